@@ -23,12 +23,16 @@
 #include <libsigrok/libsigrok.h>
 
 #include <getopt.h>
+#include <string.h>
 
 #include <QtGui/QApplication>
 #include <QDebug>
 
 #include "signalhandler.h"
 #include "pv/mainwindow.h"
+#include "pv/data/logicsnapshot.h"
+#include "pv/data/storage.h"
+#include "pv/sigsession.h"
 
 #include "config.h"
 
@@ -40,6 +44,16 @@ void usage()
 		"\n"
 		"Help Options:\n"
 		"  -l, --loglevel                  Set libsigrok/libsigrokdecode loglevel\n"
+		"  -m, --ram-threshold             Set the RAM in MiB captures may use before\n"
+		"                                  spilling to disk\n"
+		"  -L, --logic-layout              Set the logic data layout: interleaved,\n"
+		"                                  run-length or bit-plane\n"
+		"  -b, --memory-budget             Set the MiB the captured data of the session\n"
+		"                                  may take before old captures are discarded\n"
+		"  -r, --ring-buffer               Capture until stopped, keeping the last\n"
+		"                                  given number of seconds\n"
+		"  -f, --frame-rate                Set the most times a second the view is\n"
+		"                                  updated during a capture (default 30)\n"
 		"  -V, --version                   Show release version\n"
 		"  -h, -?, --help                  Show help option\n"
 		"\n", PV_BIN_NAME, PV_DESCRIPTION);
@@ -62,13 +76,18 @@ int main(int argc, char *argv[])
 	while (1) {
 		static const struct option long_options[] = {
 			{"loglevel", required_argument, 0, 'l'},
+			{"ram-threshold", required_argument, 0, 'm'},
+			{"logic-layout", required_argument, 0, 'L'},
+			{"memory-budget", required_argument, 0, 'b'},
+			{"ring-buffer", required_argument, 0, 'r'},
+			{"frame-rate", required_argument, 0, 'f'},
 			{"version", no_argument, 0, 'V'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}
 		};
 
 		const int c = getopt_long(argc, argv,
-			"l:Vh?", long_options, NULL);
+			"l:m:L:b:r:f:Vh?", long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -81,6 +100,61 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		case 'm':
+		{
+			const uint64_t threshold = strtoull(optarg, NULL, 10);
+			pv::data::Storage::set_ram_threshold(threshold << 20);
+			break;
+		}
+
+		case 'L':
+			if (strcmp(optarg, "interleaved") == 0)
+				pv::data::LogicSnapshot::set_default_layout(
+					pv::data::LogicSnapshot::Interleaved);
+			else if (strcmp(optarg, "run-length") == 0)
+				pv::data::LogicSnapshot::set_default_layout(
+					pv::data::LogicSnapshot::RunLength);
+			else if (strcmp(optarg, "bit-plane") == 0)
+				pv::data::LogicSnapshot::set_default_layout(
+					pv::data::LogicSnapshot::BitPlane);
+			else {
+				fprintf(stderr, "Unknown logic layout: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+
+		case 'b':
+		{
+			const uint64_t budget = strtoull(optarg, NULL, 10);
+			pv::SigSession::set_memory_budget(budget << 20);
+			break;
+		}
+
+		case 'r':
+		{
+			const double seconds = atof(optarg);
+			if (seconds <= 0) {
+				fprintf(stderr, "Invalid ring buffer duration: "
+					"%s\n", optarg);
+				return 1;
+			}
+			pv::SigSession::set_ring_duration(seconds);
+			break;
+		}
+
+		case 'f':
+		{
+			const double frame_rate = atof(optarg);
+			if (frame_rate <= 0) {
+				fprintf(stderr, "Invalid frame rate: %s\n",
+					optarg);
+				return 1;
+			}
+			pv::SigSession::set_frame_rate(frame_rate);
+			break;
+		}
+
 		case 'V':
 			// Print version info
 			fprintf(stdout, "%s %s\n", PV_TITLE, PV_VERSION_STRING);
@@ -130,12 +204,13 @@ int main(int argc, char *argv[])
 			if(SignalHandler::prepare_signals()) {
 				SignalHandler *const handler =
 					new SignalHandler(&w);
+				// Close every window, not just the first
 				QObject::connect(handler,
 					SIGNAL(int_received()),
-					&w, SLOT(close()));
+					&a, SLOT(closeAllWindows()));
 				QObject::connect(handler,
 					SIGNAL(term_received()),
-					&w, SLOT(close()));
+					&a, SLOT(closeAllWindows()));
     			} else {
 				qWarning() <<
 					"Could not prepare signal handler.";
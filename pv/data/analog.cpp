@@ -21,6 +21,8 @@
 #include "analog.h"
 #include "analogsnapshot.h"
 
+#include <boost/foreach.hpp>
+
 using namespace boost;
 using namespace std;
 
@@ -34,13 +36,49 @@ Analog::Analog(uint64_t samplerate) :
 
 void Analog::push_snapshot(shared_ptr<AnalogSnapshot> &snapshot)
 {
+	lock_guard<mutex> lock(_snapshots_mutex);
 	_snapshots.push_front(snapshot);
 }
 
-deque< shared_ptr<AnalogSnapshot> >& Analog::get_snapshots()
+deque< shared_ptr<AnalogSnapshot> > Analog::get_snapshots() const
 {
+	lock_guard<mutex> lock(_snapshots_mutex);
 	return _snapshots;
 }
 
+void Analog::clear_snapshots()
+{
+	// The snapshots are freed once the lock is let go, if nothing else
+	// holds them
+	deque< shared_ptr<AnalogSnapshot> > snapshots;
+	lock_guard<mutex> lock(_snapshots_mutex);
+	_snapshots.swap(snapshots);
+}
+
+uint64_t Analog::get_memory_usage() const
+{
+	lock_guard<mutex> lock(_snapshots_mutex);
+	uint64_t usage = 0;
+	BOOST_FOREACH(const shared_ptr<AnalogSnapshot> &s, _snapshots)
+		usage += s->get_memory_usage();
+	return usage;
+}
+
+bool Analog::discard_oldest_snapshot()
+{
+	// The snapshot is freed once the lock is let go, if the view does
+	// not hold it
+	shared_ptr<AnalogSnapshot> snapshot;
+	lock_guard<mutex> lock(_snapshots_mutex);
+
+	if (_snapshots.size() < 2)
+		return false;
+
+	// New snapshots are pushed onto the front
+	snapshot = _snapshots.back();
+	_snapshots.pop_back();
+	return true;
+}
+
 } // namespace data
 } // namespace pv
@@ -24,6 +24,8 @@
 #include "signaldata.h"
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
 #include <deque>
 
 namespace pv {
@@ -39,10 +41,34 @@ public:
 	void push_snapshot(
 		boost::shared_ptr<AnalogSnapshot> &snapshot);
 
-	std::deque< boost::shared_ptr<AnalogSnapshot> >&
-		get_snapshots();
+	/**
+	 * Gets the snapshots, newest first. The list is copied, so that
+	 * the snapshots stay alive while they are read, even if they are
+	 * replaced or discarded by the storage thread meanwhile.
+	 */
+	std::deque< boost::shared_ptr<AnalogSnapshot> > get_snapshots() const;
+
+	/**
+	 * Drops every snapshot, so that only the next one pushed is kept.
+	 */
+	void clear_snapshots();
+
+	/**
+	 * Gets the number of bytes held by the snapshots, including the
+	 * indices built over them.
+	 */
+	uint64_t get_memory_usage() const;
+
+	/**
+	 * Discards the oldest snapshot, unless it is the only one left.
+	 * @return Returns false if there was no snapshot to discard.
+	 */
+	bool discard_oldest_snapshot();
 
 private:
+	/// Guards the list of snapshots, which the storage thread changes
+	/// while the view reads it.
+	mutable boost::mutex _snapshots_mutex;
 	std::deque< boost::shared_ptr<AnalogSnapshot> > _snapshots;
 };
 
@@ -26,10 +26,12 @@
 #include <math.h>
 
 #include <algorithm>
+#include <new>
 
 #include <boost/foreach.hpp>
 
 #include "analogsnapshot.h"
+#include "simd.h"
 
 using namespace boost;
 using namespace std;
@@ -43,85 +45,138 @@ const float AnalogSnapshot::LogEnvelopeScaleFactor =
 	logf(EnvelopeScaleFactor);
 const uint64_t AnalogSnapshot::EnvelopeDataUnit = 64*1024;	// bytes
 
-AnalogSnapshot::AnalogSnapshot(const sr_datafeed_analog &analog) :
-	Snapshot(sizeof(float))
+AnalogSnapshot::AnalogSnapshot(const sr_datafeed_analog &analog,
+	uint64_t ring_length) :
+	Snapshot(sizeof(float), ring_length),
+	_envelope_kernel(Simd::get_analog_envelope_kernel()),
+	_reduction_kernel(Simd::get_analog_reduction_kernel())
 {
-	lock_guard<recursive_mutex> lock(_mutex);
 	memset(_envelope_levels, 0, sizeof(_envelope_levels));
+	for (unsigned int level = 0; level < ScaleStepCount; level++)
+		_envelope_levels[level].mask = get_ring_mask(
+			(level + 1) * EnvelopeScalePower);
+
 	append_payload(analog);
 }
 
 AnalogSnapshot::~AnalogSnapshot()
 {
-	lock_guard<recursive_mutex> lock(_mutex);
+	stop_indexing_thread();
+
+	lock_guard<shared_mutex> lock(_mutex);
 	BOOST_FOREACH(Envelope &e, _envelope_levels)
-		free(e.samples);
+		_storage.release(e.samples,
+			e.data_length * sizeof(EnvelopeSample));
 }
 
 void AnalogSnapshot::append_payload(
 	const sr_datafeed_analog &analog)
 {
-	lock_guard<recursive_mutex> lock(_mutex);
-	append_data(analog.data, analog.num_samples);
+	append_or_defer(analog.data, analog.num_samples);
+}
 
-	// Generate the first mip-map from the data
-	append_payload_to_envelope_levels();
+void AnalogSnapshot::append_samples(const void *data, uint64_t samples)
+{
+	append_data(data, samples);
 }
 
-const float* AnalogSnapshot::get_samples(
-	int64_t start_sample, int64_t end_sample) const
+void AnalogSnapshot::update_index(uint64_t end)
 {
-	assert(start_sample >= 0);
-	assert(start_sample < (int64_t)_sample_count);
-	assert(end_sample >= 0);
-	assert(end_sample < (int64_t)_sample_count);
-	assert(start_sample <= end_sample);
-
-	lock_guard<recursive_mutex> lock(_mutex);
-
-	float *const data = new float[end_sample - start_sample];
-	memcpy(data, (float*)_data + start_sample, sizeof(float) *
-		(end_sample - start_sample));
-	return data;
+	append_payload_to_envelope_levels(end);
 }
 
-void AnalogSnapshot::get_envelope_section(EnvelopeSection &s,
-	uint64_t start, uint64_t end, float min_length) const
+const float* AnalogSnapshot::get_samples(const Pin &pin,
+	uint64_t start, uint64_t end, uint64_t &length) const
 {
-	assert(end <= get_sample_count());
+	assert_pinned(pin);
+	assert(start < end);
+	assert(end <= _sample_count);
+
+	const uint8_t *const ptr = get_raw_samples(start, end, length);
+	_storage.prefetch(ptr, length * sizeof(float));
+	return (const float*)ptr;
+}
+
+void AnalogSnapshot::get_envelope_section(const Pin &pin,
+	EnvelopeSection &s, uint64_t start, uint64_t end,
+	float min_length) const
+{
+	assert_pinned(pin);
+	assert(end <= _sample_count);
 	assert(start <= end);
 	assert(min_length > 0);
 
-	lock_guard<recursive_mutex> lock(_mutex);
-
-	const unsigned int min_level = max((int)floorf(logf(min_length) /
+	unsigned int min_level = max((int)floorf(logf(min_length) /
 		LogEnvelopeScaleFactor) - 1, 0);
+
+	// Levels too coarse to be kept in a ring are not built
+	while (_envelope_levels[min_level].mask == 0)
+		min_level--;
+
+	const Envelope &e = _envelope_levels[min_level];
 	const unsigned int scale_power = (min_level + 1) *
 		EnvelopeScalePower;
-	start >>= scale_power;
+	const uint64_t start_sample = _first_chunk << ChunkSizePower;
+
+	// Leave out envelope samples which reach back past the samples
+	// kept by a ring buffer
+	start = max(start >> scale_power,
+		(start_sample + (1 << scale_power) - 1) >> scale_power);
 	end >>= scale_power;
 
+	// The envelope may not have been built up to the end yet
+	end = min(end, e.length);
+	start = min(start, end);
+
 	s.start = start << scale_power;
 	s.scale = 1 << scale_power;
-	s.length = end - start;
-	s.samples = new EnvelopeSample[s.length];
-	memcpy(s.samples, _envelope_levels[min_level].samples + start,
-		s.length * sizeof(EnvelopeSample));
+	s.length = (start == end) ? 0 :
+		min(end - start - 1, e.mask - (start & e.mask)) + 1;
+	s.samples = e.samples + (start & e.mask);
+	_storage.prefetch(s.samples, s.length * sizeof(EnvelopeSample));
 }
 
-void AnalogSnapshot::reallocate_envelope(Envelope &e)
+bool AnalogSnapshot::reserve_samples(uint64_t sample_count)
+{
+	// The envelope is reserved first, because a failed reservation
+	// only releases the sample buffers
+	for (unsigned int level = 0; level < ScaleStepCount; level++) {
+		Envelope &e = _envelope_levels[level];
+		if (e.mask != 0 && !reserve_envelope(e, get_ring_length(
+			sample_count >> ((level + 1) * EnvelopeScalePower),
+			e.mask)))
+			return false;
+	}
+
+	return reserve_data_chunks(sample_count);
+}
+
+bool AnalogSnapshot::reserve_envelope(Envelope &e, uint64_t length)
 {
-	const uint64_t new_data_length = ((e.length + EnvelopeDataUnit - 1) /
+	const uint64_t new_data_length = ((length + EnvelopeDataUnit - 1) /
 		EnvelopeDataUnit) * EnvelopeDataUnit;
 	if (new_data_length > e.data_length)
 	{
-		e.data_length = new_data_length;
-		e.samples = (EnvelopeSample*)realloc(e.samples,
+		void *const samples = _storage.reallocate(e.samples,
+			e.data_length * sizeof(EnvelopeSample),
 			new_data_length * sizeof(EnvelopeSample));
+		if (!samples)
+			return false;
+
+		e.samples = (EnvelopeSample*)samples;
+		e.data_length = new_data_length;
 	}
+
+	return true;
+}
+
+void AnalogSnapshot::reallocate_envelope(Envelope &e)
+{
+	if (!reserve_envelope(e, get_ring_length(e.length, e.mask)))
+		throw bad_alloc();
 }
 
-void AnalogSnapshot::append_payload_to_envelope_levels()
+void AnalogSnapshot::append_payload_to_envelope_levels(uint64_t end)
 {
 	Envelope &e0 = _envelope_levels[0];
 	uint64_t prev_length;
@@ -129,7 +184,7 @@ void AnalogSnapshot::append_payload_to_envelope_levels()
 
 	// Expand the data buffer to fit the new samples
 	prev_length = e0.length;
-	e0.length = _sample_count / EnvelopeScaleFactor;
+	e0.length = end / EnvelopeScaleFactor;
 
 	// Break off if there are no new samples to compute
 	if (e0.length == prev_length)
@@ -137,21 +192,42 @@ void AnalogSnapshot::append_payload_to_envelope_levels()
 
 	reallocate_envelope(e0);
 
-	dest_ptr = e0.samples + prev_length;
-
-	// Iterate through the samples to populate the first level mipmap
-	const float *const end_src_ptr = (float*)_data +
-		e0.length * EnvelopeScaleFactor;
-	for (const float *src_ptr = (float*)_data +
-		prev_length * EnvelopeScaleFactor;
-		src_ptr < end_src_ptr; src_ptr += EnvelopeScaleFactor)
+	// Iterate through the samples to populate the first level mipmap.
+	// The chunk size is a multiple of the envelope scale factor, so a
+	// block of samples never straddles two chunks.
+	uint64_t index = prev_length * EnvelopeScaleFactor;
+	const uint64_t end_index = e0.length * EnvelopeScaleFactor;
+	while (index < end_index)
 	{
-		const EnvelopeSample sub_sample = {
-			*min_element(src_ptr, src_ptr + EnvelopeScaleFactor),
-			*max_element(src_ptr, src_ptr + EnvelopeScaleFactor),
-		};
+		uint64_t length;
+		const float *src_ptr = (const float*)get_raw_samples(
+			index, end_index, length);
+
+		// The ring of a level holds a whole number of chunks, so
+		// the envelope samples of a span never wrap around it
+		dest_ptr = e0.samples +
+			((index / EnvelopeScaleFactor) & e0.mask);
+		index += length;
+
+		if (_envelope_kernel) {
+			_envelope_kernel((float*)dest_ptr, src_ptr,
+				length / EnvelopeScaleFactor);
+			dest_ptr += length / EnvelopeScaleFactor;
+			continue;
+		}
 
-		*dest_ptr++ = sub_sample;
+		const float *const end_src_ptr = src_ptr + length;
+		for (; src_ptr < end_src_ptr; src_ptr += EnvelopeScaleFactor)
+		{
+			const EnvelopeSample sub_sample = {
+				*min_element(src_ptr,
+					src_ptr + EnvelopeScaleFactor),
+				*max_element(src_ptr,
+					src_ptr + EnvelopeScaleFactor),
+			};
+
+			*dest_ptr++ = sub_sample;
+		}
 	}
 
 	// Compute higher level mipmaps
@@ -160,6 +236,10 @@ void AnalogSnapshot::append_payload_to_envelope_levels()
 		Envelope &e = _envelope_levels[level];
 		const Envelope &el = _envelope_levels[level-1];
 
+		// Break off at levels too coarse to be kept in a ring
+		if (e.mask == 0)
+			break;
+
 		// Expand the data buffer to fit the new samples
 		prev_length = e.length;
 		e.length = el.length / EnvelopeScaleFactor;
@@ -170,25 +250,44 @@ void AnalogSnapshot::append_payload_to_envelope_levels()
 
 		reallocate_envelope(e);
 
-		// Subsample the level lower level
-		const EnvelopeSample *src_ptr =
-			el.samples + prev_length * EnvelopeScaleFactor;
-		const EnvelopeSample *const end_dest_ptr = e.samples + e.length;
-		for (dest_ptr = e.samples + prev_length;
-			dest_ptr < end_dest_ptr; dest_ptr++)
+		// Subsample the level lower level, a stretch at a time up to
+		// where the ring wraps around. The ring of the lower level is
+		// longer by the scale factor, so it wraps at the same place.
+		for (uint64_t offset = prev_length; offset < e.length;)
 		{
-			const EnvelopeSample *const end_src_ptr =
-				src_ptr + EnvelopeScaleFactor;
+			const uint64_t length = min(e.length - offset - 1,
+				e.mask - (offset & e.mask)) + 1;
+
+			const EnvelopeSample *src_ptr = el.samples +
+				((offset * EnvelopeScaleFactor) & el.mask);
+			dest_ptr = e.samples + (offset & e.mask);
+			offset += length;
+
+			if (_reduction_kernel) {
+				_reduction_kernel((float*)dest_ptr,
+					(const float*)src_ptr, length);
+				continue;
+			}
 
-			EnvelopeSample sub_sample = *src_ptr++;
-			while (src_ptr < end_src_ptr)
+			const EnvelopeSample *const end_dest_ptr =
+				dest_ptr + length;
+			for (; dest_ptr < end_dest_ptr; dest_ptr++)
 			{
-				sub_sample.min = min(sub_sample.min, src_ptr->min);
-				sub_sample.max = max(sub_sample.max, src_ptr->max);
-				src_ptr++;
+				const EnvelopeSample *const end_src_ptr =
+					src_ptr + EnvelopeScaleFactor;
+
+				EnvelopeSample sub_sample = *src_ptr++;
+				while (src_ptr < end_src_ptr)
+				{
+					sub_sample.min = min(sub_sample.min,
+						src_ptr->min);
+					sub_sample.max = max(sub_sample.max,
+						src_ptr->max);
+					src_ptr++;
+				}
+
+				*dest_ptr = sub_sample;
 			}
-
-			*dest_ptr = sub_sample;
 		}
 	}
 }
@@ -21,6 +21,7 @@
 #ifndef PULSEVIEW_PV_DATA_ANALOGSNAPSHOT_H
 #define PULSEVIEW_PV_DATA_ANALOGSNAPSHOT_H
 
+#include "simd.h"
 #include "snapshot.h"
 
 #include <utility>
@@ -28,6 +29,9 @@
 
 namespace AnalogSnapshotTest {
 class Basic;
+class SimdKernels;
+class Views;
+class RingBuffer;
 }
 
 namespace pv {
@@ -47,7 +51,7 @@ public:
 		uint64_t start;
 		unsigned int scale;
 		uint64_t length;
-		EnvelopeSample *samples;
+		const EnvelopeSample *samples;
 	};
 
 private:
@@ -56,6 +60,9 @@ private:
 		uint64_t length;
 		uint64_t data_length;
 		EnvelopeSample *samples;
+
+		/// Wraps the offsets of the level around its buffer.
+		uint64_t mask;
 	};
 
 private:
@@ -66,27 +73,78 @@ private:
 	static const uint64_t EnvelopeDataUnit;
 
 public:
-	AnalogSnapshot(const sr_datafeed_analog &analog);
+	/**
+	 * Constructor.
+	 * @param analog The first payload of the snapshot.
+	 * @param ring_length The number of samples to keep, or 0 to keep
+	 *   them all.
+	 */
+	AnalogSnapshot(const sr_datafeed_analog &analog,
+		uint64_t ring_length = 0);
 
 	virtual ~AnalogSnapshot();
 
 	void append_payload(const sr_datafeed_analog &analog);
 
-	const float* get_samples(int64_t start_sample,
-		int64_t end_sample) const;
-
-	void get_envelope_section(EnvelopeSection &s,
+	/**
+	 * Gets a read-only view onto a run of samples which are stored
+	 * contiguously in a single chunk.
+	 * @param pin A pin held on this snapshot. The view is valid for as
+	 *   long as the pin is held.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one wanted.
+	 * @param[out] length The number of samples from start that can be
+	 *   read from the returned pointer. This stops at the end of the
+	 *   chunk, so it may be less than end - start.
+	 * @return Returns a pointer to the start sample.
+	 */
+	const float* get_samples(const Pin &pin, uint64_t start,
+		uint64_t end, uint64_t &length) const;
+
+	/**
+	 * Gets a read-only view onto the envelope of a range of samples.
+	 * In a ring buffer, the section stops where the envelope wraps
+	 * around, so it may end short of the range. The rest of the range
+	 * follows on from the end of the section.
+	 * @param pin A pin held on this snapshot. The section is valid for
+	 *   as long as the pin is held.
+	 * @param[out] s The envelope section.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one.
+	 * @param min_length The number of samples which may be merged into
+	 *   each envelope sample.
+	 */
+	void get_envelope_section(const Pin &pin, EnvelopeSection &s,
 		uint64_t start, uint64_t end, float min_length) const;
 
 private:
-	void reallocate_envelope(Envelope &l);
+	void append_samples(const void *data, uint64_t samples);
+
+	void update_index(uint64_t end);
 
-	void append_payload_to_envelope_levels();
+	bool reserve_samples(uint64_t sample_count);
+
+	/**
+	 * Grows the buffer of an envelope level to hold at least a number
+	 * of samples.
+	 * @return Returns false if the buffer could not be grown.
+	 */
+	bool reserve_envelope(Envelope &e, uint64_t length);
+
+	void reallocate_envelope(Envelope &e);
+
+	void append_payload_to_envelope_levels(uint64_t end);
 
 private:
 	struct Envelope _envelope_levels[ScaleStepCount];
 
+	const Simd::AnalogEnvelopeKernel _envelope_kernel;
+	const Simd::AnalogReductionKernel _reduction_kernel;
+
 	friend class AnalogSnapshotTest::Basic;
+	friend class AnalogSnapshotTest::SimdKernels;
+	friend class AnalogSnapshotTest::Views;
+	friend class AnalogSnapshotTest::RingBuffer;
 };
 
 } // namespace data
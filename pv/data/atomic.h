@@ -0,0 +1,92 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_ATOMIC_H
+#define PULSEVIEW_PV_DATA_ATOMIC_H
+
+#ifndef __ATOMIC_ACQUIRE
+#include <boost/thread.hpp>
+#endif
+
+namespace pv {
+namespace data {
+
+#ifndef __ATOMIC_ACQUIRE
+/**
+ * Guards the values shared between threads, on compilers without the
+ * __atomic builtins. Taking a lock fences memory on every platform
+ * boost supports.
+ */
+inline boost::mutex& atomic_mutex()
+{
+	static boost::mutex m;
+	return m;
+}
+#endif
+
+/**
+ * Reads a value which another thread stores, after which the writes
+ * it made before the store are seen.
+ */
+template<typename T>
+inline T load_acquire(const T *p)
+{
+#ifdef __ATOMIC_ACQUIRE
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+	boost::lock_guard<boost::mutex> lock(atomic_mutex());
+	return *p;
+#endif
+}
+
+/**
+ * Stores a value for another thread, once the writes before it have
+ * been made.
+ */
+template<typename T, typename U>
+inline void store_release(T *p, U x)
+{
+#ifdef __ATOMIC_RELEASE
+	__atomic_store_n(p, (T)x, __ATOMIC_RELEASE);
+#else
+	boost::lock_guard<boost::mutex> lock(atomic_mutex());
+	*p = (T)x;
+#endif
+}
+
+/**
+ * Orders every read and write before the fence with every one after
+ * it, including a store before it with a load after it. Two threads
+ * which each store a flag and then read the other's need this, so
+ * that at least one sees the other's store.
+ */
+inline void memory_fence()
+{
+#ifdef __ATOMIC_SEQ_CST
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#else
+	boost::lock_guard<boost::mutex> lock(atomic_mutex());
+#endif
+}
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_ATOMIC_H
@@ -21,6 +21,8 @@
 #include "logic.h"
 #include "logicsnapshot.h"
 
+#include <boost/foreach.hpp>
+
 using namespace boost;
 using namespace std;
 
@@ -29,7 +31,10 @@ namespace data {
 
 Logic::Logic(unsigned int num_probes, uint64_t samplerate) :
 	SignalData(samplerate),
-	_num_probes(num_probes)
+	_num_probes(num_probes),
+	_edges_start(0),
+	_edges_end(0),
+	_edges_min_length(0)
 {
 	assert(_num_probes > 0);
 }
@@ -42,13 +47,77 @@ int Logic::get_num_probes() const
 void Logic::push_snapshot(
 	shared_ptr<LogicSnapshot> &snapshot)
 {
+	lock_guard<mutex> lock(_snapshots_mutex);
 	_snapshots.push_front(snapshot);
 }
 
-deque< shared_ptr<LogicSnapshot> >& Logic::get_snapshots()
+deque< shared_ptr<LogicSnapshot> > Logic::get_snapshots() const
 {
+	lock_guard<mutex> lock(_snapshots_mutex);
 	return _snapshots;
 }
 
+void Logic::clear_snapshots()
+{
+	// The snapshots are freed once the lock is let go, if nothing else
+	// holds them
+	deque< shared_ptr<LogicSnapshot> > snapshots;
+	lock_guard<mutex> lock(_snapshots_mutex);
+	_snapshots.swap(snapshots);
+}
+
+uint64_t Logic::get_memory_usage() const
+{
+	lock_guard<mutex> lock(_snapshots_mutex);
+	uint64_t usage = 0;
+	BOOST_FOREACH(const shared_ptr<LogicSnapshot> &s, _snapshots)
+		usage += s->get_memory_usage();
+	return usage;
+}
+
+bool Logic::discard_oldest_snapshot()
+{
+	// The snapshot is freed once the lock is let go, if the view does
+	// not hold it. The cached edges only refer to it weakly, so they
+	// are left to the view.
+	shared_ptr<LogicSnapshot> snapshot;
+	lock_guard<mutex> lock(_snapshots_mutex);
+
+	if (_snapshots.size() < 2)
+		return false;
+
+	// New snapshots are pushed onto the front
+	snapshot = _snapshots.back();
+	_snapshots.pop_back();
+	return true;
+}
+
+const vector< pair<int64_t, bool> >& Logic::get_subsampled_edges(
+	const shared_ptr<LogicSnapshot> &snapshot,
+	uint64_t start, uint64_t end, float min_length, int probe_index)
+{
+	assert(snapshot);
+	assert(probe_index >= 0);
+
+	if (snapshot != _edges_snapshot.lock() || start != _edges_start ||
+		end != _edges_end || min_length != _edges_min_length) {
+		// Extract every probe in the snapshot, because the probes
+		// being shown need not be the first ones
+		const unsigned int words =
+			(snapshot->get_probe_count() + 63) / 64;
+		for (unsigned int word = 0; word < words; word++)
+			snapshot->get_subsampled_edges(_edges, start, end,
+				min_length, ~0ULL, word);
+
+		_edges_snapshot = snapshot;
+		_edges_start = start;
+		_edges_end = end;
+		_edges_min_length = min_length;
+	}
+
+	assert((unsigned int)probe_index < _edges.size());
+	return _edges[probe_index];
+}
+
 } // namespace data
 } // namespace pv
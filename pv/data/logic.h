@@ -24,7 +24,12 @@
 #include "signaldata.h"
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
 #include <deque>
+#include <utility>
+#include <vector>
 
 namespace pv {
 namespace data {
@@ -41,12 +46,62 @@ public:
 	void push_snapshot(
 		boost::shared_ptr<LogicSnapshot> &snapshot);
 
-	std::deque< boost::shared_ptr<LogicSnapshot> >&
-		get_snapshots();
+	/**
+	 * Gets the snapshots, newest first. The list is copied, so that
+	 * the snapshots stay alive while they are read, even if they are
+	 * replaced or discarded by the storage thread meanwhile.
+	 */
+	std::deque< boost::shared_ptr<LogicSnapshot> > get_snapshots() const;
+
+	/**
+	 * Drops every snapshot, so that only the next one pushed is kept.
+	 */
+	void clear_snapshots();
+
+	/**
+	 * Gets the number of bytes held by the snapshots, including the
+	 * indices built over them.
+	 */
+	uint64_t get_memory_usage() const;
+
+	/**
+	 * Discards the oldest snapshot, unless it is the only one left.
+	 * @return Returns false if there was no snapshot to discard.
+	 */
+	bool discard_oldest_snapshot();
+
+	/**
+	 * Gets the transitions of a probe for painting. The transitions of
+	 * all the probes are extracted together, and kept until a
+	 * different range is asked for, so that painting every probe
+	 * walks the snapshot only once.
+	 * @param snapshot The snapshot to get the transitions from.
+	 * @param start The start sample index.
+	 * @param end The end sample index.
+	 * @param min_length The minimum number of samples that can be
+	 *   resolved at this level of detail.
+	 * @param probe_index The index of the probe.
+	 */
+	const std::vector< std::pair<int64_t, bool> >& get_subsampled_edges(
+		const boost::shared_ptr<LogicSnapshot> &snapshot,
+		uint64_t start, uint64_t end, float min_length,
+		int probe_index);
 
 private:
 	const unsigned int _num_probes;
+	/// Guards the list of snapshots, which the storage thread changes
+	/// while the view reads it.
+	mutable boost::mutex _snapshots_mutex;
 	std::deque< boost::shared_ptr<LogicSnapshot> > _snapshots;
+
+	/// The snapshot the edges were extracted from. The edges are only
+	/// used from the painting thread, and a weak pointer leaves the
+	/// snapshot free to be discarded meanwhile.
+	boost::weak_ptr<LogicSnapshot> _edges_snapshot;
+	uint64_t _edges_start;
+	uint64_t _edges_end;
+	float _edges_min_length;
+	std::vector< std::vector< std::pair<int64_t, bool> > > _edges;
 };
 
 } // namespace data
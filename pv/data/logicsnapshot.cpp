@@ -25,9 +25,15 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include <algorithm>
+#include <new>
+
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 
+#include "atomic.h"
 #include "logicsnapshot.h"
+#include "simd.h"
 
 using namespace boost;
 using namespace std;
@@ -39,21 +45,83 @@ const int LogicSnapshot::MipMapScalePower = 4;
 const int LogicSnapshot::MipMapScaleFactor = 1 << MipMapScalePower;
 const float LogicSnapshot::LogMipMapScaleFactor = logf(MipMapScaleFactor);
 const uint64_t LogicSnapshot::MipMapDataUnit = 64*1024;	// bytes
+const int LogicSnapshot::LazyBlockPower = 10;
+const uint64_t LogicSnapshot::LazyBlockSize = 1 << LazyBlockPower; // samples
+
+const int LogicSnapshot::RunBlockPower = 16;
+const uint64_t LogicSnapshot::RunBlockSize = 1 << RunBlockPower; // samples
+
+const int LogicSnapshot::TransitionCountPower = 12;
+const uint64_t LogicSnapshot::TransitionCountBlockSize =
+	1 << TransitionCountPower;	// samples
+const uint64_t LogicSnapshot::TransitionCountDataUnit = 256;	// blocks
+
+LogicSnapshot::Layout LogicSnapshot::_default_layout =
+	LogicSnapshot::Interleaved;
 
-LogicSnapshot::LogicSnapshot(const sr_datafeed_logic &logic) :
-	Snapshot(logic.unitsize),
-	_last_append_sample(0)
+LogicSnapshot::LogicSnapshot(const sr_datafeed_logic &logic,
+	Layout layout, uint64_t ring_length) :
+	Snapshot(logic.unitsize, ring_length),
+	_layout((ring_length == 0) ? layout : Interleaved),
+	_last_append_sample(get_word_count(), 0),
+	_run_tail(NULL),
+	_compressed_run_block_count(0),
+	_transition_counts(NULL),
+	_transition_count_mask(get_ring_mask(TransitionCountPower)),
+	_transition_count_length(0),
+	_transition_count_data_length(0),
+	_kernels(get_kernels(_unit_size)),
+	_transition_kernel(Simd::get_logic_transition_kernel(_unit_size)),
+	_reduction_kernel(Simd::get_logic_reduction_kernel(_unit_size)),
+	_lazy_mipmap(false)
 {
-	lock_guard<recursive_mutex> lock(_mutex);
 	memset(_mip_map, 0, sizeof(_mip_map));
+	for (unsigned int level = 0; level < ScaleStepCount; level++)
+		_mip_map[level].mask = get_ring_mask(
+			(level + 1) * MipMapScalePower);
+
 	append_payload(logic);
 }
 
 LogicSnapshot::~LogicSnapshot()
 {
-	lock_guard<recursive_mutex> lock(_mutex);
+	stop_indexing_thread();
+
+	lock_guard<shared_mutex> lock(_mutex);
 	BOOST_FOREACH(MipMapLevel &l, _mip_map)
-		free(l.data);
+		_storage.release(l.data, l.data_length * _unit_size +
+			sizeof(uint64_t));
+
+	BOOST_FOREACH(const RunBlock &b, _run_blocks)
+		_storage.release(b.data, get_run_block_size(b));
+	_storage.release(_run_tail, RunBlockSize * _unit_size +
+		sizeof(uint64_t));
+
+	BOOST_FOREACH(uint64_t *c, _bit_plane_chunks)
+		_storage.release(c, ChunkSize / 8 * _unit_size * 8);
+
+	_storage.release(_transition_counts, _transition_count_data_length *
+		_unit_size * 8 * sizeof(uint64_t));
+}
+
+LogicSnapshot::Layout LogicSnapshot::get_default_layout()
+{
+	return _default_layout;
+}
+
+void LogicSnapshot::set_default_layout(Layout layout)
+{
+	_default_layout = layout;
+}
+
+LogicSnapshot::Layout LogicSnapshot::get_layout() const
+{
+	return _layout;
+}
+
+unsigned int LogicSnapshot::get_probe_count() const
+{
+	return _unit_size * 8;
 }
 
 void LogicSnapshot::append_payload(
@@ -62,40 +130,283 @@ void LogicSnapshot::append_payload(
 	assert(_unit_size == logic.unitsize);
 	assert((logic.length % _unit_size) == 0);
 
-	lock_guard<recursive_mutex> lock(_mutex);
+	append_or_defer(logic.data, logic.length / _unit_size);
+}
 
-	append_data(logic.data, logic.length / _unit_size);
+void LogicSnapshot::append_samples(const void *data, uint64_t samples)
+{
+	if (_layout == RunLength) {
+		append_run_length_data((const uint8_t*)data, samples);
+		return;
+	}
 
-	// Generate the first mip-map from the data
-	append_payload_to_mipmap();
+	if (_layout == BitPlane)
+		append_bit_plane_data((const uint8_t*)data, samples);
+	else
+		append_data(data, samples);
 }
 
-void LogicSnapshot::reallocate_mipmap_level(MipMapLevel &m)
+void LogicSnapshot::update_index(uint64_t end)
+{
+	// New samples are reduced from the whole of each level below
+	if (_lazy_mipmap)
+		build_lazy_levels();
+
+	append_payload_to_mipmap(end);
+	append_payload_to_transition_counts(end);
+
+	if (_layout == RunLength)
+		compress_run_blocks(end);
+}
+
+bool LogicSnapshot::reserve_samples(uint64_t sample_count)
+{
+	// The index is reserved first, because a failed reservation only
+	// releases the sample buffers
+	for (unsigned int level = 0; level < ScaleStepCount; level++) {
+		MipMapLevel &m = _mip_map[level];
+		if (m.mask != 0 && !reserve_mipmap_level(m, get_ring_length(
+			sample_count >> ((level + 1) * MipMapScalePower),
+			m.mask)))
+			return false;
+	}
+
+	if (!reserve_transition_counts(get_ring_length(
+		sample_count >> TransitionCountPower, _transition_count_mask)))
+		return false;
+
+	switch (_layout) {
+	case RunLength:
+		// The size of the compressed blocks cannot be known ahead
+		return true;
+
+	case BitPlane:
+		return reserve_bit_plane_chunks(sample_count);
+
+	default:
+		return reserve_data_chunks(sample_count);
+	}
+}
+
+void LogicSnapshot::append_run_length_data(const uint8_t *data,
+	uint64_t samples)
 {
-	const uint64_t new_data_length = ((m.length + MipMapDataUnit - 1) /
+	while (samples > 0)
+	{
+		const uint64_t offset = _sample_count & (RunBlockSize - 1);
+
+		// Samples are collected raw in the tail block until it
+		// is full, then it is compressed
+		if (!_run_tail) {
+			_run_tail = (uint8_t*)_storage.allocate(
+				RunBlockSize * _unit_size + sizeof(uint64_t));
+			if (!_run_tail)
+				throw bad_alloc();
+			memset(_run_tail + RunBlockSize * _unit_size, 0,
+				sizeof(uint64_t));
+		}
+
+		const uint64_t length = min(samples, RunBlockSize - offset);
+		memcpy(_run_tail + offset * _unit_size, data,
+			length * _unit_size);
+
+		data += length * _unit_size;
+		samples -= length;
+		_sample_count += length;
+
+		// A full tail is held raw until the index has been
+		// brought up to date over it, because the index reads
+		// spans of raw samples
+		if (offset + length == RunBlockSize) {
+			RunBlock b;
+			b.run_count = 0;
+			b.data = _run_tail;
+			_run_tail = NULL;
+			_run_blocks.push_back(b);
+		}
+	}
+}
+
+void LogicSnapshot::compress_run_blocks(uint64_t end)
+{
+	assert((end >> RunBlockPower) <= _run_blocks.size());
+	while (_compressed_run_block_count < (end >> RunBlockPower))
+		compress_run_block(
+			_run_blocks[_compressed_run_block_count++]);
+}
+
+void LogicSnapshot::compress_run_block(RunBlock &b)
+{
+	assert(b.run_count == 0);
+	uint8_t *const raw = b.data;
+
+	// Count the runs in the block
+	unsigned int run_count = 1;
+	for (uint64_t i = 1; i < RunBlockSize; i++)
+		if (memcmp(raw + i * _unit_size,
+			raw + (i - 1) * _unit_size, _unit_size) != 0)
+			run_count++;
+
+	// The block does not compress, so keep it raw
+	if (run_count * (sizeof(uint16_t) + _unit_size) >=
+		RunBlockSize * _unit_size)
+		return;
+
+	RunBlock c;
+	c.run_count = run_count;
+	c.data = (uint8_t*)_storage.allocate(get_run_block_size(c));
+	if (!c.data)
+		throw bad_alloc();
+
+	uint16_t *starts = (uint16_t*)c.data;
+	uint8_t *values = c.data + c.run_count * sizeof(uint16_t);
+
+	*starts++ = 0;
+	memcpy(values, raw, _unit_size);
+	for (uint64_t i = 1; i < RunBlockSize; i++) {
+		const uint8_t *const sample = raw + i * _unit_size;
+		if (memcmp(sample, values, _unit_size) != 0) {
+			*starts++ = i;
+			values += _unit_size;
+			memcpy(values, sample, _unit_size);
+		}
+	}
+
+	// Padding is added to allow for the uint64_t read word
+	memset(values + _unit_size, 0, sizeof(uint64_t));
+
+	_storage.release(raw, get_run_block_size(b));
+	b = c;
+}
+
+uint64_t LogicSnapshot::get_run_block_size(const RunBlock &b) const
+{
+	if (b.run_count == 0)
+		return RunBlockSize * _unit_size + sizeof(uint64_t);
+	return b.run_count * (sizeof(uint16_t) + _unit_size) +
+		sizeof(uint64_t);
+}
+
+void LogicSnapshot::append_bit_plane_data(const uint8_t *data,
+	uint64_t samples)
+{
+	const int probe_count = _unit_size * 8;
+	const uint64_t chunk_words = ChunkSize / 64;
+
+	while (samples > 0)
+	{
+		const uint64_t chunk = _sample_count >> ChunkSizePower;
+		if (chunk == _bit_plane_chunks.size() &&
+			!allocate_bit_plane_chunk())
+			throw bad_alloc();
+
+		uint64_t *const word = _bit_plane_chunks[chunk] +
+			((_sample_count & (ChunkSize - 1)) >> 6);
+		const int shift = _sample_count & 63;
+		uint64_t length;
+
+		if ((shift & 7) == 0 && samples >= 8) {
+			// Transpose 8 samples at a time, a byte of probes
+			// at a time
+			for (int b = 0; b < _unit_size; b++) {
+				uint64_t x = 0;
+				for (int i = 0; i < 8; i++)
+					x |= (uint64_t)data[i * _unit_size + b] <<
+						(i * 8);
+				x = transpose_8x8(x);
+
+				for (int i = 0; i < 8; i++)
+					word[(b * 8 + i) * chunk_words] |=
+						((x >> (i * 8)) & 0xFF) << shift;
+			}
+
+			length = 8;
+		} else {
+			for (int p = 0; p < probe_count; p++)
+				if (data[p / 8] & (1 << (p % 8)))
+					word[p * chunk_words] |= 1ULL << shift;
+			length = 1;
+		}
+
+		data += length * _unit_size;
+		samples -= length;
+		_sample_count += length;
+	}
+}
+
+bool LogicSnapshot::allocate_bit_plane_chunk()
+{
+	// The samples are ORed into the planes, so new chunks must start
+	// out cleared
+	const uint64_t chunk_bytes = ChunkSize / 8 * _unit_size * 8;
+	uint64_t *const c = (uint64_t*)_storage.allocate(chunk_bytes);
+	if (!c)
+		return false;
+	memset(c, 0, chunk_bytes);
+	_bit_plane_chunks.push_back(c);
+	return true;
+}
+
+bool LogicSnapshot::reserve_bit_plane_chunks(uint64_t sample_count)
+{
+	const size_t prev_chunk_count = _bit_plane_chunks.size();
+	const uint64_t chunk_count =
+		(sample_count + ChunkSize - 1) >> ChunkSizePower;
+
+	while (_bit_plane_chunks.size() < chunk_count)
+		if (!allocate_bit_plane_chunk()) {
+			while (_bit_plane_chunks.size() > prev_chunk_count) {
+				_storage.release(_bit_plane_chunks.back(),
+					ChunkSize / 8 * _unit_size * 8);
+				_bit_plane_chunks.pop_back();
+			}
+			return false;
+		}
+
+	return true;
+}
+
+bool LogicSnapshot::reserve_mipmap_level(MipMapLevel &m, uint64_t length)
+{
+	const uint64_t new_data_length = ((length + MipMapDataUnit - 1) /
 		MipMapDataUnit) * MipMapDataUnit;
 	if (new_data_length > m.data_length)
 	{
-		m.data_length = new_data_length;
-
 		// Padding is added to allow for the uint64_t write word
-		m.data = realloc(m.data, new_data_length * _unit_size +
-			sizeof(uint64_t));
+		void *const data = _storage.reallocate(m.data,
+			m.data_length * _unit_size + sizeof(uint64_t),
+			new_data_length * _unit_size + sizeof(uint64_t));
+		if (!data)
+			return false;
+
+		m.data = data;
+		m.data_length = new_data_length;
 	}
+
+	return true;
+}
+
+void LogicSnapshot::reallocate_mipmap_level(MipMapLevel &m)
+{
+	if (!reserve_mipmap_level(m, get_ring_length(m.length, m.mask)))
+		throw bad_alloc();
+}
+
+uint8_t* LogicSnapshot::get_mipmap_sample(unsigned int level,
+	uint64_t offset) const
+{
+	const MipMapLevel &m = _mip_map[level];
+	assert(m.data);
+	return (uint8_t*)m.data + (offset & m.mask) * _unit_size;
 }
 
-void LogicSnapshot::append_payload_to_mipmap()
+void LogicSnapshot::append_payload_to_mipmap(uint64_t end)
 {
 	MipMapLevel &m0 = _mip_map[0];
-	uint64_t prev_length;
-	const uint8_t *src_ptr;
-	uint8_t *dest_ptr;
-	uint64_t accumulator;
-	unsigned int diff_counter;
 
 	// Expand the data buffer to fit the new samples
-	prev_length = m0.length;
-	m0.length = _sample_count / MipMapScaleFactor;
+	const uint64_t prev_length = m0.length;
+	m0.length = end / MipMapScaleFactor;
 
 	// Break off if there are no new samples to compute
 	if (m0.length == prev_length)
@@ -103,36 +414,65 @@ void LogicSnapshot::append_payload_to_mipmap()
 
 	reallocate_mipmap_level(m0);
 
-	dest_ptr = (uint8_t*)m0.data + prev_length * _unit_size;
+	append_samples_to_mipmap(prev_length, m0.length,
+		&_last_append_sample[0]);
+	append_mipmap_levels();
+}
 
-	// Iterate through the samples to populate the first level mipmap
-	const uint8_t *const end_src_ptr = (uint8_t*)_data +
-		m0.length * _unit_size * MipMapScaleFactor;
-	for (src_ptr = (uint8_t*)_data +
-		prev_length * _unit_size * MipMapScaleFactor;
-		src_ptr < end_src_ptr;)
+void LogicSnapshot::append_samples_to_mipmap(uint64_t start, uint64_t end,
+	uint64_t *last_sample) const
+{
+	// The bit planes are not held as spans of samples
+	if (_layout == BitPlane) {
+		append_bit_planes_to_mipmap(get_mipmap_sample(0, start),
+			start, end);
+		return;
+	}
+
+	// Iterate through the samples to populate the first level mipmap.
+	// The chunk size is a multiple of the mip-map scale factor, so a
+	// block of samples never straddles two chunks.
+	uint64_t index = start * MipMapScaleFactor;
+	const uint64_t end_index = end * MipMapScaleFactor;
+
+	while (index < end_index)
 	{
-		// Accumulate transitions which have occurred in this sample
-		accumulator = 0;
-		diff_counter = MipMapScaleFactor;
-		while (diff_counter-- > 0)
-		{
-			const uint64_t sample = *(uint64_t*)src_ptr;
-			accumulator |= _last_append_sample ^ sample;
-			_last_append_sample = sample;
-			src_ptr += _unit_size;
-		}
+		uint64_t length;
+		const uint8_t *const src_ptr =
+			get_sample_span(index, end_index, length);
 
-		*(uint64_t*)dest_ptr = accumulator;
-		dest_ptr += _unit_size;
+		// The ring of a level holds a whole number of chunks, so
+		// the entries of a span never wrap around it
+		uint8_t *const dest_ptr =
+			get_mipmap_sample(0, index / MipMapScaleFactor);
+		index += length;
+
+		if (_transition_kernel)
+			_transition_kernel(dest_ptr, src_ptr,
+				length / MipMapScaleFactor, _unit_size,
+				last_sample[0]);
+		else
+			_kernels.transitions(dest_ptr, src_ptr,
+				length / MipMapScaleFactor, _unit_size,
+				last_sample);
 	}
+}
+
+void LogicSnapshot::append_mipmap_levels()
+{
+	uint64_t prev_length;
+	const uint8_t *src_ptr;
+	uint8_t *dest_ptr;
 
-	// Compute higher level mipmaps
 	for (unsigned int level = 1; level < ScaleStepCount; level++)
 	{
 		MipMapLevel &m = _mip_map[level];
 		const MipMapLevel &ml = _mip_map[level-1];
 
+		// Break off at levels too coarse to be kept in a ring
+		if (m.mask == 0)
+			break;
+
 		// Expand the data buffer to fit the new samples
 		prev_length = m.length;
 		m.length = ml.length / MipMapScaleFactor;
@@ -143,35 +483,771 @@ void LogicSnapshot::append_payload_to_mipmap()
 
 		reallocate_mipmap_level(m);
 
-		// Subsample the level lower level
-		src_ptr = (uint8_t*)ml.data +
-			_unit_size * prev_length * MipMapScaleFactor;
-		const uint8_t *const end_dest_ptr =
-			(uint8_t*)m.data + _unit_size * m.length;
-		for (dest_ptr = (uint8_t*)m.data +
-			_unit_size * prev_length;
-			dest_ptr < end_dest_ptr;
-			dest_ptr += _unit_size)
+		// Subsample the level lower level, a stretch at a time up to
+		// where the ring wraps around. The ring of the lower level is
+		// longer by the scale factor, so it wraps at the same place.
+		for (uint64_t offset = prev_length; offset < m.length;)
 		{
-			accumulator = 0;
-			diff_counter = MipMapScaleFactor;
-			while (diff_counter-- > 0)
+			const uint64_t length = min(m.length - offset - 1,
+				m.mask - (offset & m.mask)) + 1;
+
+			src_ptr = get_mipmap_sample(level - 1,
+				offset * MipMapScaleFactor);
+			dest_ptr = get_mipmap_sample(level, offset);
+			offset += length;
+
+			(_reduction_kernel ? _reduction_kernel :
+				_kernels.reduction)(dest_ptr, src_ptr, length,
+				_unit_size);
+		}
+	}
+}
+
+void LogicSnapshot::append_bit_planes_to_mipmap(uint8_t *dest,
+	uint64_t start, uint64_t end) const
+{
+	const int probe_count = _unit_size * 8;
+	const int blocks_per_word = 64 / MipMapScaleFactor;
+	const uint64_t block_mask = (1ULL << MipMapScaleFactor) - 1;
+
+	while (start < end)
+	{
+		const uint64_t index = start * MipMapScaleFactor;
+		const int first = start & (blocks_per_word - 1);
+		const int last = (int)min((uint64_t)blocks_per_word,
+			first + end - start);
+
+		// Build the entries a word of 64 probes at a time
+		for (unsigned int w = 0; w < get_word_count(); w++)
+		{
+			const int first_probe = w * 64;
+			const int last_probe = min(probe_count, first_probe + 64);
+
+			uint64_t accumulators[64 / MipMapScaleFactor] = {0};
+			for (int p = first_probe; p < last_probe; p++)
 			{
-				accumulator |= *(uint64_t*)src_ptr;
-				src_ptr += _unit_size;
+				// Find the transitions of the probe in the word,
+				// with the last sample of the previous word
+				// shifted in
+				const uint64_t word = *get_bit_plane_word(p, index);
+				const uint64_t prev = (index < 64) ? 0 :
+					*get_bit_plane_word(p, index - 64) >> 63;
+				const uint64_t transitions =
+					word ^ ((word << 1) | prev);
+
+				for (int i = first; i < last; i++)
+					if ((transitions >>
+						(i * MipMapScaleFactor)) & block_mask)
+						accumulators[i] |=
+							1ULL << (p - first_probe);
 			}
 
-			*(uint64_t*)dest_ptr = accumulator;
+			for (int i = first; i < last; i++)
+				memcpy(dest + (i - first) * _unit_size + w * 8,
+					&accumulators[i], get_word_width(w));
 		}
+
+		dest += (last - first) * _unit_size;
+		start += last - first;
+	}
+}
+
+void LogicSnapshot::defer_mipmap_levels()
+{
+	for (unsigned int level = 1; level < ScaleStepCount; level++)
+	{
+		MipMapLevel &m = _mip_map[level];
+		const MipMapLevel &ml = _mip_map[level-1];
+
+		const uint64_t prev_length = m.length;
+		m.length = ml.length / MipMapScaleFactor;
+		if (m.length == prev_length)
+			break;
+
+		reallocate_mipmap_level(m);
+
+		// The blocks up to the previous length are built already,
+		// except the last one if it was only part built
+		vector<uint8_t> &built = _lazy_blocks[level];
+		built.resize(prev_length >> LazyBlockPower, 1);
+		built.resize((m.length + LazyBlockSize - 1) >> LazyBlockPower,
+			0);
 	}
+
+	_lazy_mipmap = true;
+}
+
+void LogicSnapshot::build_lazy_levels()
+{
+	for (unsigned int level = 1; level < ScaleStepCount; level++)
+		for (uint64_t block = 0; block < _lazy_blocks[level].size();
+			block++)
+			build_mipmap_block(level, block);
+
+	_lazy_mipmap = false;
 }
 
-uint64_t LogicSnapshot::get_sample(uint64_t index) const
+void LogicSnapshot::build_mipmap_block(unsigned int level,
+	uint64_t block) const
+{
+	assert(level > 0);
+	vector<uint8_t> &built = _lazy_blocks[level];
+	assert(block < built.size());
+	if (load_acquire(&built[block]))
+		return;
+
+	const uint64_t start = block << LazyBlockPower;
+	const uint64_t end = min(_mip_map[level].length,
+		start + LazyBlockSize);
+
+	// Build the blocks of the level below which this one is reduced
+	// from
+	if (level > 1)
+		for (uint64_t b = (start << MipMapScalePower) >> LazyBlockPower;
+			b <= ((end << MipMapScalePower) - 1) >> LazyBlockPower;
+			b++)
+			build_mipmap_block(level - 1, b);
+
+	(_reduction_kernel ? _reduction_kernel : _kernels.reduction)(
+		get_mipmap_sample(level, start),
+		get_mipmap_sample(level - 1, start * MipMapScaleFactor),
+		end - start, _unit_size);
+	store_release(&built[block], 1);
+}
+
+bool LogicSnapshot::reserve_transition_counts(uint64_t length)
+{
+	const int probe_count = _unit_size * 8;
+
+	if (length <= _transition_count_data_length)
+		return true;
+
+	const uint64_t new_data_length = ((length +
+		TransitionCountDataUnit - 1) / TransitionCountDataUnit) *
+		TransitionCountDataUnit;
+	void *const data = _storage.reallocate(_transition_counts,
+		_transition_count_data_length * probe_count * sizeof(uint64_t),
+		new_data_length * probe_count * sizeof(uint64_t));
+	if (!data)
+		return false;
+
+	_transition_counts = (uint64_t*)data;
+	_transition_count_data_length = new_data_length;
+	return true;
+}
+
+void LogicSnapshot::append_payload_to_transition_counts(uint64_t end)
+{
+	const int probe_count = _unit_size * 8;
+
+	const uint64_t prev_length = _transition_count_length;
+	const uint64_t length = end >> TransitionCountPower;
+	if (length == prev_length)
+		return;
+
+	if (!reserve_transition_counts(get_ring_length(length,
+		_transition_count_mask)))
+		throw bad_alloc();
+
+	for (uint64_t block = prev_length; block < length; block++)
+	{
+		uint64_t *const counts = _transition_counts +
+			(block & _transition_count_mask) * probe_count;
+
+		// Carry the totals on from the previous block
+		if (block == 0)
+			memset(counts, 0, probe_count * sizeof(uint64_t));
+		else
+			memcpy(counts, _transition_counts +
+				((block - 1) & _transition_count_mask) *
+				probe_count, probe_count * sizeof(uint64_t));
+
+		count_block_transitions(counts, block);
+	}
+
+	_transition_count_length = length;
+}
+
+void LogicSnapshot::count_block_transitions(uint64_t *counts,
+	uint64_t block) const
+{
+	const int probe_count = _unit_size * 8;
+
+	uint64_t index = block << TransitionCountPower;
+	const uint64_t end_index = index + TransitionCountBlockSize;
+
+	if (_layout == BitPlane) {
+		// Count the transitions a word at a time
+		for (int p = 0; p < probe_count; p++)
+			for (uint64_t i = index; i < end_index; i += 64) {
+				const uint64_t word = *get_bit_plane_word(p, i);
+				const uint64_t prev = (i == 0) ? (word & 1) :
+					*get_bit_plane_word(p, i - 64) >> 63;
+				counts[p] += count_set_bits(
+					word ^ ((word << 1) | prev));
+			}
+		return;
+	}
+
+	vector<uint64_t> last_sample(get_word_count());
+	for (unsigned int w = 0; w < get_word_count(); w++)
+		last_sample[w] = get_sample(index ? index - 1 : 0, w);
+
+	while (index < end_index)
+	{
+		uint64_t length;
+		const uint8_t *src_ptr = get_sample_span(index,
+			end_index, length);
+		index += length;
+
+		_kernels.count_transitions(counts, src_ptr, length,
+			_unit_size, &last_sample[0]);
+	}
+}
+
+void LogicSnapshot::build_index()
+{
+	build_index(max(boost::thread::hardware_concurrency(), 1U));
+}
+
+void LogicSnapshot::build_index(unsigned int thread_count)
+{
+	// Run length blocks are compressed as the index passes over them,
+	// which the threads of the build do not do
+	if (_layout == RunLength) {
+		update_index(_sample_count);
+		return;
+	}
+
+	// Give each thread a chunk of samples at least, so that small
+	// snapshots are not worth the threads
+	thread_count = (unsigned int)min((uint64_t)thread_count,
+		((_sample_count - _mip_map[0].length * MipMapScaleFactor) >>
+			ChunkSizePower) + 1);
+
+	MipMapLevel &m0 = _mip_map[0];
+	const uint64_t prev_length = m0.length;
+	m0.length = _sample_count / MipMapScaleFactor;
+	reallocate_mipmap_level(m0);
+
+	const uint64_t prev_count_length = _transition_count_length;
+	_transition_count_length = _sample_count >> TransitionCountPower;
+	if (!reserve_transition_counts(get_ring_length(
+		_transition_count_length, _transition_count_mask)))
+		throw bad_alloc();
+
+	// Level 0 of the mip-map and the transitions of each count block
+	// depend only on the samples, so the threads build them over
+	// stretches of their own. The first stretch is built on this
+	// thread.
+	boost::thread_group threads;
+	for (unsigned int i = 1; i < thread_count; i++)
+		threads.create_thread(boost::bind(
+			&LogicSnapshot::build_index_stretch, this,
+			prev_length + (m0.length - prev_length) * i /
+				thread_count,
+			prev_length + (m0.length - prev_length) * (i + 1) /
+				thread_count,
+			prev_count_length + (_transition_count_length -
+				prev_count_length) * i / thread_count,
+			prev_count_length + (_transition_count_length -
+				prev_count_length) * (i + 1) / thread_count));
+	build_index_stretch(prev_length,
+		prev_length + (m0.length - prev_length) / thread_count,
+		prev_count_length, prev_count_length +
+			(_transition_count_length - prev_count_length) /
+			thread_count);
+	threads.join_all();
+
+	// Carry the samples on to the next payload, as appending would
+	if (_layout == Interleaved && m0.length != prev_length)
+		for (unsigned int w = 0; w < get_word_count(); w++)
+			_last_append_sample[w] = get_sample(
+				m0.length * MipMapScaleFactor - 1, w);
+
+	// Most of the higher levels of a whole file are never looked at,
+	// so they are left to be built as they are first read
+	if (_ring_chunk_count == 0)
+		defer_mipmap_levels();
+	else
+		append_mipmap_levels();
+
+	// Carry the totals on from block to block
+	const int probe_count = _unit_size * 8;
+	for (uint64_t block = max(prev_count_length, (uint64_t)1);
+		block < _transition_count_length; block++) {
+		uint64_t *const counts = _transition_counts +
+			(block & _transition_count_mask) * probe_count;
+		const uint64_t *const prev = _transition_counts +
+			((block - 1) & _transition_count_mask) * probe_count;
+		for (int p = 0; p < probe_count; p++)
+			counts[p] += prev[p];
+	}
+}
+
+void LogicSnapshot::build_index_stretch(uint64_t start, uint64_t end,
+	uint64_t count_start, uint64_t count_end) const
+{
+	// Start from the sample before the stretch, as appending would
+	vector<uint64_t> last_sample(get_word_count(), 0);
+	if (start != 0)
+		for (unsigned int w = 0; w < get_word_count(); w++)
+			last_sample[w] = get_sample(
+				start * MipMapScaleFactor - 1, w);
+
+	if (start != end)
+		append_samples_to_mipmap(start, end, &last_sample[0]);
+
+	const int probe_count = _unit_size * 8;
+	for (uint64_t block = count_start; block < count_end; block++) {
+		uint64_t *const counts = _transition_counts +
+			(block & _transition_count_mask) * probe_count;
+		memset(counts, 0, probe_count * sizeof(uint64_t));
+		count_block_transitions(counts, block);
+	}
+}
+
+const uint8_t* LogicSnapshot::get_sample_span(uint64_t start, uint64_t end,
+	uint64_t &length) const
+{
+	if (_layout == RunLength) {
+		// Only the raw blocks can be read as spans, which the
+		// blocks the index has not passed over always are
+		const uint64_t block = start >> RunBlockPower;
+		const uint8_t *const data = (block == _run_blocks.size()) ?
+			_run_tail : _run_blocks[block].data;
+		assert(block >= _compressed_run_block_count);
+		assert(data);
+
+		const uint64_t offset = start & (RunBlockSize - 1);
+		length = min(end - start, RunBlockSize - offset);
+		return data + offset * _unit_size;
+	}
+
+	return get_raw_samples(start, end, length);
+}
+
+uint64_t LogicSnapshot::get_sample(uint64_t index, unsigned int word) const
 {
-	assert(_data);
 	assert(index < _sample_count);
+	assert(word < get_word_count());
+
+	if (_layout == BitPlane)
+		return get_bit_plane_sample(index, word);
+
+	// The word is read whole, so the bytes past the end of the sample
+	// belong to the next one
+	const uint8_t *const sample = (_layout == RunLength) ?
+		get_run_length_sample(index) : get_raw_sample(index);
+	return *(const uint64_t*)(sample + word * 8) & get_word_mask(word);
+}
+
+const uint8_t* LogicSnapshot::get_run_length_sample(uint64_t index) const
+{
+	const uint64_t block = index >> RunBlockPower;
+	const uint64_t offset = index & (RunBlockSize - 1);
+
+	if (block == _run_blocks.size())
+		return _run_tail + offset * _unit_size;
+
+	const RunBlock &b = _run_blocks[block];
+	if (b.run_count == 0)
+		return b.data + offset * _unit_size;
+
+	// Find the last run which starts at or before the offset
+	const uint16_t *const starts = (const uint16_t*)b.data;
+	const unsigned int run = upper_bound(starts, starts + b.run_count,
+		offset) - starts - 1;
+	return b.data + b.run_count * sizeof(uint16_t) + run * _unit_size;
+}
+
+uint64_t LogicSnapshot::get_bit_plane_sample(uint64_t index,
+	unsigned int word) const
+{
+	const int shift = index & 63;
+	const int first_probe = word * 64;
+	const int last_probe = min(_unit_size * 8, first_probe + 64);
 
-	return *(uint64_t*)((uint8_t*)_data + index * _unit_size);
+	uint64_t sample = 0;
+	for (int p = first_probe; p < last_probe; p++)
+		sample |= ((*get_bit_plane_word(p, index) >> shift) & 1) <<
+			(p - first_probe);
+	return sample;
+}
+
+const uint64_t* LogicSnapshot::get_bit_plane_word(int probe,
+	uint64_t index) const
+{
+	assert((index >> ChunkSizePower) < _bit_plane_chunks.size());
+	return _bit_plane_chunks[index >> ChunkSizePower] +
+		probe * (ChunkSize / 64) + ((index & (ChunkSize - 1)) >> 6);
+}
+
+uint64_t LogicSnapshot::find_change(uint64_t start, uint64_t end,
+	unsigned int word, uint64_t sig_mask, bool level) const
+{
+	if (_layout == RunLength)
+		return find_run_length_change(start, end, word, sig_mask,
+			level);
+	if (_layout == BitPlane)
+		return find_bit_plane_change(start, end, word, sig_mask,
+			level);
+
+	for (uint64_t length; start < end; start += length) {
+		const uint8_t *const src = get_raw_samples(start, end, length);
+		const uint64_t offset = _kernels.find_change(src + word * 8,
+			length, _unit_size, sig_mask, level);
+		if (offset < length)
+			return start + offset;
+	}
+
+	return end;
+}
+
+uint64_t LogicSnapshot::find_run_length_change(uint64_t start, uint64_t end,
+	unsigned int word, uint64_t sig_mask, bool level) const
+{
+	while (start < end)
+	{
+		const uint64_t block = start >> RunBlockPower;
+		const uint64_t block_start = block << RunBlockPower;
+		const uint64_t block_end = min(end, block_start + RunBlockSize);
+
+		if (block == _run_blocks.size() ||
+			_run_blocks[block].run_count == 0) {
+			// Search uncompressed blocks sample by sample
+			for (; start < block_end; start++)
+				if (((get_sample(start, word) & sig_mask) != 0)
+					!= level)
+					return start;
+			continue;
+		}
+
+		// Step through the runs of compressed blocks
+		const RunBlock &b = _run_blocks[block];
+		const uint16_t *const starts = (const uint16_t*)b.data;
+		const uint8_t *const values =
+			b.data + b.run_count * sizeof(uint16_t);
+
+		for (unsigned int run = upper_bound(starts,
+			starts + b.run_count, start - block_start) - starts - 1;
+			run < b.run_count; run++) {
+			const uint64_t run_start = block_start + starts[run];
+			if (run_start >= block_end)
+				break;
+
+			const uint64_t sample = *(const uint64_t*)(values +
+				run * _unit_size + word * 8);
+			if (((sample & sig_mask) != 0) != level)
+				return max(start, run_start);
+		}
+
+		start = block_end;
+	}
+
+	return end;
+}
+
+uint64_t LogicSnapshot::find_bit_plane_change(uint64_t start, uint64_t end,
+	unsigned int word, uint64_t sig_mask, bool level) const
+{
+	const int probe = word * 64 + count_trailing_zeros(sig_mask);
+	const uint64_t invert = level ? ~0ULL : 0;
+
+	while (start < end)
+	{
+		// Any set bit from the start offset onwards is a change
+		const uint64_t changes = (*get_bit_plane_word(probe, start) ^
+			invert) & (~0ULL << (start & 63));
+		if (changes)
+			return min(end, (start & ~(uint64_t)63) +
+				count_trailing_zeros(changes));
+
+		start = (start | 63) + 1;
+	}
+
+	return end;
+}
+
+void LogicSnapshot::get_samples(const Pin &pin, uint8_t *dest,
+	uint64_t start, uint64_t end) const
+{
+	assert_pinned(pin);
+	assert(dest);
+	assert(start <= end);
+	assert(end <= _sample_count);
+
+	if (_layout == RunLength) {
+		// Expand the runs of each block in turn, rather than search
+		// for the run of every sample
+		while (start < end) {
+			const uint64_t block = start >> RunBlockPower;
+			const uint64_t offset = start & (RunBlockSize - 1);
+			const uint64_t length = min(end - start,
+				RunBlockSize - offset);
+
+			const RunBlock *const b = (block < _run_blocks.size()) ?
+				&_run_blocks[block] : NULL;
+			if (!b || b->run_count == 0) {
+				const uint8_t *const src = b ? b->data : _run_tail;
+				memcpy(dest, src + offset * _unit_size,
+					length * _unit_size);
+			} else {
+				const uint16_t *const starts =
+					(const uint16_t*)b->data;
+				const uint8_t *const values = b->data +
+					b->run_count * sizeof(uint16_t);
+				unsigned int run = upper_bound(starts,
+					starts + b->run_count, offset) -
+					starts - 1;
+				for (uint64_t i = 0; i < length; i++) {
+					while (run + 1 < b->run_count &&
+						starts[run + 1] <= offset + i)
+						run++;
+					memcpy(dest + i * _unit_size,
+						values + run * _unit_size,
+						_unit_size);
+				}
+			}
+
+			dest += length * _unit_size;
+			start += length;
+		}
+	} else if (_layout == BitPlane) {
+		for (uint64_t i = start; i < end; i++)
+			for (unsigned int w = 0; w < get_word_count(); w++) {
+				const uint64_t sample =
+					get_bit_plane_sample(i, w);
+				memcpy(dest + (i - start) * _unit_size + w * 8,
+					&sample, get_word_width(w));
+			}
+	} else
+		copy_raw_samples(dest, start, end);
+}
+
+bool LogicSnapshot::find_next_edge(uint64_t index, int sig_index,
+	EdgePair &edge) const
+{
+	assert(sig_index >= 0);
+	assert(sig_index < _unit_size * 8);
+
+	shared_lock<shared_mutex> lock(_mutex);
+
+	const unsigned int word = sig_index / 64;
+	const uint64_t sig_mask = 1ULL << (sig_index % 64);
+	const uint64_t next = find_next_transition(max(index + 1,
+		(_first_chunk << ChunkSizePower) + 1), word, sig_mask);
+	if (next >= _sample_count)
+		return false;
+
+	edge = EdgePair(next, (get_sample(next, word) & sig_mask) != 0);
+	return true;
+}
+
+bool LogicSnapshot::find_previous_edge(uint64_t index, int sig_index,
+	EdgePair &edge) const
+{
+	assert(sig_index >= 0);
+	assert(sig_index < _unit_size * 8);
+
+	shared_lock<shared_mutex> lock(_mutex);
+
+	const unsigned int word = sig_index / 64;
+	const uint64_t sig_mask = 1ULL << (sig_index % 64);
+	const uint64_t prev = find_previous_transition(
+		min(index, _sample_count), word, sig_mask);
+	if (prev == 0)
+		return false;
+
+	edge = EdgePair(prev, (get_sample(prev, word) & sig_mask) != 0);
+	return true;
+}
+
+uint64_t LogicSnapshot::get_edge_count(uint64_t start, uint64_t end,
+	int sig_index) const
+{
+	assert(start <= end);
+	assert(sig_index >= 0);
+	assert(sig_index < _unit_size * 8);
+
+	shared_lock<shared_mutex> lock(_mutex);
+
+	// Samples which have been discarded from a ring buffer are left
+	// out of the range
+	const uint64_t start_sample = _first_chunk << ChunkSizePower;
+	end = max(min(end, _sample_count), start_sample);
+	start = max(min(start, end), start_sample);
+	return count_edges_before(end, sig_index) -
+		count_edges_before(start, sig_index);
+}
+
+uint64_t LogicSnapshot::count_edges_before(uint64_t index,
+	int sig_index) const
+{
+	const unsigned int word = sig_index / 64;
+	const uint64_t sig_mask = 1ULL << (sig_index % 64);
+	const int probe_count = _unit_size * 8;
+
+	// Look up the total up to the last whole block, then count the
+	// rest of the way sample by sample
+	const uint64_t block = min(index >> TransitionCountPower,
+		_transition_count_length);
+	uint64_t count = (block == 0) ? 0 :
+		_transition_counts[((block - 1) & _transition_count_mask) *
+			probe_count + sig_index];
+
+	uint64_t i = max(block << TransitionCountPower, (uint64_t)1);
+	if (i >= index)
+		return count;
+
+	// The sample before the first one kept by a ring buffer is only
+	// held on its own
+	const uint64_t prev_sample =
+		(i == (_first_chunk << ChunkSizePower)) ?
+		_discarded_sample[word] : get_sample(i - 1, word);
+	bool level = (prev_sample & sig_mask) != 0;
+	while ((i = find_change(i, index, word, sig_mask, level)) < index) {
+		count++;
+		level = !level;
+	}
+
+	return count;
+}
+
+uint64_t LogicSnapshot::find_next_transition(uint64_t index,
+	unsigned int word, uint64_t sig_mask) const
+{
+	if (index == 0)
+		index = 1;
+	if (index >= _sample_count)
+		return _sample_count;
+
+	// Search the samples up to the start of the next mip-map block
+	const bool level = (get_sample(index - 1, word) & sig_mask) != 0;
+	const uint64_t block_end = min(_sample_count,
+		pow2_ceil(index, MipMapScalePower));
+	index = find_change(index, block_end, word, sig_mask, level);
+	if (index < block_end || index == _sample_count)
+		return index;
+
+	index = find_flagged_block(index, 0, word, sig_mask);
+
+	// Search the samples of the block, or the samples beyond the end
+	// of the mip-map
+	return find_change(index, _sample_count, word, sig_mask,
+		(get_sample(index - 1, word) & sig_mask) != 0);
+}
+
+uint64_t LogicSnapshot::find_flagged_block(uint64_t index,
+	unsigned int min_level, unsigned int word, uint64_t sig_mask) const
+{
+	// Slide right and zoom out until a block with a transition is
+	// found, then zoom back in on it
+	unsigned int level = min_level;
+	while (1) {
+		const MipMapLevel &m = _mip_map[level];
+		const int level_scale_power = (level + 1) * MipMapScalePower;
+		const uint64_t offset = index >> level_scale_power;
+
+		if (offset >= m.length ||
+			(get_subsample(level, offset, word) & sig_mask))
+			break;
+
+		if ((offset & (MipMapScaleFactor - 1)) == 0 &&
+			level + 1 < ScaleStepCount &&
+			(offset >> MipMapScalePower) <
+				_mip_map[level + 1].length)
+			level++;
+		else
+			index = (offset + 1) << level_scale_power;
+	}
+
+	while (1) {
+		const MipMapLevel &m = _mip_map[level];
+		const int level_scale_power = (level + 1) * MipMapScalePower;
+		const uint64_t offset = index >> level_scale_power;
+
+		if (offset >= m.length ||
+			(get_subsample(level, offset, word) & sig_mask)) {
+			if (level == min_level)
+				break;
+			level--;
+		} else
+			index = (offset + 1) << level_scale_power;
+	}
+
+	return index;
+}
+
+uint64_t LogicSnapshot::find_previous_transition(uint64_t index,
+	unsigned int word, uint64_t sig_mask) const
+{
+	const uint64_t start_sample = _first_chunk << ChunkSizePower;
+
+	// Search the samples back to the start of the mip-map block, or
+	// back to the end of the mip-map if it has not been built this far
+	const uint64_t indexed_end = _mip_map[0].length * MipMapScaleFactor;
+	const uint64_t block_start = (index > indexed_end) ? indexed_end :
+		(index & ~(uint64_t)(MipMapScaleFactor - 1));
+
+	const uint64_t change = find_previous_change(block_start, index,
+		word, sig_mask);
+	if (change != 0 || block_start <= start_sample)
+		return change;
+
+	// Slide left and zoom out until a block with a transition is
+	// found
+	index = block_start;
+	unsigned int level = 0;
+	while (1) {
+		const int level_scale_power = (level + 1) * MipMapScalePower;
+		const uint64_t offset = (index >> level_scale_power) - 1;
+
+		if (get_subsample(level, offset, word) & sig_mask)
+			break;
+
+		index = offset << level_scale_power;
+		if (index <= start_sample)
+			return 0;
+
+		// If we are now at the end of a higher level mip-map
+		// block ascend one level
+		if ((offset & (MipMapScaleFactor - 1)) == 0 &&
+			level + 1 < ScaleStepCount &&
+			_mip_map[level + 1].mask != 0)
+			level++;
+
+		// Zoom back in while the block before reaches back past
+		// the first sample kept by a ring buffer
+		while (((index - start_sample) >>
+			((level + 1) * MipMapScalePower)) == 0)
+			level--;
+	}
+
+	// Zoom in on the last block with a transition
+	while (level > 0) {
+		level--;
+		const int level_scale_power = (level + 1) * MipMapScalePower;
+		while (!(get_subsample(level,
+			(index >> level_scale_power) - 1, word) & sig_mask))
+			index -= 1ULL << level_scale_power;
+	}
+
+	// Only the first block can be marked without holding an edge,
+	// because its first sample is compared against zero
+	return find_previous_change(index - MipMapScaleFactor, index,
+		word, sig_mask);
+}
+
+uint64_t LogicSnapshot::find_previous_change(uint64_t start, uint64_t end,
+	unsigned int word, uint64_t sig_mask) const
+{
+	const uint64_t first = (_first_chunk << ChunkSizePower) + 1;
+	for (uint64_t i = end; i > max(start, first); i--)
+		if ((get_sample(i - 1, word) ^ get_sample(i - 2, word)) &
+			sig_mask)
+			return i - 1;
+	return 0;
 }
 
 void LogicSnapshot::get_subsampled_edges(
@@ -188,17 +1264,25 @@ void LogicSnapshot::get_subsampled_edges(
 	assert(start <= end);
 	assert(min_length > 0);
 	assert(sig_index >= 0);
-	assert(sig_index < SR_MAX_NUM_PROBES);
+	assert(sig_index < _unit_size * 8);
 
-	lock_guard<recursive_mutex> lock(_mutex);
+	shared_lock<shared_mutex> lock(_mutex);
+
+	// Leave out samples which have been discarded from a ring buffer
+	start = max(start, _first_chunk << ChunkSizePower);
+	end = max(end, start);
+	index = start;
 
 	const uint64_t block_length = (uint64_t)max(min_length, 1.0f);
 	const unsigned int min_level = max((int)floorf(logf(min_length) /
 		LogMipMapScaleFactor) - 1, 0);
-	const uint64_t sig_mask = 1ULL << sig_index;
+	const unsigned int word = sig_index / 64;
+	const uint64_t sig_mask = 1ULL << (sig_index % 64);
+
+	prefetch_edge_data(start, end, min_length, min_level);
 
 	// Store the initial state
-	last_sample = (get_sample(start) & sig_mask) != 0;
+	last_sample = (get_sample(start, word) & sig_mask) != 0;
 	edges.push_back(pair<int64_t, bool>(index++, last_sample));
 
 	while (index + block_length <= end)
@@ -217,19 +1301,12 @@ void LogicSnapshot::get_subsampled_edges(
 			const uint64_t final_index = min(end,
 				pow2_ceil(index, MipMapScalePower));
 
-			for (; index < final_index &&
-				(index & ~(~0 << MipMapScalePower)) != 0;
-				index++)
-			{
-				const bool sample =
-					(get_sample(index) & sig_mask) != 0;
+			index = find_change(index, final_index, word, sig_mask,
+				last_sample);
 
-				// If there was a change we cannot fast forward
-				if (sample != last_sample) {
-					fast_forward = false;
-					break;
-				}
-			}
+			// If there was a change we cannot fast forward
+			if (index < final_index)
+				fast_forward = false;
 		}
 		else
 		{
@@ -244,9 +1321,17 @@ void LogicSnapshot::get_subsampled_edges(
 
 			// We can fast forward only if there was no change
 			const bool sample =
-				(get_sample(index) & sig_mask) != 0;
+				(get_sample(index, word) & sig_mask) != 0;
 			if (last_sample != sample)
 				fast_forward = false;
+			else if ((index >> min_level_scale_power) >=
+				_mip_map[level].length) {
+				// The mip-map has not been built this far yet,
+				// so search the samples themselves
+				index = find_change(index, end, word, sig_mask,
+					last_sample);
+				fast_forward = false;
+			}
 		}
 
 		if (fast_forward) {
@@ -267,7 +1352,7 @@ void LogicSnapshot::get_subsampled_edges(
 				// Check if we reached the last block at this
 				// level, or if there was a change in this block
 				if (offset >= _mip_map[level].length ||
-					(get_subsample(level, offset) &
+					(get_subsample(level, offset, word) &
 						sig_mask))
 					break;
 
@@ -301,7 +1386,7 @@ void LogicSnapshot::get_subsampled_edges(
 				// Check if we reached the last block at this
 				// level, or if there was a change in this block
 				if (offset >= _mip_map[level].length ||
-					(get_subsample(level, offset) &
+					(get_subsample(level, offset, word) &
 						sig_mask)) {
 					// Zoom in unless we reached the minimum
 					// zoom
@@ -320,14 +1405,9 @@ void LogicSnapshot::get_subsampled_edges(
 			// If individual samples within the limit of resolution,
 			// do a linear search for the next transition within the
 			// block
-			if (min_length < MipMapScaleFactor) {
-				for (; index < end; index++) {
-					const bool sample = (get_sample(index) &
-						sig_mask) != 0;
-					if (sample != last_sample)
-						break;
-				}
-			}
+			if (min_length < MipMapScaleFactor)
+				index = find_change(index, end, word, sig_mask,
+					last_sample);
 		}
 
 		//----- Store the edge -----//
@@ -339,7 +1419,7 @@ void LogicSnapshot::get_subsampled_edges(
 
 		// Store the final state
 		const bool final_sample =
-			(get_sample(final_index - 1) & sig_mask) != 0;
+			(get_sample(final_index - 1, word) & sig_mask) != 0;
 		edges.push_back(pair<int64_t, bool>(index, final_sample));
 
 		index = final_index;
@@ -348,15 +1428,342 @@ void LogicSnapshot::get_subsampled_edges(
 
 	// Add the final state
 	edges.push_back(pair<int64_t, bool>(end,
-		get_sample(end) & sig_mask));
+		get_sample(end, word) & sig_mask));
 }
 
-uint64_t LogicSnapshot::get_subsample(int level, uint64_t offset) const
+void LogicSnapshot::get_subsampled_edges(
+	std::vector< std::vector<EdgePair> > &edges,
+	uint64_t start, uint64_t end,
+	float min_length, uint64_t sig_mask, unsigned int word)
+{
+	assert(end <= get_sample_count());
+	assert(word < get_word_count());
+	assert(start <= end);
+	assert(min_length > 0);
+
+	shared_lock<shared_mutex> lock(_mutex);
+
+	// Leave out samples which have been discarded from a ring buffer
+	start = max(start, _first_chunk << ChunkSizePower);
+	end = max(end, start);
+
+	const int probe_count = _unit_size * 8;
+	sig_mask &= get_word_mask(word);
+
+	const uint64_t block_length = (uint64_t)max(min_length, 1.0f);
+	const unsigned int min_level = max((int)floorf(logf(min_length) /
+		LogMipMapScaleFactor) - 1, 0);
+	const int min_level_scale_power = (min_level + 1) * MipMapScalePower;
+	const uint64_t mipmap_end =
+		_mip_map[min_level].length << min_level_scale_power;
+
+	prefetch_edge_data(start, end, min_length, min_level);
+
+	// Descend the mip-map once for all the signals, listing the
+	// blocks in which any of them have transitions, along with the
+	// signals which do
+	vector< pair<uint64_t, uint64_t> > blocks;
+	if (_mip_map[min_level].data) {
+		const uint64_t blocks_end = min(end, mipmap_end);
+		for (uint64_t index = pow2_ceil(start, min_level_scale_power);
+			(index = find_flagged_block(index, min_level, word,
+				sig_mask)) < blocks_end;
+			index += 1ULL << min_level_scale_power)
+			blocks.push_back(make_pair(index, get_subsample(
+				min_level, index >> min_level_scale_power,
+				word)));
+	}
+
+	edges.resize(probe_count);
+
+	// Walk each signal through the list in the same way as the single
+	// signal search
+	for (int bit = 0; bit < 64; bit++)
+	{
+		const uint64_t mask = 1ULL << bit;
+		if (!(sig_mask & mask))
+			continue;
+
+		vector<EdgePair> &e = edges[word * 64 + bit];
+		vector< pair<uint64_t, uint64_t> >::const_iterator block =
+			blocks.begin();
+		uint64_t index = start;
+
+		e.clear();
+
+		// Store the initial state
+		bool last_sample = (get_sample(start, word) & mask) != 0;
+		e.push_back(pair<int64_t, bool>(index++, last_sample));
+
+		while (index + block_length <= end)
+		{
+			bool fast_forward = (_mip_map[min_level].data != NULL);
+
+			if (min_length < MipMapScaleFactor)
+			{
+				const uint64_t final_index = min(end,
+					pow2_ceil(index, MipMapScalePower));
+
+				index = find_change(index, final_index, word, mask,
+					last_sample);
+
+				if (index < final_index)
+					fast_forward = false;
+			}
+			else
+			{
+				index = pow2_ceil(index, min_level_scale_power);
+				if (index >= end)
+					break;
+
+				const bool sample =
+					(get_sample(index, word) & mask) != 0;
+				if (last_sample != sample)
+					fast_forward = false;
+				else if (index >= mipmap_end) {
+					index = find_change(index, end, word, mask,
+						last_sample);
+					fast_forward = false;
+				}
+			}
+
+			if (fast_forward) {
+				// Skip to the next listed block in which this
+				// signal changes
+				while (block != blocks.end() &&
+					(block->first < index ||
+					!(block->second & mask)))
+					block++;
+
+				if (block != blocks.end())
+					index = block->first;
+				else
+					index = max(index, mipmap_end);
+
+				if (min_length < MipMapScaleFactor)
+					index = find_change(index, end, word, mask,
+						last_sample);
+			}
+
+			// Take the last sample of the quanization block
+			const int64_t final_index = index + block_length;
+			if (index + block_length > end)
+				break;
+
+			const bool final_sample =
+				(get_sample(final_index - 1, word) & mask) != 0;
+			e.push_back(pair<int64_t, bool>(index, final_sample));
+
+			index = final_index;
+			last_sample = final_sample;
+		}
+
+		// Add the final state
+		e.push_back(pair<int64_t, bool>(end,
+			get_sample(end, word) & mask));
+	}
+}
+
+void LogicSnapshot::prefetch_edge_data(uint64_t start, uint64_t end,
+	float min_length, unsigned int min_level) const
+{
+	// Hint to spilled storage which data the search is going to walk
+	if (min_length < MipMapScaleFactor) {
+		if (_layout == Interleaved)
+			prefetch_raw_samples(start, end);
+	}
+	else if (_mip_map[min_level].data) {
+		const int level_scale_power = (min_level + 1) *
+			MipMapScalePower;
+		const uint64_t first = start >> level_scale_power;
+		const uint64_t last = min(end >> level_scale_power,
+			_mip_map[min_level].length);
+		if (first < last) {
+			// The range may wrap around the ring of the level
+			const uint64_t mask = _mip_map[min_level].mask;
+			const uint64_t length = min(last - first - 1,
+				mask - (first & mask)) + 1;
+			_storage.prefetch(get_mipmap_sample(min_level, first),
+				length * _unit_size);
+			if (first + length < last)
+				_storage.prefetch(_mip_map[min_level].data,
+					(last - first - length) * _unit_size);
+		}
+	}
+}
+
+uint64_t LogicSnapshot::get_subsample(int level, uint64_t offset,
+	unsigned int word) const
 {
 	assert(level >= 0);
-	assert(_mip_map[level].data);
-	return *(uint64_t*)((uint8_t*)_mip_map[level].data +
-		_unit_size * offset);
+	assert(word < get_word_count());
+
+	// The higher levels of a lazy snapshot are built as they are read.
+	// The lock is only taken for blocks which are not built yet
+	if (level > 0 && _lazy_mipmap) {
+		const uint64_t block = offset >> LazyBlockPower;
+		if (!load_acquire(&_lazy_blocks[level][block])) {
+			lock_guard<boost::mutex> lock(_lazy_mutex);
+			build_mipmap_block(level, block);
+		}
+	}
+
+	return *(uint64_t*)(get_mipmap_sample(level, offset) + word * 8);
+}
+
+unsigned int LogicSnapshot::get_word_count() const
+{
+	return (_unit_size + 7) / 8;
+}
+
+int LogicSnapshot::get_word_width(unsigned int word) const
+{
+	return min(_unit_size - (int)word * 8, 8);
+}
+
+uint64_t LogicSnapshot::get_word_mask(unsigned int word) const
+{
+	const int width = get_word_width(word);
+	return (width == 8) ? ~0ULL : ((1ULL << (width * 8)) - 1);
+}
+
+LogicSnapshot::Kernels LogicSnapshot::get_kernels(int unit_size)
+{
+	switch (unit_size) {
+	case 1: return make_kernels<1>();
+	case 2: return make_kernels<2>();
+	case 4: return make_kernels<4>();
+	case 8: return make_kernels<8>();
+	default: return make_kernels<0>();
+	}
+}
+
+template <int UnitSize>
+LogicSnapshot::Kernels LogicSnapshot::make_kernels()
+{
+	const Kernels kernels = {
+		accumulate_transitions<UnitSize>,
+		reduce_mipmap_blocks<UnitSize>,
+		find_span_change<UnitSize>,
+		count_span_transitions<UnitSize>
+	};
+	return kernels;
+}
+
+template <int UnitSize>
+inline uint64_t LogicSnapshot::read_sample(const uint8_t *src, int width)
+{
+	switch (UnitSize) {
+	case 1: return *src;
+	case 2: return *(const uint16_t*)src;
+	case 4: return *(const uint32_t*)src;
+	case 8: return *(const uint64_t*)src;
+	}
+
+	uint64_t sample = 0;
+	memcpy(&sample, src, width);
+	return sample;
+}
+
+// Units of up to 8 bytes are a single word. Wider units are walked a
+// word of 64 probes at a time, each word in a column of its own. The
+// last word of a unit which is not a multiple of 8 bytes is narrower.
+
+template <int UnitSize>
+void LogicSnapshot::accumulate_transitions(uint8_t *dest,
+	const uint8_t *src, uint64_t blocks, int unit_size,
+	uint64_t *last_sample)
+{
+	const int unit = UnitSize ? UnitSize : unit_size;
+	const int words = UnitSize ? 1 : (unit_size + 7) / 8;
+
+	for (int w = 0; w < words; w++) {
+		const int width = UnitSize ? UnitSize : min(unit - w * 8, 8);
+		const uint8_t *s = src + w * 8;
+		uint8_t *d = dest + w * 8;
+		uint64_t last = last_sample[w];
+
+		for (uint64_t b = 0; b < blocks; b++) {
+			// Accumulate the transitions which occur in the block
+			uint64_t accumulator = 0;
+			for (int i = 0; i < MipMapScaleFactor; i++) {
+				const uint64_t sample =
+					read_sample<UnitSize>(s, width);
+				accumulator |= last ^ sample;
+				last = sample;
+				s += unit;
+			}
+
+			memcpy(d, &accumulator, width);
+			d += unit;
+		}
+
+		last_sample[w] = last;
+	}
+}
+
+template <int UnitSize>
+void LogicSnapshot::reduce_mipmap_blocks(uint8_t *dest, const uint8_t *src,
+	uint64_t blocks, int unit_size)
+{
+	const int unit = UnitSize ? UnitSize : unit_size;
+	const int words = UnitSize ? 1 : (unit_size + 7) / 8;
+
+	for (int w = 0; w < words; w++) {
+		const int width = UnitSize ? UnitSize : min(unit - w * 8, 8);
+		const uint8_t *s = src + w * 8;
+		uint8_t *d = dest + w * 8;
+
+		for (uint64_t b = 0; b < blocks; b++) {
+			uint64_t accumulator = 0;
+			for (int i = 0; i < MipMapScaleFactor; i++) {
+				accumulator |= read_sample<UnitSize>(s, width);
+				s += unit;
+			}
+
+			memcpy(d, &accumulator, width);
+			d += unit;
+		}
+	}
+}
+
+template <int UnitSize>
+uint64_t LogicSnapshot::find_span_change(const uint8_t *src,
+	uint64_t length, int unit_size, uint64_t sig_mask, bool level)
+{
+	const int unit = UnitSize ? UnitSize : unit_size;
+
+	// A whole word is read, so that the signal may be in any word of
+	// a wide unit. Only the signal's bit is looked at.
+	for (uint64_t i = 0; i < length; i++, src += unit)
+		if (((read_sample<UnitSize>(src, 8) & sig_mask) != 0) != level)
+			return i;
+	return length;
+}
+
+template <int UnitSize>
+void LogicSnapshot::count_span_transitions(uint64_t *counts,
+	const uint8_t *src, uint64_t length, int unit_size,
+	uint64_t *last_sample)
+{
+	const int unit = UnitSize ? UnitSize : unit_size;
+	const int words = UnitSize ? 1 : (unit_size + 7) / 8;
+
+	for (int w = 0; w < words; w++) {
+		const int width = UnitSize ? UnitSize : min(unit - w * 8, 8);
+		uint64_t last = last_sample[w];
+
+		for (const uint8_t *s = src + w * 8, *const end =
+			s + length * unit; s < end; s += unit) {
+			const uint64_t sample = read_sample<UnitSize>(s, width);
+			for (uint64_t diff = sample ^ last; diff;
+				diff &= diff - 1)
+				counts[w * 64 + count_trailing_zeros(diff)]++;
+			last = sample;
+		}
+
+		last_sample[w] = last;
+	}
 }
 
 uint64_t LogicSnapshot::pow2_ceil(uint64_t x, unsigned int power)
@@ -365,5 +1772,42 @@ uint64_t LogicSnapshot::pow2_ceil(uint64_t x, unsigned int power)
 	return (x + p - 1) / p * p;
 }
 
+unsigned int LogicSnapshot::count_trailing_zeros(uint64_t x)
+{
+	assert(x != 0);
+#ifdef __GNUC__
+	return __builtin_ctzll(x);
+#else
+	unsigned int count = 0;
+	for (; !(x & 1); x >>= 1)
+		count++;
+	return count;
+#endif
+}
+
+unsigned int LogicSnapshot::count_set_bits(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(x);
+#else
+	unsigned int count = 0;
+	for (; x; x &= x - 1)
+		count++;
+	return count;
+#endif
+}
+
+uint64_t LogicSnapshot::transpose_8x8(uint64_t x)
+{
+	uint64_t t;
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+	return x;
+}
+
 } // namespace data
 } // namespace pv
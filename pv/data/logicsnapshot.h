@@ -21,6 +21,7 @@
 #ifndef PULSEVIEW_PV_DATA_LOGICSNAPSHOT_H
 #define PULSEVIEW_PV_DATA_LOGICSNAPSHOT_H
 
+#include "simd.h"
 #include "snapshot.h"
 
 #include <utility>
@@ -32,6 +33,22 @@ class Basic;
 class LargeData;
 class Pulses;
 class LongPulses;
+class ChunkBoundaries;
+class Spilled;
+class RunLength;
+class RunLengthIndexingThread;
+class SimdKernels;
+class BitPlane;
+class Deferred;
+class IndexingThread;
+class IndexingThreadBacklog;
+class EdgeQueries;
+class Reserve;
+class MemoryUsage;
+class RingBuffer;
+class SampleMask;
+class DeferredIndexing;
+class LazyMipMap;
 }
 
 namespace pv {
@@ -39,12 +56,84 @@ namespace data {
 
 class LogicSnapshot : public Snapshot
 {
+public:
+	enum Layout
+	{
+		/// Samples are stored exactly as they arrive.
+		Interleaved,
+
+		/// Runs of unchanged samples are stored as (value, length)
+		/// pairs.
+		RunLength,
+
+		/// The samples of each probe are packed into a bit stream of
+		/// 64 samples per word.
+		BitPlane
+	};
+
 private:
 	struct MipMapLevel
 	{
 		uint64_t length;
 		uint64_t data_length;
 		void *data;
+
+		/// Wraps the offsets of the level around its buffer.
+		uint64_t mask;
+	};
+
+	/**
+	 * A block of RunBlockSize samples stored in the RunLength layout.
+	 * A compressed block holds the uint16_t block offsets at which
+	 * each run starts, followed by the sample value of each run. A
+	 * block which would not compress holds the raw samples instead.
+	 */
+	struct RunBlock
+	{
+		/// The number of runs, or zero if the block is stored raw.
+		unsigned int run_count;
+		uint8_t *data;
+	};
+
+	/**
+	 * The kernels which walk spans of samples, specialised for the
+	 * unit size of the snapshot so that the compiler can unroll
+	 * them. The mip-map kernels are the scalar reference which the
+	 * Simd kernels are used in place of when the CPU allows.
+	 */
+	struct Kernels
+	{
+		/**
+		 * Accumulates the transitions of blocks of samples.
+		 * @param[in,out] last_sample The sample before the blocks,
+		 *   one per word of the unit. On return it holds the last
+		 *   sample of the blocks.
+		 */
+		void (*transitions)(uint8_t *dest, const uint8_t *src,
+			uint64_t blocks, int unit_size, uint64_t *last_sample);
+
+		Simd::LogicReductionKernel reduction;
+
+		/**
+		 * Searches a span of samples for the first at which a signal
+		 * differs from a level. src points at the word of the first
+		 * sample which holds the signal.
+		 * @return Returns the offset of the sample into the span, or
+		 *   the length of the span if there is none.
+		 */
+		uint64_t (*find_change)(const uint8_t *src, uint64_t length,
+			int unit_size, uint64_t sig_mask, bool level);
+
+		/**
+		 * Adds up the transitions of each probe in a span of
+		 * samples.
+		 * @param[in,out] last_sample The sample before the span, one
+		 *   per word of the unit. On return it holds the last sample
+		 *   of the span.
+		 */
+		void (*count_transitions)(uint64_t *counts,
+			const uint8_t *src, uint64_t length, int unit_size,
+			uint64_t *last_sample);
 	};
 
 private:
@@ -54,22 +143,318 @@ private:
 	static const float LogMipMapScaleFactor;
 	static const uint64_t MipMapDataUnit;
 
+	/// The mip-map levels of a lazy snapshot are built this many
+	/// entries at a time.
+	static const int LazyBlockPower;
+	static const uint64_t LazyBlockSize;
+
+	static const int RunBlockPower;
+	static const uint64_t RunBlockSize;
+
+	static const int TransitionCountPower;
+	static const uint64_t TransitionCountBlockSize;
+	static const uint64_t TransitionCountDataUnit;
+
 public:
 	typedef std::pair<int64_t, bool> EdgePair;
 
 public:
-	LogicSnapshot(const sr_datafeed_logic &logic);
+	/**
+	 * Gets the layout new snapshots are created with by default.
+	 */
+	static Layout get_default_layout();
+
+	/**
+	 * Sets the layout new snapshots are created with by default.
+	 */
+	static void set_default_layout(Layout layout);
+
+public:
+	/**
+	 * Constructor.
+	 * @param logic The first payload of the snapshot.
+	 * @param layout The layout to store the samples in.
+	 * @param ring_length The number of samples to keep, or 0 to keep
+	 *   them all. Ring buffers always use the Interleaved layout.
+	 */
+	LogicSnapshot(const sr_datafeed_logic &logic,
+		Layout layout = get_default_layout(),
+		uint64_t ring_length = 0);
 
 	virtual ~LogicSnapshot();
 
+	Layout get_layout() const;
+
+	/**
+	 * Gets the number of probes a sample holds, which is a multiple
+	 * of 8 and may exceed 64.
+	 */
+	unsigned int get_probe_count() const;
+
 	void append_payload(const sr_datafeed_logic &logic);
 
+	/**
+	 * Copies a range of samples out of the snapshot as they were
+	 * appended, whatever layout they are stored in.
+	 * @param pin A pin held on this snapshot.
+	 * @param dest The buffer to copy the samples into. It must hold
+	 *   (end - start) samples.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one to copy.
+	 */
+	void get_samples(const Pin &pin, uint8_t *dest, uint64_t start,
+		uint64_t end) const;
+
+	/**
+	 * Finds the first edge of a signal after a sample.
+	 * @param[in] index The index of the sample to search after.
+	 * @param[in] sig_index The index of the signal.
+	 * @param[out] edge The index of the first sample after the edge,
+	 *   and the level the signal changed to.
+	 *
+	 * @return Returns true if an edge was found.
+	 */
+	bool find_next_edge(uint64_t index, int sig_index,
+		EdgePair &edge) const;
+
+	/**
+	 * Finds the last edge of a signal before a sample.
+	 * @param[in] index The index of the sample to search before.
+	 * @param[in] sig_index The index of the signal.
+	 * @param[out] edge The index of the first sample after the edge,
+	 *   and the level the signal changed to.
+	 *
+	 * @return Returns true if an edge was found.
+	 */
+	bool find_previous_edge(uint64_t index, int sig_index,
+		EdgePair &edge) const;
+
+	/**
+	 * Counts the edges of a signal in a range of samples.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one.
+	 * @param sig_index The index of the signal.
+	 *
+	 * @return Returns the number of samples in the range at which the
+	 *   signal differs from the sample before.
+	 */
+	uint64_t get_edge_count(uint64_t start, uint64_t end,
+		int sig_index) const;
+
 private:
+	void append_samples(const void *data, uint64_t samples);
+
+	void update_index(uint64_t end);
+
+	void build_index();
+
+	/**
+	 * Builds the index over the samples which have not been indexed,
+	 * splitting the samples between a number of threads. The running
+	 * totals of the transition counts, which are a small part of the
+	 * work, are then added up on the calling thread. The higher levels
+	 * of the mip-map are left to be built as they are read, unless the
+	 * snapshot is a ring buffer.
+	 */
+	void build_index(unsigned int thread_count);
+
+	/**
+	 * Builds the parts of the index which the threads of build_index
+	 * split between them.
+	 * @param start The index of the first level 0 mip-map sample.
+	 * @param end The index of the level 0 mip-map sample after the
+	 *   last one.
+	 * @param count_start The first block of the transition counts.
+	 *   The counts are left holding the transitions of their block
+	 *   alone.
+	 * @param count_end The block after the last one.
+	 */
+	void build_index_stretch(uint64_t start, uint64_t end,
+		uint64_t count_start, uint64_t count_end) const;
+
+	bool reserve_samples(uint64_t sample_count);
+
+	void append_run_length_data(const uint8_t *data, uint64_t samples);
+
+	/**
+	 * Compresses the raw blocks which the index has been brought up to
+	 * date over.
+	 * @param end The index of the sample after the last one indexed.
+	 */
+	void compress_run_blocks(uint64_t end);
+
+	/**
+	 * Replaces a raw block with its runs, unless it would not
+	 * compress.
+	 */
+	void compress_run_block(RunBlock &b);
+
+	uint64_t get_run_block_size(const RunBlock &b) const;
+
+	void append_bit_plane_data(const uint8_t *data, uint64_t samples);
+
+	bool allocate_bit_plane_chunk();
+
+	bool reserve_bit_plane_chunks(uint64_t sample_count);
+
+	/**
+	 * Computes level 0 of the mip-map from the bit planes.
+	 * @param dest The mip-map sample to write to first.
+	 * @param start The index of the first mip-map sample to compute.
+	 * @param end The index of the mip-map sample after the last one.
+	 */
+	void append_bit_planes_to_mipmap(uint8_t *dest, uint64_t start,
+		uint64_t end) const;
+
+	/**
+	 * Grows the buffer of a mip-map level to hold at least a number
+	 * of samples.
+	 * @return Returns false if the buffer could not be grown.
+	 */
+	bool reserve_mipmap_level(MipMapLevel &m, uint64_t length);
+
 	void reallocate_mipmap_level(MipMapLevel &m);
 
-	void append_payload_to_mipmap();
+	/**
+	 * Gets a pointer to an entry of a mip-map level.
+	 */
+	uint8_t* get_mipmap_sample(unsigned int level, uint64_t offset) const;
+
+	void append_payload_to_mipmap(uint64_t end);
+
+	/**
+	 * Computes a stretch of level 0 of the mip-map from the samples.
+	 * @param start The index of the first mip-map sample to compute.
+	 * @param end The index of the mip-map sample after the last one.
+	 * @param[in,out] last_sample The sample before the stretch, one
+	 *   per word. On return it holds the last sample of the stretch.
+	 */
+	void append_samples_to_mipmap(uint64_t start, uint64_t end,
+		uint64_t *last_sample) const;
+
+	/**
+	 * Computes the higher levels of the mip-map from level 0.
+	 */
+	void append_mipmap_levels();
+
+	/**
+	 * Grows the higher levels of the mip-map to cover level 0, but
+	 * leaves their new entries to be built by get_subsample as they
+	 * are first read. The snapshot is then lazy.
+	 */
+	void defer_mipmap_levels();
+
+	/**
+	 * Builds the entries of a lazy snapshot's mip-map which have not
+	 * been read yet, so that the snapshot is no longer lazy.
+	 */
+	void build_lazy_levels();
+
+	/**
+	 * Builds a block of LazyBlockSize entries of a mip-map level of a
+	 * lazy snapshot, and the blocks of the lower levels it is reduced
+	 * from, unless they have been built already. This is called with
+	 * either the lazy mutex locked or the mutex exclusively locked.
+	 */
+	void build_mipmap_block(unsigned int level, uint64_t block) const;
+
+	bool reserve_transition_counts(uint64_t length);
+
+	void append_payload_to_transition_counts(uint64_t end);
+
+	/**
+	 * Adds the transitions of each probe in a block of the transition
+	 * counts onto the counts.
+	 */
+	void count_block_transitions(uint64_t *counts, uint64_t block) const;
+
+	/**
+	 * Counts the edges of a signal from the first sample up to a
+	 * sample, using the transition counts where they are available.
+	 */
+	uint64_t count_edges_before(uint64_t index, int sig_index) const;
+
+	/**
+	 * Searches forward for the first edge at or after a sample,
+	 * descending the mip-map to skip blocks without transitions.
+	 * @return Returns the index of the sample after the edge, or the
+	 *   sample count if there is none.
+	 */
+	uint64_t find_next_transition(uint64_t index, unsigned int word,
+		uint64_t sig_mask) const;
+
+	/**
+	 * Finds the first mip-map block at a level in which a signal has
+	 * a transition, climbing the higher levels to skip idle stretches.
+	 * @param index The sample to search from, aligned to a block at
+	 *   min_level.
+	 * @param min_level The level of the blocks to find.
+	 * @param word The word of the sample which holds the signals.
+	 * @param sig_mask The mask of the signals in the word.
+	 *
+	 * @return Returns the index of the first sample of the block, or
+	 *   the end of the level if there is none.
+	 */
+	uint64_t find_flagged_block(uint64_t index, unsigned int min_level,
+		unsigned int word, uint64_t sig_mask) const;
+
+	/**
+	 * Searches backward for the last edge before a sample, descending
+	 * the mip-map to skip blocks without transitions.
+	 * @return Returns the index of the sample after the edge, or 0 if
+	 *   there is none.
+	 */
+	uint64_t find_previous_transition(uint64_t index,
+		unsigned int word, uint64_t sig_mask) const;
 
-	uint64_t get_sample(uint64_t index) const;
+	/**
+	 * Searches backward sample by sample for the last edge in a range.
+	 * @return Returns the index of the sample after the edge, or 0 if
+	 *   there is none.
+	 */
+	uint64_t find_previous_change(uint64_t start, uint64_t end,
+		unsigned int word, uint64_t sig_mask) const;
+
+	const uint8_t* get_sample_span(uint64_t start, uint64_t end,
+		uint64_t &length) const;
+
+	/**
+	 * Gets a word of 64 probes of a sample. Bits of probes beyond the
+	 * unit size are clear.
+	 */
+	uint64_t get_sample(uint64_t index, unsigned int word = 0) const;
+
+	const uint8_t* get_run_length_sample(uint64_t index) const;
+
+	uint64_t get_bit_plane_sample(uint64_t index,
+		unsigned int word) const;
+
+	/**
+	 * Gets the bit plane word which holds a sample of a probe. The
+	 * words of a probe are contiguous up to the end of the chunk.
+	 */
+	const uint64_t* get_bit_plane_word(int probe, uint64_t index) const;
+
+	/**
+	 * Searches forward for the first sample at which a signal differs
+	 * from a given level.
+	 * @param start The index of the sample to start searching from.
+	 * @param end The index of the sample after the last to search.
+	 * @param word The word of the sample which holds the signal.
+	 * @param sig_mask The mask of the signal's bit in the word.
+	 * @param level The level the signal is currently at.
+	 *
+	 * @return Returns the index of the first sample which differs,
+	 *   or end if there is none.
+	 */
+	uint64_t find_change(uint64_t start, uint64_t end,
+		unsigned int word, uint64_t sig_mask, bool level) const;
+
+	uint64_t find_run_length_change(uint64_t start, uint64_t end,
+		unsigned int word, uint64_t sig_mask, bool level) const;
+
+	uint64_t find_bit_plane_change(uint64_t start, uint64_t end,
+		unsigned int word, uint64_t sig_mask, bool level) const;
 
 public:
 	/**
@@ -86,20 +471,160 @@ public:
 		uint64_t start, uint64_t end,
 		float min_length, int sig_index);
 
+	/**
+	 * Generates the lists of transitions of several signals in one
+	 * pass, sharing the walk of the mip-map between them. The lists
+	 * are the same as get_subsampled_edges would give for each signal.
+	 * @param[out] edges The vector to place the edges into, indexed by
+	 *   signal. Lists of signals not in sig_mask are left untouched.
+	 * @param[in] start The start sample index.
+	 * @param[in] end The end sample index.
+	 * @param[in] min_length The minimum number of samples that
+	 * can be resolved at this level of detail.
+	 * @param[in] sig_mask The mask of the signals in the word.
+	 * @param[in] word The word of 64 signals to generate the lists
+	 *   of. Bit n of sig_mask is signal word * 64 + n.
+	 **/
+	void get_subsampled_edges(
+		std::vector< std::vector<EdgePair> > &edges,
+		uint64_t start, uint64_t end,
+		float min_length, uint64_t sig_mask, unsigned int word = 0);
+
+private:
+	void prefetch_edge_data(uint64_t start, uint64_t end,
+		float min_length, unsigned int min_level) const;
+
 private:
-	uint64_t get_subsample(int level, uint64_t offset) const;
+	uint64_t get_subsample(int level, uint64_t offset,
+		unsigned int word = 0) const;
+
+	/**
+	 * Gets the number of 64-bit words a sample is addressed in. The
+	 * samples are padded so that a word may be read whole even when
+	 * the unit ends part way through it.
+	 */
+	unsigned int get_word_count() const;
+
+	/**
+	 * Gets the number of bytes of the unit which a word covers.
+	 */
+	int get_word_width(unsigned int word) const;
+
+	/**
+	 * Gets the mask of the probes of the unit which a word covers.
+	 */
+	uint64_t get_word_mask(unsigned int word) const;
+
+	/**
+	 * Gets the kernels for a unit size. Unit sizes without kernels
+	 * of their own get kernels which take the size at run time.
+	 */
+	static Kernels get_kernels(int unit_size);
+
+	template <int UnitSize>
+	static Kernels make_kernels();
+
+	/**
+	 * Reads a word of a sample. Kernels for a unit size read the
+	 * whole unit, others read width bytes.
+	 */
+	template <int UnitSize>
+	static uint64_t read_sample(const uint8_t *src, int width);
+
+	template <int UnitSize>
+	static void accumulate_transitions(uint8_t *dest, const uint8_t *src,
+		uint64_t blocks, int unit_size, uint64_t *last_sample);
+
+	template <int UnitSize>
+	static void reduce_mipmap_blocks(uint8_t *dest, const uint8_t *src,
+		uint64_t blocks, int unit_size);
+
+	template <int UnitSize>
+	static uint64_t find_span_change(const uint8_t *src, uint64_t length,
+		int unit_size, uint64_t sig_mask, bool level);
+
+	template <int UnitSize>
+	static void count_span_transitions(uint64_t *counts,
+		const uint8_t *src, uint64_t length, int unit_size,
+		uint64_t *last_sample);
 
 	static uint64_t pow2_ceil(uint64_t x, unsigned int power);
 
+	static unsigned int count_trailing_zeros(uint64_t x);
+
+	static unsigned int count_set_bits(uint64_t x);
+
+	/**
+	 * Transposes an 8x8 bit matrix held one row per byte.
+	 */
+	static uint64_t transpose_8x8(uint64_t x);
+
 private:
+	static Layout _default_layout;
+
+	const Layout _layout;
+
 	struct MipMapLevel _mip_map[ScaleStepCount];
-	uint64_t _last_append_sample;
+	/// The last sample appended to the mip-map, one per word.
+	std::vector<uint64_t> _last_append_sample;
+
+	std::vector<RunBlock> _run_blocks;
+	uint8_t *_run_tail;
+
+	/// The number of blocks at the front of _run_blocks which have
+	/// been indexed and compressed. The blocks after them are held raw
+	/// until the index has been brought up to date over them.
+	uint64_t _compressed_run_block_count;
+
+	/// Chunks of ChunkSize samples in the BitPlane layout. Each holds
+	/// the bit stream of every probe in turn.
+	std::vector<uint64_t*> _bit_plane_chunks;
+
+	/// The number of edges of each probe from the start of the
+	/// snapshot up to the end of each block of TransitionCountBlockSize
+	/// samples.
+	uint64_t *_transition_counts;
+	const uint64_t _transition_count_mask;
+	uint64_t _transition_count_length;
+	uint64_t _transition_count_data_length;
+
+	const Kernels _kernels;
+	const Simd::LogicTransitionKernel _transition_kernel;
+	const Simd::LogicReductionKernel _reduction_kernel;
+
+	/// Set when the higher levels of the mip-map are built as they are
+	/// read, rather than as the samples are appended.
+	bool _lazy_mipmap;
+
+	/// Guards the building of the blocks of a lazy mip-map by readers.
+	mutable boost::mutex _lazy_mutex;
+
+	/// Flags the blocks of each level of a lazy mip-map which have
+	/// been built. Readers check a flag before taking the lazy mutex,
+	/// so a flag is set with a release store once its block is built.
+	mutable std::vector<uint8_t> _lazy_blocks[ScaleStepCount];
 
 	friend class LogicSnapshotTest::Pow2;
 	friend class LogicSnapshotTest::Basic;
 	friend class LogicSnapshotTest::LargeData;
 	friend class LogicSnapshotTest::Pulses;
 	friend class LogicSnapshotTest::LongPulses;
+	friend class LogicSnapshotTest::ChunkBoundaries;
+	friend class LogicSnapshotTest::Spilled;
+	friend class LogicSnapshotTest::RunLength;
+	friend class LogicSnapshotTest::RunLengthIndexingThread;
+	friend class LogicSnapshotTest::SimdKernels;
+	friend class LogicSnapshotTest::BitPlane;
+	friend class LogicSnapshotTest::Deferred;
+	friend class LogicSnapshotTest::IndexingThread;
+	friend class LogicSnapshotTest::IndexingThreadBacklog;
+	friend class LogicSnapshotTest::EdgeQueries;
+	friend class LogicSnapshotTest::Reserve;
+	friend class LogicSnapshotTest::MemoryUsage;
+	friend class LogicSnapshotTest::RingBuffer;
+	friend class LogicSnapshotTest::SampleMask;
+	friend class LogicSnapshotTest::DeferredIndexing;
+	friend class LogicSnapshotTest::LazyMipMap;
 };
 
 } // namespace data
@@ -0,0 +1,184 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "packetqueue.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "atomic.h"
+
+using namespace std;
+
+namespace pv {
+namespace data {
+
+PacketQueue::PacketQueue(size_t capacity) :
+	_slots(capacity),
+	_head(0),
+	_tail(0),
+	_high_water_mark(0),
+	_allocation_count(0),
+	_pool_size(0)
+{
+	assert(capacity != 0);
+}
+
+bool PacketQueue::push(const sr_dev_inst *sdi,
+	const sr_datafeed_packet &packet, uint64_t samplerate)
+{
+	// The slot at the tail is not reused until the consumer has
+	// released it by moving the head on
+	const size_t tail = _tail;
+	const size_t head = load_acquire(&_head);
+
+	const size_t depth = tail - head;
+	if (depth == _slots.size())
+		return false;
+
+	Packet &p = _slots[tail % _slots.size()];
+	p.type = packet.type;
+	p.sdi = sdi;
+	p.samplerate = samplerate;
+
+	switch (packet.type) {
+	case SR_DF_LOGIC:
+	{
+		assert(packet.payload);
+		const sr_datafeed_logic &logic =
+			*(const sr_datafeed_logic*)packet.payload;
+		p.logic = logic;
+		p.logic.data = copy_payload(p, logic.data, logic.length);
+		break;
+	}
+
+	case SR_DF_ANALOG:
+	{
+		assert(packet.payload);
+		const sr_datafeed_analog &analog =
+			*(const sr_datafeed_analog*)packet.payload;
+		p.analog = analog;
+		p.analog.data = (float*)copy_payload(p, analog.data,
+			analog.num_samples * sizeof(float));
+
+		// The probe list belongs to the driver, and may be freed
+		// once the packet has been sent
+		p.analog.probes = NULL;
+		break;
+	}
+
+	default:
+		// Only the type of other packets is stored
+		break;
+	}
+
+	store_release(&_tail, tail + 1);
+
+	if (depth + 1 > _high_water_mark)
+		store_release(&_high_water_mark, depth + 1);
+
+	return true;
+}
+
+const PacketQueue::Packet* PacketQueue::front() const
+{
+	const size_t head = _head;
+	if (load_acquire(&_tail) == head)
+		return NULL;
+
+	return &_slots[head % _slots.size()];
+}
+
+void PacketQueue::pop()
+{
+	const size_t head = _head;
+	assert(load_acquire(&_tail) != head);
+
+	store_release(&_head, head + 1);
+}
+
+size_t PacketQueue::get_capacity() const
+{
+	return _slots.size();
+}
+
+size_t PacketQueue::get_depth() const
+{
+	const size_t head = load_acquire(&_head);
+	return load_acquire(&_tail) - head;
+}
+
+size_t PacketQueue::get_high_water_mark() const
+{
+	return load_acquire(&_high_water_mark);
+}
+
+void PacketQueue::reset_high_water_mark()
+{
+	store_release(&_high_water_mark, get_depth());
+}
+
+size_t PacketQueue::get_allocation_count() const
+{
+	return load_acquire(&_allocation_count);
+}
+
+size_t PacketQueue::get_pool_size() const
+{
+	return load_acquire(&_pool_size);
+}
+
+void PacketQueue::clear_pool()
+{
+	assert(get_depth() == 0);
+
+	for (vector<Packet>::iterator i = _slots.begin();
+		i != _slots.end(); i++)
+		vector<uint8_t>().swap((*i).data);
+	store_release(&_allocation_count, 0);
+	store_release(&_pool_size, 0);
+}
+
+void* PacketQueue::copy_payload(Packet &p, const void *data, size_t length)
+{
+	if (length == 0)
+		return NULL;
+
+	if (length > p.data.size()) {
+		// Grow to the next power of two, so that a device whose
+		// packets slowly get longer does not allocate every lap
+		size_t size = 1;
+		while (size < length)
+			size <<= 1;
+
+		const size_t prev_size = p.data.size();
+		vector<uint8_t>().swap(p.data);
+		p.data.resize(size);
+
+		store_release(&_allocation_count, _allocation_count + 1);
+		store_release(&_pool_size, _pool_size - prev_size + size);
+	}
+
+	memcpy(&p.data.front(), data, length);
+	return &p.data.front();
+}
+
+} // namespace data
+} // namespace pv
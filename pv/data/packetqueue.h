@@ -0,0 +1,166 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_PACKETQUEUE_H
+#define PULSEVIEW_PV_DATA_PACKETQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <libsigrok/libsigrok.h>
+
+namespace pv {
+namespace data {
+
+/**
+ * A bounded queue which passes copies of datafeed packets from the
+ * libsigrok session thread to the thread which stores them.
+ *
+ * The queue takes no locks. It may only be pushed to by one thread and
+ * popped from by one other thread. The indices are published with
+ * release stores and read with acquire loads, which order them with
+ * the slots they hand over.
+ *
+ * The payload buffers of the slots form a pool which is recycled as the
+ * queue wraps around. A buffer is only allocated when a packet does not
+ * fit in its slot, and then to the next power of two, so once the
+ * buffers have grown to fit the largest packets the device sends, the
+ * queue makes no further heap allocations.
+ */
+class PacketQueue
+{
+public:
+	/**
+	 * A copy of a datafeed packet. The payload of a logic or analog
+	 * packet points into the pooled buffer of the slot.
+	 */
+	struct Packet
+	{
+		uint16_t type;
+		const sr_dev_inst *sdi;
+
+		/// The samplerate of the device, passed on with a header
+		/// packet by the thread which can ask libsigrok for it.
+		uint64_t samplerate;
+
+		sr_datafeed_logic logic;
+		sr_datafeed_analog analog;
+		std::vector<uint8_t> data;
+	};
+
+public:
+	/**
+	 * Constructor.
+	 * @param capacity The most packets which may wait in the queue.
+	 */
+	PacketQueue(size_t capacity);
+
+	/**
+	 * Copies a packet to the back of the queue. This may only be
+	 * called on the producer thread.
+	 * @param samplerate The samplerate to pass on with a header packet.
+	 * @return false if the queue is full, in which case nothing is
+	 * copied.
+	 */
+	bool push(const sr_dev_inst *sdi, const sr_datafeed_packet &packet,
+		uint64_t samplerate = 0);
+
+	/**
+	 * Gets the packet at the front of the queue. This may only be
+	 * called on the consumer thread.
+	 * @return The packet, or NULL if the queue is empty. The packet
+	 * stays valid until it is popped.
+	 */
+	const Packet* front() const;
+
+	/**
+	 * Hands the slot of the packet at the front of the queue back to
+	 * the producer. This may only be called on the consumer thread,
+	 * when the queue is not empty.
+	 */
+	void pop();
+
+	size_t get_capacity() const;
+
+	/**
+	 * Gets the number of packets waiting in the queue.
+	 */
+	size_t get_depth() const;
+
+	/**
+	 * Gets the most packets which have waited in the queue at once
+	 * since the high-water mark was last reset.
+	 */
+	size_t get_high_water_mark() const;
+
+	/**
+	 * Resets the high-water mark to the current depth. This may only
+	 * be called on the producer thread, or while nothing is pushed.
+	 */
+	void reset_high_water_mark();
+
+	/**
+	 * Gets the number of times a payload buffer has been allocated
+	 * since the pool was last cleared.
+	 */
+	size_t get_allocation_count() const;
+
+	/**
+	 * Gets the bytes held by the payload buffers of the slots.
+	 */
+	size_t get_pool_size() const;
+
+	/**
+	 * Frees the payload buffers of the slots, and zeroes the
+	 * allocation count. This may only be called while the queue is
+	 * empty and nothing is pushed.
+	 */
+	void clear_pool();
+
+private:
+	/**
+	 * Copies a payload into the buffer of a slot, growing the buffer
+	 * if it is too small.
+	 * @return A pointer to the copy, or NULL if the payload is empty.
+	 */
+	void* copy_payload(Packet &p, const void *data, size_t length);
+
+private:
+	std::vector<Packet> _slots;
+
+	/// The number of packets ever popped. Only the consumer writes it.
+	size_t _head;
+
+	/// The number of packets ever pushed. Only the producer writes it.
+	size_t _tail;
+
+	size_t _high_water_mark;
+
+	/// The pool statistics. Only the producer writes them.
+	size_t _allocation_count;
+	size_t _pool_size;
+};
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_PACKETQUEUE_H
@@ -0,0 +1,775 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "sessionfile.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <zlib.h>
+
+using namespace boost;
+using namespace std;
+
+namespace pv {
+namespace data {
+
+const size_t SessionFile::PieceSize = 4 << 20;	// bytes
+const size_t SessionFile::ReadSize = 1 << 20;	// bytes
+const unsigned int SessionFile::PiecesPerThread = 2;
+
+/**
+ * The chunks of a version 2 file, as they are inflated by the worker
+ * threads and taken in order by the loading thread.
+ */
+struct SessionFile::ChunkQueue
+{
+	mutex queue_mutex;
+	condition_variable cond;
+
+	const vector<Entry> *chunks;
+	CancelHandler cancel_handler;
+
+	vector< vector<uint8_t> > data;
+	vector<bool> done;
+
+	/// The index of the next chunk to be inflated.
+	size_t next;
+
+	/// The number of chunks taken by the loading thread.
+	size_t taken;
+
+	/// The most chunks which may be inflated ahead of those taken.
+	size_t window;
+
+	bool failed;
+};
+
+/**
+ * Passes data on in whole samples, holding back any part of a sample
+ * which ends a piece until the rest of it arrives.
+ */
+class SampleFeeder
+{
+public:
+	typedef function<void (const uint8_t*, size_t)> Sink;
+
+public:
+	SampleFeeder(Sink sink, unsigned int unit_size) :
+		_sink(sink),
+		_unit_size(unit_size)
+	{
+	}
+
+	void feed(const uint8_t *data, size_t length)
+	{
+		if (!_carry.empty()) {
+			const size_t n = min(length,
+				(size_t)_unit_size - _carry.size());
+			_carry.insert(_carry.end(), data, data + n);
+			data += n;
+			length -= n;
+
+			if (_carry.size() < _unit_size)
+				return;
+			_sink(&_carry[0], _unit_size);
+			_carry.clear();
+		}
+
+		const size_t whole = length - length % _unit_size;
+		if (whole != 0)
+			_sink(data, whole);
+		_carry.insert(_carry.end(), data + whole, data + length);
+	}
+
+private:
+	const Sink _sink;
+	const unsigned int _unit_size;
+	vector<uint8_t> _carry;
+};
+
+static void send_logic(SessionFile::LogicHandler handler,
+	unsigned int unit_size, const uint8_t *data, size_t length)
+{
+	sr_datafeed_logic logic;
+	logic.length = length;
+	logic.unitsize = unit_size;
+	logic.data = (void*)data;
+	handler(logic);
+}
+
+static void send_analog(SessionFile::AnalogHandler handler,
+	const uint8_t *data, size_t length)
+{
+	sr_datafeed_analog analog;
+	memset(&analog, 0, sizeof(analog));
+	analog.num_samples = length / sizeof(float);
+	analog.data = (float*)data;
+	handler(analog);
+}
+
+static inline uint16_t read_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t read_le32(const uint8_t *p)
+{
+	return read_le16(p) | ((uint32_t)read_le16(p + 2) << 16);
+}
+
+static inline uint64_t read_le64(const uint8_t *p)
+{
+	return read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static bool read_at(istream &f, uint64_t offset, uint8_t *data,
+	size_t length)
+{
+	f.clear();
+	f.seekg((streamoff)offset);
+	f.read((char*)data, length);
+	return f.gcount() == (streamsize)length;
+}
+
+static string trim(const string &s)
+{
+	size_t begin = 0, end = s.size();
+	while (begin < end && isspace((unsigned char)s[begin]))
+		begin++;
+	while (end > begin && isspace((unsigned char)s[end - 1]))
+		end--;
+	return s.substr(begin, end - begin);
+}
+
+SessionFile::SessionFile() :
+	_samplerate(0),
+	_unit_size(0),
+	_total_probe_count(0)
+{
+}
+
+bool SessionFile::open(const string &path)
+{
+	ifstream f(path.c_str(), ios::in | ios::binary);
+	if (!f)
+		return false;
+
+	_path = path;
+	_entries.clear();
+	_samplerate = 0;
+	_unit_size = 0;
+	_total_probe_count = 0;
+	return read_directory(f) && read_metadata(f);
+}
+
+uint64_t SessionFile::get_samplerate() const
+{
+	return _samplerate;
+}
+
+unsigned int SessionFile::get_unit_size() const
+{
+	return _unit_size;
+}
+
+unsigned int SessionFile::get_total_probe_count() const
+{
+	return _total_probe_count;
+}
+
+const vector< pair<int, string> >& SessionFile::get_probes() const
+{
+	return _probes;
+}
+
+uint64_t SessionFile::get_sample_count() const
+{
+	return _unit_size ? get_data_size(_chunks) / _unit_size : 0;
+}
+
+bool SessionFile::has_analog() const
+{
+	return !_analog_chunks.empty();
+}
+
+const pair<int, string>& SessionFile::get_analog_probe() const
+{
+	return _analog_probe;
+}
+
+uint64_t SessionFile::get_analog_sample_count() const
+{
+	return get_data_size(_analog_chunks) / sizeof(float);
+}
+
+bool SessionFile::read(LogicHandler logic_handler,
+	AnalogHandler analog_handler, ProgressHandler progress_handler,
+	unsigned int thread_count, CancelHandler cancel_handler) const
+{
+	assert(thread_count != 0);
+
+	const uint64_t total = get_data_size(_chunks) +
+		get_data_size(_analog_chunks);
+	uint64_t done = 0;
+
+	if (logic_handler && !_chunks.empty()) {
+		SampleFeeder feeder(bind(&send_logic, logic_handler,
+			_unit_size, _1, _2), _unit_size);
+		if (!read_chunks(_chunks, bind(&SampleFeeder::feed,
+			&feeder, _1, _2), progress_handler, done, total,
+			thread_count, cancel_handler))
+			return false;
+	} else
+		done += get_data_size(_chunks);
+
+	if (analog_handler && !_analog_chunks.empty()) {
+		SampleFeeder feeder(bind(&send_analog, analog_handler,
+			_1, _2), sizeof(float));
+		if (!read_chunks(_analog_chunks, bind(&SampleFeeder::feed,
+			&feeder, _1, _2), progress_handler, done, total,
+			thread_count, cancel_handler))
+			return false;
+	}
+
+	return true;
+}
+
+bool SessionFile::read_chunks(const vector<Entry> &chunks,
+	function<void (const uint8_t*, size_t)> sink,
+	ProgressHandler progress_handler, uint64_t &done, uint64_t total,
+	unsigned int thread_count, CancelHandler cancel_handler) const
+{
+	assert(sink);
+	assert(thread_count != 0);
+
+	// One entry can only be inflated from start to end, so a version 1
+	// file is read on this thread alone
+	thread_count = min(thread_count, (unsigned int)chunks.size());
+	if (thread_count <= 1) {
+		ifstream f(_path.c_str(), ios::in | ios::binary);
+		if (!f)
+			return false;
+
+		for (vector<Entry>::const_iterator i = chunks.begin();
+			i != chunks.end(); i++) {
+			if (!inflate_entry(f, *i, sink, cancel_handler))
+				return false;
+
+			done += (*i).size;
+			if (progress_handler)
+				progress_handler(done, total);
+		}
+
+		return true;
+	}
+
+	// Inflate the chunks on the worker threads, a few ahead of those
+	// taken, and take them in order on this thread
+	ChunkQueue queue;
+	queue.chunks = &chunks;
+	queue.cancel_handler = cancel_handler;
+	queue.data.resize(chunks.size());
+	queue.done.resize(chunks.size(), false);
+	queue.next = 0;
+	queue.taken = 0;
+	queue.window = thread_count * PiecesPerThread;
+	queue.failed = false;
+
+	boost::thread_group workers;
+	for (unsigned int i = 0; i < thread_count; i++)
+		workers.create_thread(bind(&SessionFile::inflate_chunks_proc,
+			this, &queue));
+
+	for (size_t i = 0; i < chunks.size(); i++) {
+		vector<uint8_t> data;
+
+		{
+			unique_lock<mutex> lock(queue.queue_mutex);
+			while (!queue.done[i] && !queue.failed)
+				queue.cond.wait(lock);
+			if (queue.failed)
+				break;
+
+			queue.data[i].swap(data);
+			queue.taken = i + 1;
+			queue.cond.notify_all();
+		}
+
+		if (!data.empty())
+			sink(&data[0], data.size());
+
+		done += data.size();
+		if (progress_handler)
+			progress_handler(done, total);
+	}
+
+	workers.join_all();
+	return !queue.failed;
+}
+
+bool SessionFile::read_directory(istream &f)
+{
+	const size_t EndRecordSize = 22;
+	const size_t MaxCommentSize = 0xFFFF;
+	const size_t Zip64LocatorSize = 20;
+	const size_t Zip64EndRecordSize = 56;
+	const size_t CentralHeaderSize = 46;
+
+	// Find the end of central directory record, which is followed by
+	// the comment of the archive
+	f.seekg(0, ios::end);
+	const uint64_t file_size = f.tellg();
+	if (file_size < EndRecordSize)
+		return false;
+
+	const size_t tail_size = (size_t)min(file_size,
+		(uint64_t)(EndRecordSize + MaxCommentSize));
+	vector<uint8_t> tail(tail_size);
+	if (!read_at(f, file_size - tail_size, &tail[0], tail_size))
+		return false;
+
+	size_t end = tail_size - EndRecordSize + 1;
+	do {
+		if (end-- == 0)
+			return false;
+	} while (read_le32(&tail[end]) != 0x06054b50);
+
+	uint64_t entry_count = read_le16(&tail[end + 10]);
+	uint64_t directory_size = read_le32(&tail[end + 12]);
+	uint64_t directory_offset = read_le32(&tail[end + 16]);
+
+	// Archives too large for the record have a zip64 record as well
+	if (entry_count == 0xFFFF || directory_size == 0xFFFFFFFF ||
+		directory_offset == 0xFFFFFFFF) {
+		const uint64_t end_offset = file_size - tail_size + end;
+		if (end_offset < Zip64LocatorSize)
+			return false;
+
+		uint8_t locator[Zip64LocatorSize];
+		if (!read_at(f, end_offset - Zip64LocatorSize, locator,
+			Zip64LocatorSize) ||
+			read_le32(locator) != 0x07064b50)
+			return false;
+
+		uint8_t record[Zip64EndRecordSize];
+		if (!read_at(f, read_le64(locator + 8), record,
+			Zip64EndRecordSize) ||
+			read_le32(record) != 0x06064b50)
+			return false;
+
+		entry_count = read_le64(record + 32);
+		directory_size = read_le64(record + 40);
+		directory_offset = read_le64(record + 48);
+	}
+
+	if (directory_offset + directory_size > file_size)
+		return false;
+
+	vector<uint8_t> directory((size_t)directory_size);
+	if (!directory.empty() && !read_at(f, directory_offset,
+		&directory[0], directory.size()))
+		return false;
+
+	size_t pos = 0;
+	for (uint64_t i = 0; i < entry_count; i++) {
+		if (pos + CentralHeaderSize > directory.size())
+			return false;
+
+		const uint8_t *const h = &directory[pos];
+		if (read_le32(h) != 0x02014b50)
+			return false;
+
+		const uint16_t flags = read_le16(h + 8);
+		const size_t name_length = read_le16(h + 28);
+		const size_t extra_length = read_le16(h + 30);
+		const size_t comment_length = read_le16(h + 32);
+		if (pos + CentralHeaderSize + name_length + extra_length +
+			comment_length > directory.size())
+			return false;
+
+		Entry entry;
+		entry.method = read_le16(h + 10);
+		entry.compressed_size = read_le32(h + 20);
+		entry.size = read_le32(h + 24);
+		entry.offset = read_le32(h + 42);
+
+		const string name((const char*)h + CentralHeaderSize,
+			name_length);
+
+		// Sizes and offsets which do not fit are given in the zip64
+		// extra field, in this order
+		const uint8_t *extra = h + CentralHeaderSize + name_length;
+		const uint8_t *const extra_end = extra + extra_length;
+		while (extra + 4 <= extra_end) {
+			const uint16_t id = read_le16(extra);
+			const uint16_t length = read_le16(extra + 2);
+			const uint8_t *field = extra + 4;
+			if (field + length > extra_end)
+				break;
+
+			if (id == 0x0001) {
+				const uint8_t *const field_end = field + length;
+				uint64_t *const values[] = {&entry.size,
+					&entry.compressed_size, &entry.offset};
+				for (unsigned int j = 0; j < 3; j++)
+					if (*values[j] == 0xFFFFFFFF &&
+						field + 8 <= field_end) {
+						*values[j] = read_le64(field);
+						field += 8;
+					}
+			}
+
+			extra += 4 + length;
+		}
+
+		// Encrypted entries cannot be read
+		if (!(flags & 1))
+			_entries[name] = entry;
+
+		pos += CentralHeaderSize + name_length + extra_length +
+			comment_length;
+	}
+
+	return true;
+}
+
+bool SessionFile::read_metadata(istream &f)
+{
+	map<string, Entry>::const_iterator e;
+	vector<uint8_t> data;
+
+	// Versions 1 and 2 differ only in how the samples are stored
+	if ((e = _entries.find("version")) == _entries.end() ||
+		!read_entry(f, (*e).second, data))
+		return false;
+
+	const int version = atoi(string(data.begin(), data.end()).c_str());
+	if (version != 1 && version != 2)
+		return false;
+
+	if ((e = _entries.find("metadata")) == _entries.end() ||
+		!read_entry(f, (*e).second, data))
+		return false;
+
+	// The metadata is a key file with a section for each device
+	istringstream metadata(string(data.begin(), data.end()));
+	string line, section, capture_file;
+	unsigned int device_count = 0, analog_count = 0;
+	map<int, string> probe_names, analog_names;
+
+	while (getline(metadata, line)) {
+		line = trim(line);
+		if (line.empty() || line[0] == '#' || line[0] == ';')
+			continue;
+
+		if (line[0] == '[') {
+			section = trim(line.substr(1, line.find(']') - 1));
+			if (section.compare(0, 7, "device ") == 0)
+				device_count++;
+			continue;
+		}
+
+		if (section.compare(0, 7, "device ") != 0)
+			continue;
+
+		const size_t equals = line.find('=');
+		if (equals == string::npos)
+			continue;
+
+		const string key = trim(line.substr(0, equals));
+		const string value = trim(line.substr(equals + 1));
+
+		if (key == "capturefile")
+			capture_file = value;
+		else if (key == "unitsize")
+			_unit_size = atoi(value.c_str());
+		else if (key == "total probes")
+			_total_probe_count = atoi(value.c_str());
+		else if (key == "samplerate")
+			_samplerate = parse_samplerate(value);
+		else if (key.compare(0, 5, "probe") == 0 && key.size() > 5 &&
+			key.find_first_not_of("0123456789", 5) == string::npos)
+			probe_names[atoi(key.c_str() + 5)] = value;
+		else if (key == "total analog")
+			analog_count = atoi(value.c_str());
+		else if (key.compare(0, 6, "analog") == 0 && key.size() > 6 &&
+			key.find_first_not_of("0123456789", 6) == string::npos)
+			analog_names[atoi(key.c_str() + 6)] = value;
+	}
+
+	// Files of several devices, or of several analog probes, are left
+	// to libsigrok
+	if (device_count != 1 || analog_count > 1)
+		return false;
+
+	// Probes are numbered from 1 in the file
+	_probes.clear();
+	_chunks.clear();
+	if (!capture_file.empty()) {
+		if (_unit_size == 0 || _total_probe_count == 0 ||
+			_total_probe_count > _unit_size * 8)
+			return false;
+
+		for (map<int, string>::const_iterator i =
+			probe_names.begin(); i != probe_names.end(); i++)
+			if ((*i).first >= 1 &&
+				(*i).first <= (int)_total_probe_count)
+				_probes.push_back(make_pair((*i).first - 1,
+					(*i).second));
+		if (_probes.empty())
+			return false;
+
+		// Version 1 files hold the samples in one entry, and
+		// version 2 files in entries numbered from 1
+		find_chunks(capture_file, _chunks);
+		if (_chunks.empty())
+			return false;
+	}
+
+	// The samples of an analog probe are held in the same way, in
+	// entries named after the device and the number of the probe
+	_analog_chunks.clear();
+	if (analog_count != 0) {
+		if (analog_names.empty())
+			return false;
+
+		const map<int, string>::const_iterator i =
+			analog_names.begin();
+		_analog_probe = make_pair((*i).first - 1, (*i).second);
+
+		ostringstream name;
+		name << "analog-1-" << (*i).first;
+		find_chunks(name.str(), _analog_chunks);
+		if (_analog_chunks.empty())
+			return false;
+	}
+
+	return !_chunks.empty() || !_analog_chunks.empty();
+}
+
+void SessionFile::find_chunks(const string &name,
+	vector<Entry> &chunks) const
+{
+	map<string, Entry>::const_iterator e;
+
+	chunks.clear();
+	if ((e = _entries.find(name)) != _entries.end())
+		chunks.push_back((*e).second);
+	else
+		for (unsigned int i = 1; ; i++) {
+			ostringstream chunk_name;
+			chunk_name << name << "-" << i;
+			if ((e = _entries.find(chunk_name.str())) ==
+				_entries.end())
+				break;
+			chunks.push_back((*e).second);
+		}
+
+	// Entries stored in other ways cannot be read
+	for (vector<Entry>::const_iterator i = chunks.begin();
+		i != chunks.end(); i++)
+		if ((*i).method != 0 && (*i).method != Z_DEFLATED) {
+			chunks.clear();
+			return;
+		}
+}
+
+bool SessionFile::inflate_entry(istream &f, const Entry &entry,
+	function<void (const uint8_t*, size_t)> sink,
+	CancelHandler cancel_handler) const
+{
+	const size_t LocalHeaderSize = 30;
+
+	// The name and extra field of the local header may differ from
+	// those of the central directory
+	uint8_t header[LocalHeaderSize];
+	if (!read_at(f, entry.offset, header, LocalHeaderSize) ||
+		read_le32(header) != 0x04034b50)
+		return false;
+
+	f.seekg((streamoff)(entry.offset + LocalHeaderSize +
+		read_le16(header + 26) + read_le16(header + 28)));
+
+	vector<uint8_t> in(max((uint64_t)1,
+		min((uint64_t)ReadSize, entry.compressed_size)));
+	uint64_t remaining = entry.compressed_size;
+
+	if (entry.method == 0) {
+		// Stored entries are passed on as they are read
+		if (entry.size != entry.compressed_size)
+			return false;
+
+		while (remaining != 0) {
+			if (cancel_handler && cancel_handler())
+				return false;
+
+			const size_t length = (size_t)min(remaining,
+				(uint64_t)in.size());
+			f.read((char*)&in[0], length);
+			if (f.gcount() != (streamsize)length)
+				return false;
+			sink(&in[0], length);
+			remaining -= length;
+		}
+
+		return true;
+	}
+
+	assert(entry.method == Z_DEFLATED);
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+		return false;
+
+	vector<uint8_t> out(max((uint64_t)1,
+		min((uint64_t)PieceSize, entry.size)));
+	z.next_out = &out[0];
+	z.avail_out = out.size();
+	uint64_t size = 0;
+	int ret = Z_OK;
+
+	do {
+		if (z.avail_in == 0 && remaining != 0) {
+			const size_t length = (size_t)min(remaining,
+				(uint64_t)in.size());
+			f.read((char*)&in[0], length);
+			if (f.gcount() != (streamsize)length)
+				break;
+
+			z.next_in = &in[0];
+			z.avail_in = length;
+			remaining -= length;
+		}
+
+		// The stream is truncated or corrupt if this makes no
+		// progress
+		ret = inflate(&z, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+
+		// Pieces are passed on once they fill the buffer, or the
+		// stream ends
+		if (z.avail_out == 0 || ret == Z_STREAM_END) {
+			if (cancel_handler && cancel_handler())
+				break;
+
+			const size_t length = out.size() - z.avail_out;
+			if (length != 0)
+				sink(&out[0], length);
+			size += length;
+
+			z.next_out = &out[0];
+			z.avail_out = out.size();
+		}
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&z);
+	return ret == Z_STREAM_END && size == entry.size;
+}
+
+static void append_data(vector<uint8_t> *data, const uint8_t *src,
+	size_t length)
+{
+	data->insert(data->end(), src, src + length);
+}
+
+bool SessionFile::read_entry(istream &f, const Entry &entry,
+	vector<uint8_t> &data, CancelHandler cancel_handler) const
+{
+	data.clear();
+	data.reserve((size_t)entry.size);
+	return inflate_entry(f, entry, bind(&append_data, &data, _1, _2),
+		cancel_handler);
+}
+
+void SessionFile::inflate_chunks_proc(ChunkQueue *queue) const
+{
+	assert(queue);
+
+	ifstream f(_path.c_str(), ios::in | ios::binary);
+
+	unique_lock<mutex> lock(queue->queue_mutex);
+	while (true) {
+		while (!queue->failed && queue->next < queue->chunks->size() &&
+			queue->next >= queue->taken + queue->window)
+			queue->cond.wait(lock);
+		if (queue->failed || queue->next == queue->chunks->size())
+			return;
+
+		const size_t i = queue->next++;
+		lock.unlock();
+
+		vector<uint8_t> data;
+		const bool ok = f && read_entry(f, (*queue->chunks)[i], data,
+			queue->cancel_handler);
+
+		lock.lock();
+		if (!ok) {
+			queue->failed = true;
+			queue->cond.notify_all();
+			return;
+		}
+
+		queue->data[i].swap(data);
+		queue->done[i] = true;
+		queue->cond.notify_all();
+	}
+}
+
+uint64_t SessionFile::get_data_size(const vector<Entry> &chunks)
+{
+	uint64_t size = 0;
+	for (vector<Entry>::const_iterator i = chunks.begin();
+		i != chunks.end(); i++)
+		size += (*i).size;
+	return size;
+}
+
+uint64_t SessionFile::parse_samplerate(const string &s)
+{
+	// libsigrok writes rates as a number of Hz, kHz, MHz or GHz
+	char *end = NULL;
+	const double value = strtod(s.c_str(), &end);
+	while (*end == ' ')
+		end++;
+
+	double scale = 1;
+	switch (*end) {
+	case 'k': case 'K': scale = 1e3; break;
+	case 'm': case 'M': scale = 1e6; break;
+	case 'g': case 'G': scale = 1e9; break;
+	}
+
+	return (uint64_t)(value * scale + 0.5);
+}
+
+} // namespace data
+} // namespace pv
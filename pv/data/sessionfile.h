@@ -0,0 +1,230 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_SESSIONFILE_H
+#define PULSEVIEW_PV_DATA_SESSIONFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <istream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <libsigrok/libsigrok.h>
+
+namespace pv {
+namespace data {
+
+/**
+ * Reads the samples of a sigrok session file directly, rather than
+ * replaying it through libsigrok a packet at a time.
+ *
+ * A session file is a zip archive holding a version file, a metadata
+ * file, and the samples of the capture. Version 1 files hold the logic
+ * samples in one entry. Version 2 files split them across numbered chunk
+ * entries, which are inflated in parallel. The samples of an analog
+ * probe, as saved by SessionFileWriter, are held in an entry of their
+ * own.
+ */
+class SessionFile
+{
+public:
+	/**
+	 * Receives the logic data of the file, in order, in whole
+	 * samples.
+	 */
+	typedef boost::function<void (const sr_datafeed_logic&)>
+		LogicHandler;
+
+	/**
+	 * Receives the analog data of the file, in order.
+	 */
+	typedef boost::function<void (const sr_datafeed_analog&)>
+		AnalogHandler;
+
+	/**
+	 * Receives the number of bytes of samples read so far, and the
+	 * number which will be read in all.
+	 */
+	typedef boost::function<void (uint64_t, uint64_t)> ProgressHandler;
+
+	/**
+	 * Returns true once reading should be abandoned.
+	 */
+	typedef boost::function<bool ()> CancelHandler;
+
+private:
+	struct ChunkQueue;
+
+	struct Entry
+	{
+		uint16_t method;
+		uint64_t compressed_size;
+		uint64_t size;
+		uint64_t offset;
+	};
+
+private:
+	static const size_t PieceSize;
+	static const size_t ReadSize;
+	static const unsigned int PiecesPerThread;
+
+public:
+	SessionFile();
+
+	/**
+	 * Reads the directory and metadata of a session file.
+	 * @return false if the file is not a session file this loader can
+	 * read. libsigrok may still be able to load it.
+	 */
+	bool open(const std::string &path);
+
+	uint64_t get_samplerate() const;
+
+	unsigned int get_unit_size() const;
+
+	/**
+	 * Gets the number of probes the device had, whether or not they
+	 * were captured.
+	 */
+	unsigned int get_total_probe_count() const;
+
+	/**
+	 * Gets the index and name of each probe which was captured, in
+	 * order of index.
+	 */
+	const std::vector< std::pair<int, std::string> >& get_probes() const;
+
+	/**
+	 * Gets the number of logic samples in the file.
+	 */
+	uint64_t get_sample_count() const;
+
+	/**
+	 * Returns true if the file holds the samples of an analog probe.
+	 */
+	bool has_analog() const;
+
+	/**
+	 * Gets the index and name of the analog probe.
+	 */
+	const std::pair<int, std::string>& get_analog_probe() const;
+
+	/**
+	 * Gets the number of analog samples in the file.
+	 */
+	uint64_t get_analog_sample_count() const;
+
+	/**
+	 * Inflates the data of the file and passes it on in order: the
+	 * logic data first, then the analog data. The chunks of version 2
+	 * files are inflated on several threads at once.
+	 * @param logic_handler Receives the logic data, if there is any.
+	 * @param analog_handler Receives the analog data, if there is any.
+	 * @param thread_count The number of threads to inflate on.
+	 * @param cancel_handler Is polled between the pieces of data
+	 *   inflated, and stops the read once it returns true.
+	 * @return false if the data could not be read, or the read was
+	 *   cancelled.
+	 */
+	bool read(LogicHandler logic_handler, AnalogHandler analog_handler,
+		ProgressHandler progress_handler, unsigned int thread_count,
+		CancelHandler cancel_handler = CancelHandler()) const;
+
+private:
+	bool read_directory(std::istream &f);
+
+	bool read_metadata(std::istream &f);
+
+	/**
+	 * Finds the entry of a name, or failing that, the chunk entries
+	 * numbered from 1 after it.
+	 * @param[out] chunks The entries found, in order. This is left
+	 *   empty if any of them cannot be read.
+	 */
+	void find_chunks(const std::string &name,
+		std::vector<Entry> &chunks) const;
+
+	/**
+	 * Inflates a list of chunks and passes their data on in order.
+	 * @param[in,out] done The number of bytes of samples read before
+	 *   these chunks, which is moved on as they are read.
+	 * @param total The number of bytes of samples in the file.
+	 */
+	bool read_chunks(const std::vector<Entry> &chunks,
+		boost::function<void (const uint8_t*, size_t)> sink,
+		ProgressHandler progress_handler, uint64_t &done,
+		uint64_t total, unsigned int thread_count,
+		CancelHandler cancel_handler) const;
+
+	/**
+	 * Inflates an entry, passing the data on in pieces of at most
+	 * PieceSize bytes.
+	 * @return false if the entry could not be inflated, or cancel_handler
+	 *   returned true before a piece.
+	 */
+	bool inflate_entry(std::istream &f, const Entry &entry,
+		boost::function<void (const uint8_t*, size_t)> sink,
+		CancelHandler cancel_handler = CancelHandler()) const;
+
+	/**
+	 * Inflates a whole entry into a buffer.
+	 */
+	bool read_entry(std::istream &f, const Entry &entry,
+		std::vector<uint8_t> &data,
+		CancelHandler cancel_handler = CancelHandler()) const;
+
+	/**
+	 * Inflates chunks on a worker thread, until all have been taken
+	 * or another thread has failed.
+	 */
+	void inflate_chunks_proc(ChunkQueue *queue) const;
+
+	static uint64_t get_data_size(const std::vector<Entry> &chunks);
+
+	static uint64_t parse_samplerate(const std::string &s);
+
+private:
+	std::string _path;
+	std::map<std::string, Entry> _entries;
+
+	uint64_t _samplerate;
+	unsigned int _unit_size;
+	unsigned int _total_probe_count;
+	std::vector< std::pair<int, std::string> > _probes;
+
+	/// The entries holding the logic samples, in order.
+	std::vector<Entry> _chunks;
+
+	std::pair<int, std::string> _analog_probe;
+
+	/// The entries holding the analog samples, in order.
+	std::vector<Entry> _analog_chunks;
+};
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_SESSIONFILE_H
@@ -0,0 +1,585 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "sessionfilewriter.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <zlib.h>
+
+#include "analogsnapshot.h"
+#include "logicsnapshot.h"
+
+using namespace boost;
+using namespace std;
+
+namespace pv {
+namespace data {
+
+const uint64_t SessionFileWriter::BlockSize = 4 << 20;	// bytes
+const unsigned int SessionFileWriter::BlocksPerThread = 2;
+
+// Entries this large are given zip64 sizes. Deflating may grow the data
+// a little, so this leaves room for the compressed size to pass the
+// 32-bit limit when the size does not.
+const uint64_t SessionFileWriter::Zip64Threshold = 0xF0000000;
+
+/**
+ * The blocks of an entry, as they are deflated by the worker threads and
+ * taken in order by the writing thread.
+ */
+struct SessionFileWriter::BlockQueue
+{
+	mutex queue_mutex;
+	condition_variable cond;
+
+	Source source;
+	unsigned int unit_size;
+	uint64_t start;
+	uint64_t end;
+	uint64_t block_length;
+
+	vector< vector<uint8_t> > data;
+	vector<uint32_t> crcs;
+	vector<bool> done;
+
+	/// The index of the next block to be deflated.
+	size_t next;
+
+	/// The number of blocks taken by the writing thread.
+	size_t taken;
+
+	/// The most blocks which may be deflated ahead of those taken.
+	size_t window;
+
+	bool failed;
+};
+
+static void put16(ostream &f, uint16_t x)
+{
+	const char b[] = {(char)x, (char)(x >> 8)};
+	f.write(b, sizeof(b));
+}
+
+static void put32(ostream &f, uint32_t x)
+{
+	put16(f, x);
+	put16(f, x >> 16);
+}
+
+static void put64(ostream &f, uint64_t x)
+{
+	put32(f, x);
+	put32(f, x >> 32);
+}
+
+/**
+ * Gets a value for a 32-bit field of a zip header, which is all ones if
+ * the value is given in the zip64 extra field instead.
+ */
+static inline uint32_t zip32(uint64_t x)
+{
+	return (x < 0xFFFFFFFF) ? (uint32_t)x : 0xFFFFFFFF;
+}
+
+SessionFileWriter::SessionFileWriter(uint64_t samplerate) :
+	_samplerate(samplerate),
+	_total_probe_count(0)
+{
+	// The entries are stamped with the time the file was saved
+	const posix_time::ptime now = posix_time::second_clock::local_time();
+	const gregorian::date d = now.date();
+	const posix_time::time_duration t = now.time_of_day();
+	_dos_time = (t.hours() << 11) | (t.minutes() << 5) |
+		(t.seconds() / 2);
+	_dos_date = ((d.year() - 1980) << 9) | (d.month() << 5) | d.day();
+}
+
+void SessionFileWriter::set_logic(shared_ptr<const LogicSnapshot> snapshot,
+	const vector< pair<int, string> > &probes)
+{
+	assert(snapshot);
+	assert(!probes.empty());
+
+	_logic_snapshot = snapshot;
+	_probes = probes;
+
+	// The file records the probes up to the last one captured
+	_total_probe_count = 0;
+	for (vector< pair<int, string> >::const_iterator i = probes.begin();
+		i != probes.end(); i++)
+		_total_probe_count = max(_total_probe_count,
+			(unsigned int)(*i).first + 1);
+	assert(_total_probe_count <=
+		(unsigned int)snapshot->get_unit_size() * 8);
+}
+
+void SessionFileWriter::set_analog(
+	shared_ptr<const AnalogSnapshot> snapshot, const string &name)
+{
+	assert(snapshot);
+
+	_analog_snapshot = snapshot;
+	_analog_name = name;
+}
+
+bool SessionFileWriter::write(const string &path,
+	ProgressHandler progress_handler, unsigned int thread_count)
+{
+	assert(thread_count != 0);
+
+	_entries.clear();
+
+	// The range of each snapshot is fixed before any of it is written
+	uint64_t logic_start = 0, logic_end = 0;
+	if (_logic_snapshot) {
+		logic_start = _logic_snapshot->get_start_sample();
+		logic_end = _logic_snapshot->get_sample_count();
+	}
+
+	uint64_t analog_start = 0, analog_end = 0;
+	if (_analog_snapshot) {
+		analog_start = _analog_snapshot->get_start_sample();
+		analog_end = _analog_snapshot->get_sample_count();
+	}
+
+	const unsigned int unit_size = _logic_snapshot ?
+		_logic_snapshot->get_unit_size() : 1;
+	const uint64_t total = (logic_end - logic_start) * unit_size +
+		(analog_end - analog_start) * sizeof(float);
+	uint64_t done = 0;
+
+	ofstream f(path.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!f)
+		return false;
+
+	write_stored_entry(f, "version", "1");
+	write_stored_entry(f, "metadata", make_metadata());
+
+	bool ok = true;
+
+	if (_logic_snapshot)
+		ok = write_samples(f, "logic-1",
+			bind(&SessionFileWriter::get_logic_samples,
+				_logic_snapshot, _1, _2, _3),
+			unit_size, logic_start, logic_end,
+			progress_handler, done, total, thread_count);
+
+	if (ok && _analog_snapshot) {
+		ostringstream name;
+		name << "analog-1-" << (_total_probe_count + 1);
+		ok = write_samples(f, name.str(),
+			bind(&SessionFileWriter::get_analog_samples,
+				_analog_snapshot, _1, _2, _3),
+			sizeof(float), analog_start, analog_end,
+			progress_handler, done, total, thread_count);
+	}
+
+	if (ok) {
+		write_directory(f);
+		f.close();
+		ok = !f.fail();
+	}
+
+	if (!ok) {
+		f.close();
+		remove(path.c_str());
+	}
+
+	return ok;
+}
+
+string SessionFileWriter::make_metadata() const
+{
+	// The keys are written in the order libsigrok expects them, with
+	// the capture file first
+	ostringstream s;
+	s << "[device 1]\n";
+
+	if (_logic_snapshot) {
+		s << "capturefile=logic-1\n"
+			"unitsize=" << _logic_snapshot->get_unit_size() << "\n"
+			"total probes=" << _total_probe_count << "\n";
+	}
+
+	s << "samplerate=" << format_samplerate(_samplerate) << "\n";
+
+	// Probes are numbered from 1 in the file
+	for (vector< pair<int, string> >::const_iterator i =
+		_probes.begin(); i != _probes.end(); i++)
+		s << "probe" << ((*i).first + 1) << "=" << (*i).second << "\n";
+
+	// The analog probe is numbered after the logic probes
+	if (_analog_snapshot) {
+		s << "total analog=1\n"
+			"analog" << (_total_probe_count + 1) << "=" <<
+			_analog_name << "\n";
+	}
+
+	return s.str();
+}
+
+void SessionFileWriter::write_stored_entry(ostream &f, const string &name,
+	const string &data)
+{
+	Entry entry;
+	entry.name = name;
+	entry.method = 0;
+	entry.crc = crc32(0, (const Bytef*)data.data(), data.size());
+	entry.compressed_size = entry.size = data.size();
+	entry.offset = f.tellp();
+
+	write_local_header(f, entry);
+	f.write(data.data(), data.size());
+
+	_entries.push_back(entry);
+}
+
+bool SessionFileWriter::write_samples(ostream &f, const string &name,
+	Source source, unsigned int unit_size, uint64_t start, uint64_t end,
+	ProgressHandler progress_handler, uint64_t &done, uint64_t total,
+	unsigned int thread_count)
+{
+	assert(source);
+	assert(unit_size != 0);
+	assert(start <= end);
+
+	Entry entry;
+	entry.name = name;
+	entry.method = Z_DEFLATED;
+	entry.crc = crc32(0, NULL, 0);
+	entry.compressed_size = 0;
+	entry.size = (end - start) * unit_size;
+	entry.offset = f.tellp();
+
+	// The header is written again once the sizes and checksum are known
+	write_local_header(f, entry);
+
+	// Deflate the blocks on the worker threads, a few ahead of those
+	// taken, and write them out in order on this thread. An empty
+	// entry still has one block, to end the stream.
+	BlockQueue queue;
+	queue.source = source;
+	queue.unit_size = unit_size;
+	queue.start = start;
+	queue.end = end;
+	queue.block_length = max(BlockSize / unit_size, (uint64_t)1);
+
+	const size_t block_count = max((uint64_t)1,
+		(end - start + queue.block_length - 1) / queue.block_length);
+	queue.data.resize(block_count);
+	queue.crcs.resize(block_count);
+	queue.done.resize(block_count, false);
+	queue.next = 0;
+	queue.taken = 0;
+	queue.window = thread_count * BlocksPerThread;
+	queue.failed = false;
+
+	thread_count = min(thread_count, (unsigned int)block_count);
+	boost::thread_group workers;
+	for (unsigned int i = 0; i < thread_count; i++)
+		workers.create_thread(bind(
+			&SessionFileWriter::deflate_blocks_proc, &queue));
+
+	for (size_t i = 0; i < block_count; i++) {
+		vector<uint8_t> data;
+		uint32_t crc;
+
+		{
+			unique_lock<mutex> lock(queue.queue_mutex);
+			while (!queue.done[i] && !queue.failed)
+				queue.cond.wait(lock);
+			if (queue.failed)
+				break;
+
+			queue.data[i].swap(data);
+			crc = queue.crcs[i];
+			queue.taken = i + 1;
+			queue.cond.notify_all();
+		}
+
+		if (!data.empty() &&
+			!f.write((const char*)&data[0], data.size())) {
+			lock_guard<mutex> lock(queue.queue_mutex);
+			queue.failed = true;
+			queue.cond.notify_all();
+			break;
+		}
+
+		const uint64_t block_start = start + i * queue.block_length;
+		const uint64_t length = (min(end, block_start +
+			queue.block_length) - block_start) * unit_size;
+		entry.crc = crc32_combine(entry.crc, crc, length);
+		entry.compressed_size += data.size();
+
+		done += length;
+		if (progress_handler)
+			progress_handler(done, total);
+	}
+
+	workers.join_all();
+	if (queue.failed)
+		return false;
+
+	const streampos entry_end = f.tellp();
+	f.seekp(entry.offset);
+	write_local_header(f, entry);
+	f.seekp(entry_end);
+
+	_entries.push_back(entry);
+	return !f.fail();
+}
+
+void SessionFileWriter::write_local_header(ostream &f, const Entry &entry)
+{
+	// The sizes of large entries are given in a zip64 extra field,
+	// which must hold both of them
+	const bool zip64 = entry.size >= Zip64Threshold;
+
+	put32(f, 0x04034b50);
+	put16(f, zip64 ? 45 : 20);
+	put16(f, 0);
+	put16(f, entry.method);
+	put16(f, _dos_time);
+	put16(f, _dos_date);
+	put32(f, entry.crc);
+	put32(f, zip64 ? 0xFFFFFFFF : entry.compressed_size);
+	put32(f, zip64 ? 0xFFFFFFFF : entry.size);
+	put16(f, entry.name.size());
+	put16(f, zip64 ? 20 : 0);
+	f.write(entry.name.data(), entry.name.size());
+
+	if (zip64) {
+		put16(f, 0x0001);
+		put16(f, 16);
+		put64(f, entry.size);
+		put64(f, entry.compressed_size);
+	}
+}
+
+void SessionFileWriter::write_directory(ostream &f)
+{
+	const uint64_t directory_offset = f.tellp();
+
+	for (vector<Entry>::const_iterator i = _entries.begin();
+		i != _entries.end(); i++) {
+		const Entry &e = *i;
+
+		// Values which do not fit are given in the zip64 extra
+		// field, in this order
+		vector<uint64_t> extra;
+		if (e.size >= 0xFFFFFFFF)
+			extra.push_back(e.size);
+		if (e.compressed_size >= 0xFFFFFFFF)
+			extra.push_back(e.compressed_size);
+		if (e.offset >= 0xFFFFFFFF)
+			extra.push_back(e.offset);
+
+		const uint16_t version = extra.empty() ? 20 : 45;
+
+		put32(f, 0x02014b50);
+		put16(f, (3 << 8) | version);	// Made on Unix
+		put16(f, version);
+		put16(f, 0);
+		put16(f, e.method);
+		put16(f, _dos_time);
+		put16(f, _dos_date);
+		put32(f, e.crc);
+		put32(f, zip32(e.compressed_size));
+		put32(f, zip32(e.size));
+		put16(f, e.name.size());
+		put16(f, extra.empty() ? 0 : 4 + extra.size() * 8);
+		put16(f, 0);
+		put16(f, 0);
+		put16(f, 0);
+		put32(f, 0100644 << 16);	// A regular file, rw-r--r--
+		put32(f, zip32(e.offset));
+		f.write(e.name.data(), e.name.size());
+
+		if (!extra.empty()) {
+			put16(f, 0x0001);
+			put16(f, extra.size() * 8);
+			for (vector<uint64_t>::const_iterator j = extra.begin();
+				j != extra.end(); j++)
+				put64(f, *j);
+		}
+	}
+
+	const uint64_t directory_end = f.tellp();
+	const uint64_t directory_size = directory_end - directory_offset;
+
+	// Archives too large for the end record have a zip64 record and
+	// locator before it
+	const bool zip64 = _entries.size() >= 0xFFFF ||
+		directory_size >= 0xFFFFFFFF ||
+		directory_offset >= 0xFFFFFFFF;
+	if (zip64) {
+		put32(f, 0x06064b50);
+		put64(f, 44);
+		put16(f, (3 << 8) | 45);
+		put16(f, 45);
+		put32(f, 0);
+		put32(f, 0);
+		put64(f, _entries.size());
+		put64(f, _entries.size());
+		put64(f, directory_size);
+		put64(f, directory_offset);
+
+		put32(f, 0x07064b50);
+		put32(f, 0);
+		put64(f, directory_end);
+		put32(f, 1);
+	}
+
+	const uint16_t entry_count = zip64 ? 0xFFFF : _entries.size();
+	put32(f, 0x06054b50);
+	put16(f, 0);
+	put16(f, 0);
+	put16(f, entry_count);
+	put16(f, entry_count);
+	put32(f, zip32(directory_size));
+	put32(f, zip32(directory_offset));
+	put16(f, 0);
+}
+
+void SessionFileWriter::deflate_blocks_proc(BlockQueue *queue)
+{
+	assert(queue);
+
+	const size_t block_count = queue->data.size();
+
+	unique_lock<mutex> lock(queue->queue_mutex);
+	while (true) {
+		while (!queue->failed && queue->next < block_count &&
+			queue->next >= queue->taken + queue->window)
+			queue->cond.wait(lock);
+		if (queue->failed || queue->next == block_count)
+			return;
+
+		const size_t i = queue->next++;
+		lock.unlock();
+
+		const uint64_t start = queue->start + i * queue->block_length;
+		const uint64_t end = min(queue->end,
+			start + queue->block_length);
+		const size_t length = (size_t)(end - start) * queue->unit_size;
+
+		vector<uint8_t> samples(max(length, (size_t)1));
+		if (length != 0)
+			queue->source(&samples[0], start, end);
+		const uint32_t crc = crc32(0, &samples[0], length);
+
+		// Each block is deflated on its own. All but the last end
+		// with a sync flush, which pads the block out to a byte
+		// boundary without ending the stream.
+		const bool last = (i + 1 == block_count);
+		vector<uint8_t> data;
+		bool ok = false;
+
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			-MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+			// The bound leaves room for a finished stream, and
+			// the sync marker is no longer than that
+			data.resize(deflateBound(&z, length) + 8);
+			z.next_in = &samples[0];
+			z.avail_in = length;
+			z.next_out = &data[0];
+			z.avail_out = data.size();
+
+			const int ret = deflate(&z, last ? Z_FINISH :
+				Z_SYNC_FLUSH);
+			ok = last ? (ret == Z_STREAM_END) :
+				(ret == Z_OK && z.avail_in == 0 &&
+				z.avail_out != 0);
+			data.resize(z.total_out);
+			deflateEnd(&z);
+		}
+
+		lock.lock();
+		if (!ok) {
+			queue->failed = true;
+			queue->cond.notify_all();
+			return;
+		}
+
+		queue->data[i].swap(data);
+		queue->crcs[i] = crc;
+		queue->done[i] = true;
+		queue->cond.notify_all();
+	}
+}
+
+void SessionFileWriter::get_logic_samples(
+	shared_ptr<const LogicSnapshot> snapshot, uint8_t *dest,
+	uint64_t start, uint64_t end)
+{
+	assert(snapshot);
+	const Snapshot::Pin pin(*snapshot);
+	snapshot->get_samples(pin, dest, start, end);
+}
+
+void SessionFileWriter::get_analog_samples(
+	shared_ptr<const AnalogSnapshot> snapshot, uint8_t *dest,
+	uint64_t start, uint64_t end)
+{
+	assert(snapshot);
+	const Snapshot::Pin pin(*snapshot);
+
+	// The samples are copied a chunk at a time
+	while (start < end) {
+		uint64_t length = 0;
+		const float *const samples = snapshot->get_samples(pin,
+			start, end, length);
+		assert(length != 0);
+		memcpy(dest, samples, length * sizeof(float));
+		dest += length * sizeof(float);
+		start += length;
+	}
+}
+
+string SessionFileWriter::format_samplerate(uint64_t samplerate)
+{
+	// libsigrok writes rates as a whole number of Hz, kHz, MHz or GHz
+	ostringstream s;
+	if (samplerate != 0 && samplerate % 1000000000 == 0)
+		s << (samplerate / 1000000000) << " GHz";
+	else if (samplerate != 0 && samplerate % 1000000 == 0)
+		s << (samplerate / 1000000) << " MHz";
+	else if (samplerate != 0 && samplerate % 1000 == 0)
+		s << (samplerate / 1000) << " kHz";
+	else
+		s << samplerate << " Hz";
+	return s.str();
+}
+
+} // namespace data
+} // namespace pv
@@ -0,0 +1,173 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_SESSIONFILEWRITER_H
+#define PULSEVIEW_PV_DATA_SESSIONFILEWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace pv {
+namespace data {
+
+class AnalogSnapshot;
+class LogicSnapshot;
+
+/**
+ * Writes snapshots to a sigrok session file.
+ *
+ * The samples are written as version 1 files hold them, so that
+ * libsigrok can load the file too: the logic samples in one deflated
+ * entry, and the samples of the analog probe in another. Each entry is
+ * split into blocks which are read out of the snapshot and deflated on
+ * several threads at once, then written out in order. Every block but
+ * the last ends on a byte boundary, so the blocks join into a single
+ * deflate stream. Only a few blocks are held in memory at a time.
+ */
+class SessionFileWriter
+{
+public:
+	/**
+	 * Receives the number of bytes of samples written so far, and the
+	 * number which will be written in all.
+	 */
+	typedef boost::function<void (uint64_t, uint64_t)> ProgressHandler;
+
+private:
+	struct BlockQueue;
+
+	/**
+	 * Copies a range of samples out of a snapshot.
+	 */
+	typedef boost::function<void (uint8_t*, uint64_t, uint64_t)> Source;
+
+	struct Entry
+	{
+		std::string name;
+		uint16_t method;
+		uint32_t crc;
+		uint64_t compressed_size;
+		uint64_t size;
+		uint64_t offset;
+	};
+
+private:
+	static const uint64_t BlockSize;
+	static const unsigned int BlocksPerThread;
+	static const uint64_t Zip64Threshold;
+
+public:
+	SessionFileWriter(uint64_t samplerate);
+
+	/**
+	 * Sets the logic snapshot to write.
+	 * @param probes The index and name of each probe which was
+	 *   captured.
+	 */
+	void set_logic(boost::shared_ptr<const LogicSnapshot> snapshot,
+		const std::vector< std::pair<int, std::string> > &probes);
+
+	/**
+	 * Sets the analog snapshot to write.
+	 * @param name The name of the analog probe.
+	 */
+	void set_analog(boost::shared_ptr<const AnalogSnapshot> snapshot,
+		const std::string &name);
+
+	/**
+	 * Writes the snapshots to a file. The snapshots must not be
+	 * appended to while they are written.
+	 * @param thread_count The number of threads to deflate on.
+	 * @return false if the file could not be written. The partly
+	 *   written file is removed.
+	 */
+	bool write(const std::string &path, ProgressHandler progress_handler,
+		unsigned int thread_count);
+
+private:
+	std::string make_metadata() const;
+
+	/**
+	 * Writes an entry which is held in memory, without compressing it.
+	 */
+	void write_stored_entry(std::ostream &f, const std::string &name,
+		const std::string &data);
+
+	/**
+	 * Deflates the samples of a snapshot into an entry.
+	 * @param[in,out] done The number of bytes of samples written
+	 *   before this entry, which is moved on as the blocks are
+	 *   written.
+	 * @param total The number of bytes of samples in the file.
+	 */
+	bool write_samples(std::ostream &f, const std::string &name,
+		Source source, unsigned int unit_size, uint64_t start,
+		uint64_t end, ProgressHandler progress_handler, uint64_t &done,
+		uint64_t total, unsigned int thread_count);
+
+	void write_local_header(std::ostream &f, const Entry &entry);
+
+	void write_directory(std::ostream &f);
+
+	/**
+	 * Deflates blocks on a worker thread, until all have been taken
+	 * or another thread has failed.
+	 */
+	static void deflate_blocks_proc(BlockQueue *queue);
+
+	static void get_logic_samples(
+		boost::shared_ptr<const LogicSnapshot> snapshot, uint8_t *dest,
+		uint64_t start, uint64_t end);
+
+	static void get_analog_samples(
+		boost::shared_ptr<const AnalogSnapshot> snapshot, uint8_t *dest,
+		uint64_t start, uint64_t end);
+
+	static std::string format_samplerate(uint64_t samplerate);
+
+private:
+	const uint64_t _samplerate;
+
+	boost::shared_ptr<const LogicSnapshot> _logic_snapshot;
+	std::vector< std::pair<int, std::string> > _probes;
+	unsigned int _total_probe_count;
+
+	boost::shared_ptr<const AnalogSnapshot> _analog_snapshot;
+	std::string _analog_name;
+
+	/// The entries written so far, in order.
+	std::vector<Entry> _entries;
+
+	uint16_t _dos_time;
+	uint16_t _dos_date;
+};
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_SESSIONFILEWRITER_H
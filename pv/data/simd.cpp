@@ -0,0 +1,538 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "simd.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+namespace pv {
+namespace data {
+
+#ifdef HAVE_X86_SIMD
+
+namespace {
+
+/**
+ * ORs together the samples in a vector, leaving the result in the
+ * lowest sample.
+ */
+template <int UnitSize>
+TARGET_SSE2 inline __m128i fold_sse2(__m128i v)
+{
+	v = _mm_or_si128(v, _mm_srli_si128(v, 8));
+	if (UnitSize <= 4)
+		v = _mm_or_si128(v, _mm_srli_si128(v, 4));
+	if (UnitSize <= 2)
+		v = _mm_or_si128(v, _mm_srli_si128(v, 2));
+	if (UnitSize <= 1)
+		v = _mm_or_si128(v, _mm_srli_si128(v, 1));
+	return v;
+}
+
+/**
+ * Places a sample in the highest position of a vector.
+ */
+template <int UnitSize>
+TARGET_SSE2 inline __m128i load_last_sse2(const uint64_t &sample)
+{
+	return _mm_slli_si128(_mm_loadl_epi64((const __m128i*)&sample),
+		16 - UnitSize);
+}
+
+/**
+ * Reads back the sample in the highest position of a vector.
+ */
+template <int UnitSize>
+TARGET_SSE2 inline void store_last_sse2(uint64_t &sample, __m128i v)
+{
+	_mm_storel_epi64((__m128i*)&sample, _mm_srli_si128(v, 16 - UnitSize));
+}
+
+template <int UnitSize>
+TARGET_SSE2 inline void store_unit_sse2(uint8_t *dest, __m128i v)
+{
+	if (UnitSize == 8)
+		_mm_storel_epi64((__m128i*)dest, v);
+	else {
+		const uint32_t sample = _mm_cvtsi128_si32(v);
+		memcpy(dest, &sample, UnitSize);
+	}
+}
+
+template <int UnitSize>
+TARGET_SSE2 void logic_transitions_sse2(uint8_t *dest, const uint8_t *src,
+	uint64_t blocks, int, uint64_t &last_sample)
+{
+	// A block of 16 samples spans UnitSize vectors. Each vector is
+	// XORed with itself shifted up by one sample, with the last sample
+	// of the previous vector shifted in.
+	__m128i prev = load_last_sse2<UnitSize>(last_sample);
+
+	for (; blocks > 0; blocks--) {
+		__m128i accumulator = _mm_setzero_si128();
+		for (int i = 0; i < UnitSize; i++) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)src);
+			const __m128i shifted = _mm_or_si128(
+				_mm_slli_si128(v, UnitSize),
+				_mm_srli_si128(prev, 16 - UnitSize));
+			accumulator = _mm_or_si128(accumulator,
+				_mm_xor_si128(v, shifted));
+			prev = v;
+			src += 16;
+		}
+
+		store_unit_sse2<UnitSize>(dest,
+			fold_sse2<UnitSize>(accumulator));
+		dest += UnitSize;
+	}
+
+	store_last_sse2<UnitSize>(last_sample, prev);
+}
+
+template <int UnitSize>
+TARGET_SSE2 void logic_reduction_sse2(uint8_t *dest, const uint8_t *src,
+	uint64_t blocks, int)
+{
+	for (; blocks > 0; blocks--) {
+		__m128i accumulator = _mm_setzero_si128();
+		for (int i = 0; i < UnitSize; i++) {
+			accumulator = _mm_or_si128(accumulator,
+				_mm_loadu_si128((const __m128i*)src));
+			src += 16;
+		}
+
+		store_unit_sse2<UnitSize>(dest,
+			fold_sse2<UnitSize>(accumulator));
+		dest += UnitSize;
+	}
+}
+
+/**
+ * Stores the OR of the samples in each block held in an accumulator.
+ * With 1-byte samples each 128-bit lane holds a block of its own, with
+ * wider samples the two lanes hold parts of the same block.
+ */
+template <int UnitSize>
+TARGET_AVX2 inline void store_blocks_avx2(uint8_t *dest, __m256i v)
+{
+	const __m128i lo = _mm256_castsi256_si128(v);
+	const __m128i hi = _mm256_extracti128_si256(v, 1);
+
+	if (UnitSize == 1) {
+		store_unit_sse2<1>(dest, fold_sse2<1>(lo));
+		store_unit_sse2<1>(dest + 1, fold_sse2<1>(hi));
+	} else
+		store_unit_sse2<UnitSize>(dest,
+			fold_sse2<UnitSize>(_mm_or_si128(lo, hi)));
+}
+
+template <int UnitSize>
+TARGET_AVX2 void logic_transitions_avx2(uint8_t *dest, const uint8_t *src,
+	uint64_t blocks, int unit_size, uint64_t &last_sample)
+{
+	const uint64_t BlocksPerStep = (UnitSize == 1) ? 2 : 1;
+	const int VectorsPerStep = (UnitSize == 1) ? 1 : UnitSize / 2;
+
+	__m256i prev = _mm256_inserti128_si256(_mm256_setzero_si256(),
+		load_last_sse2<UnitSize>(last_sample), 1);
+
+	for (; blocks >= BlocksPerStep; blocks -= BlocksPerStep) {
+		__m256i accumulator = _mm256_setzero_si256();
+		for (int i = 0; i < VectorsPerStep; i++) {
+			const __m256i v = _mm256_loadu_si256(
+				(const __m256i*)src);
+
+			// Shift the vector up by one sample across the
+			// lanes, with the top of the previous vector
+			// shifted in at the bottom
+			const __m256i carry =
+				_mm256_permute2x128_si256(v, prev, 0x03);
+			const __m256i shifted = _mm256_alignr_epi8(
+				v, carry, 16 - UnitSize);
+
+			accumulator = _mm256_or_si256(accumulator,
+				_mm256_xor_si256(v, shifted));
+			prev = v;
+			src += 32;
+		}
+
+		store_blocks_avx2<UnitSize>(dest, accumulator);
+		dest += BlocksPerStep * UnitSize;
+	}
+
+	store_last_sse2<UnitSize>(last_sample,
+		_mm256_extracti128_si256(prev, 1));
+
+	// Finish off an odd block of 1-byte samples
+	if (blocks > 0)
+		logic_transitions_sse2<UnitSize>(dest, src, blocks,
+			unit_size, last_sample);
+}
+
+template <int UnitSize>
+TARGET_AVX2 void logic_reduction_avx2(uint8_t *dest, const uint8_t *src,
+	uint64_t blocks, int unit_size)
+{
+	const uint64_t BlocksPerStep = (UnitSize == 1) ? 2 : 1;
+	const int VectorsPerStep = (UnitSize == 1) ? 1 : UnitSize / 2;
+
+	for (; blocks >= BlocksPerStep; blocks -= BlocksPerStep) {
+		__m256i accumulator = _mm256_setzero_si256();
+		for (int i = 0; i < VectorsPerStep; i++) {
+			accumulator = _mm256_or_si256(accumulator,
+				_mm256_loadu_si256((const __m256i*)src));
+			src += 32;
+		}
+
+		store_blocks_avx2<UnitSize>(dest, accumulator);
+		dest += BlocksPerStep * UnitSize;
+	}
+
+	if (blocks > 0)
+		logic_reduction_sse2<UnitSize>(dest, src, blocks, unit_size);
+}
+
+/**
+ * Finds the envelope of the remaining blocks in the same order as the
+ * scalar code in AnalogSnapshot, so that NaNs and signed zeros come out
+ * the same.
+ */
+inline void analog_envelope_scalar(float *dest, const float *src,
+	uint64_t blocks, int stride, int step)
+{
+	for (; blocks > 0; blocks--) {
+		float min_value = src[0], max_value = src[step - 1];
+		for (int i = step; i < stride; i += step) {
+			if (src[i] < min_value)
+				min_value = src[i];
+			if (max_value < src[i + step - 1])
+				max_value = src[i + step - 1];
+		}
+
+		*dest++ = min_value;
+		*dest++ = max_value;
+		src += stride;
+	}
+}
+
+TARGET_SSE2 inline void transpose_sse2(__m128 &r0, __m128 &r1,
+	__m128 &r2, __m128 &r3)
+{
+	const __m128 t0 = _mm_unpacklo_ps(r0, r1);
+	const __m128 t1 = _mm_unpacklo_ps(r2, r3);
+	const __m128 t2 = _mm_unpackhi_ps(r0, r1);
+	const __m128 t3 = _mm_unpackhi_ps(r2, r3);
+	r0 = _mm_shuffle_ps(t0, t1, 0x44);
+	r1 = _mm_shuffle_ps(t0, t1, 0xEE);
+	r2 = _mm_shuffle_ps(t2, t3, 0x44);
+	r3 = _mm_shuffle_ps(t2, t3, 0xEE);
+}
+
+TARGET_AVX2 inline void transpose_avx2(__m256 &r0, __m256 &r1,
+	__m256 &r2, __m256 &r3)
+{
+	const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	const __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+	const __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+	const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	r0 = _mm256_shuffle_ps(t0, t1, 0x44);
+	r1 = _mm256_shuffle_ps(t0, t1, 0xEE);
+	r2 = _mm256_shuffle_ps(t2, t3, 0x44);
+	r3 = _mm256_shuffle_ps(t2, t3, 0xEE);
+}
+
+/**
+ * Loads a row of 4 values from each of two blocks, one per lane.
+ */
+TARGET_AVX2 inline __m256 load_rows_avx2(const float *lo, const float *hi)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(
+		_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+// The kernels work on several blocks at once, with each block in its
+// own vector element. This lets the values of a block be visited in
+// order, and _mm_min_ps(x, m) and _mm_max_ps(x, m) pick m unless x is
+// strictly beyond it, exactly as the scalar code does.
+
+TARGET_SSE2 void analog_envelope_sse2(float *dest, const float *src,
+	uint64_t blocks)
+{
+	for (; blocks >= 4; blocks -= 4) {
+		__m128 min_values = _mm_setzero_ps();
+		__m128 max_values = _mm_setzero_ps();
+
+		for (int i = 0; i < 16; i += 4) {
+			__m128 r[4];
+			for (int b = 0; b < 4; b++)
+				r[b] = _mm_loadu_ps(src + b * 16 + i);
+			transpose_sse2(r[0], r[1], r[2], r[3]);
+
+			for (int j = 0; j < 4; j++) {
+				if (i == 0 && j == 0) {
+					min_values = max_values = r[0];
+					continue;
+				}
+
+				min_values = _mm_min_ps(r[j], min_values);
+				max_values = _mm_max_ps(r[j], max_values);
+			}
+		}
+
+		_mm_storeu_ps(dest, _mm_unpacklo_ps(min_values, max_values));
+		_mm_storeu_ps(dest + 4,
+			_mm_unpackhi_ps(min_values, max_values));
+		dest += 8;
+		src += 64;
+	}
+
+	analog_envelope_scalar(dest, src, blocks, 16, 1);
+}
+
+TARGET_SSE2 void analog_reduction_sse2(float *dest, const float *src,
+	uint64_t blocks)
+{
+	for (; blocks >= 4; blocks -= 4) {
+		__m128 min_values = _mm_setzero_ps();
+		__m128 max_values = _mm_setzero_ps();
+
+		// Each row holds two (min, max) pairs
+		for (int i = 0; i < 32; i += 4) {
+			__m128 r[4];
+			for (int b = 0; b < 4; b++)
+				r[b] = _mm_loadu_ps(src + b * 32 + i);
+			transpose_sse2(r[0], r[1], r[2], r[3]);
+
+			if (i == 0) {
+				min_values = r[0];
+				max_values = r[1];
+			} else {
+				min_values = _mm_min_ps(r[0], min_values);
+				max_values = _mm_max_ps(r[1], max_values);
+			}
+
+			min_values = _mm_min_ps(r[2], min_values);
+			max_values = _mm_max_ps(r[3], max_values);
+		}
+
+		_mm_storeu_ps(dest, _mm_unpacklo_ps(min_values, max_values));
+		_mm_storeu_ps(dest + 4,
+			_mm_unpackhi_ps(min_values, max_values));
+		dest += 8;
+		src += 128;
+	}
+
+	analog_envelope_scalar(dest, src, blocks, 32, 2);
+}
+
+TARGET_AVX2 inline void store_envelope_avx2(float *dest,
+	__m256 min_values, __m256 max_values)
+{
+	const __m256 lo = _mm256_unpacklo_ps(min_values, max_values);
+	const __m256 hi = _mm256_unpackhi_ps(min_values, max_values);
+	_mm256_storeu_ps(dest, _mm256_permute2f128_ps(lo, hi, 0x20));
+	_mm256_storeu_ps(dest + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+TARGET_AVX2 void analog_envelope_avx2(float *dest, const float *src,
+	uint64_t blocks)
+{
+	for (; blocks >= 8; blocks -= 8) {
+		__m256 min_values = _mm256_setzero_ps();
+		__m256 max_values = _mm256_setzero_ps();
+
+		for (int i = 0; i < 16; i += 4) {
+			__m256 r[4];
+			for (int b = 0; b < 4; b++)
+				r[b] = load_rows_avx2(src + b * 16 + i,
+					src + (b + 4) * 16 + i);
+			transpose_avx2(r[0], r[1], r[2], r[3]);
+
+			for (int j = 0; j < 4; j++) {
+				if (i == 0 && j == 0) {
+					min_values = max_values = r[0];
+					continue;
+				}
+
+				min_values = _mm256_min_ps(r[j], min_values);
+				max_values = _mm256_max_ps(r[j], max_values);
+			}
+		}
+
+		store_envelope_avx2(dest, min_values, max_values);
+		dest += 16;
+		src += 128;
+	}
+
+	analog_envelope_sse2(dest, src, blocks);
+}
+
+TARGET_AVX2 void analog_reduction_avx2(float *dest, const float *src,
+	uint64_t blocks)
+{
+	for (; blocks >= 8; blocks -= 8) {
+		__m256 min_values = _mm256_setzero_ps();
+		__m256 max_values = _mm256_setzero_ps();
+
+		for (int i = 0; i < 32; i += 4) {
+			__m256 r[4];
+			for (int b = 0; b < 4; b++)
+				r[b] = load_rows_avx2(src + b * 32 + i,
+					src + (b + 4) * 32 + i);
+			transpose_avx2(r[0], r[1], r[2], r[3]);
+
+			if (i == 0) {
+				min_values = r[0];
+				max_values = r[1];
+			} else {
+				min_values = _mm256_min_ps(r[0], min_values);
+				max_values = _mm256_max_ps(r[1], max_values);
+			}
+
+			min_values = _mm256_min_ps(r[2], min_values);
+			max_values = _mm256_max_ps(r[3], max_values);
+		}
+
+		store_envelope_avx2(dest, min_values, max_values);
+		dest += 16;
+		src += 256;
+	}
+
+	analog_reduction_sse2(dest, src, blocks);
+}
+
+} // namespace
+
+#endif // HAVE_X86_SIMD
+
+Simd::Level Simd::_max_level = Simd::AVX2;
+
+Simd::Level Simd::get_level()
+{
+	static const Level detected_level = detect_level();
+	return min(detected_level, _max_level);
+}
+
+void Simd::set_max_level(Level level)
+{
+	_max_level = level;
+}
+
+Simd::LogicTransitionKernel Simd::get_logic_transition_kernel(
+	int unit_size)
+{
+#ifdef HAVE_X86_SIMD
+	const Level level = get_level();
+	if (level == AVX2) {
+		switch (unit_size) {
+		case 1: return logic_transitions_avx2<1>;
+		case 2: return logic_transitions_avx2<2>;
+		case 4: return logic_transitions_avx2<4>;
+		case 8: return logic_transitions_avx2<8>;
+		}
+	} else if (level == SSE2) {
+		switch (unit_size) {
+		case 1: return logic_transitions_sse2<1>;
+		case 2: return logic_transitions_sse2<2>;
+		case 4: return logic_transitions_sse2<4>;
+		case 8: return logic_transitions_sse2<8>;
+		}
+	}
+#else
+	(void)unit_size;
+#endif
+	return NULL;
+}
+
+Simd::LogicReductionKernel Simd::get_logic_reduction_kernel(int unit_size)
+{
+#ifdef HAVE_X86_SIMD
+	const Level level = get_level();
+	if (level == AVX2) {
+		switch (unit_size) {
+		case 1: return logic_reduction_avx2<1>;
+		case 2: return logic_reduction_avx2<2>;
+		case 4: return logic_reduction_avx2<4>;
+		case 8: return logic_reduction_avx2<8>;
+		}
+	} else if (level == SSE2) {
+		switch (unit_size) {
+		case 1: return logic_reduction_sse2<1>;
+		case 2: return logic_reduction_sse2<2>;
+		case 4: return logic_reduction_sse2<4>;
+		case 8: return logic_reduction_sse2<8>;
+		}
+	}
+#else
+	(void)unit_size;
+#endif
+	return NULL;
+}
+
+Simd::AnalogEnvelopeKernel Simd::get_analog_envelope_kernel()
+{
+#ifdef HAVE_X86_SIMD
+	switch (get_level()) {
+	case AVX2: return analog_envelope_avx2;
+	case SSE2: return analog_envelope_sse2;
+	case None: break;
+	}
+#endif
+	return NULL;
+}
+
+Simd::AnalogReductionKernel Simd::get_analog_reduction_kernel()
+{
+#ifdef HAVE_X86_SIMD
+	switch (get_level()) {
+	case AVX2: return analog_reduction_avx2;
+	case SSE2: return analog_reduction_sse2;
+	case None: break;
+	}
+#endif
+	return NULL;
+}
+
+Simd::Level Simd::detect_level()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SSE2;
+#endif
+	return None;
+}
+
+} // namespace data
+} // namespace pv
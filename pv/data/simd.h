@@ -0,0 +1,143 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_SIMD_H
+#define PULSEVIEW_PV_DATA_SIMD_H
+
+#include <stdint.h>
+
+namespace pv {
+namespace data {
+
+/**
+ * Vectorized kernels for building snapshot mip-maps, selected at run
+ * time according to the instruction sets the CPU supports.
+ *
+ * Every kernel has a scalar counterpart in the snapshot class which uses
+ * it. The scalar code is the reference the kernels must match exactly,
+ * and it is used whenever no kernel is returned.
+ */
+class Simd
+{
+public:
+	enum Level
+	{
+		None,
+		SSE2,
+		AVX2
+	};
+
+	/**
+	 * Accumulates the transitions in blocks of 16 logic samples.
+	 * @param dest The buffer to write one OR-of-transitions sample
+	 *   per block into.
+	 * @param src The samples.
+	 * @param blocks The number of blocks of 16 samples in src.
+	 * @param unit_size The size of a sample in bytes.
+	 * @param[in,out] last_sample The sample before the first one in
+	 *   src. On return it holds the last sample of src.
+	 */
+	typedef void (*LogicTransitionKernel)(uint8_t *dest,
+		const uint8_t *src, uint64_t blocks, int unit_size,
+		uint64_t &last_sample);
+
+	/**
+	 * ORs together blocks of 16 logic mip-map samples.
+	 * @param dest The buffer to write one sample per block into.
+	 * @param src The samples of the lower mip-map level.
+	 * @param blocks The number of blocks of 16 samples in src.
+	 * @param unit_size The size of a sample in bytes.
+	 */
+	typedef void (*LogicReductionKernel)(uint8_t *dest,
+		const uint8_t *src, uint64_t blocks, int unit_size);
+
+	/**
+	 * Finds the minimum and maximum of blocks of 16 analog samples.
+	 * @param dest The buffer to write a (min, max) pair per block into.
+	 * @param src The samples.
+	 * @param blocks The number of blocks of 16 samples in src.
+	 */
+	typedef void (*AnalogEnvelopeKernel)(float *dest, const float *src,
+		uint64_t blocks);
+
+	/**
+	 * Reduces blocks of 16 (min, max) pairs of an analog envelope level.
+	 * @param dest The buffer to write a (min, max) pair per block into.
+	 * @param src The pairs of the lower envelope level.
+	 * @param blocks The number of blocks of 16 pairs in src.
+	 */
+	typedef void (*AnalogReductionKernel)(float *dest, const float *src,
+		uint64_t blocks);
+
+public:
+	/**
+	 * Gets the best instruction set which is supported by the CPU,
+	 * and is not above the maximum level.
+	 */
+	static Level get_level();
+
+	/**
+	 * Limits the instruction set the kernels may use. This allows the
+	 * kernels to be compared against each other, and against the
+	 * scalar code.
+	 */
+	static void set_max_level(Level level);
+
+	/**
+	 * Gets the transition kernel for a unit size.
+	 * @return Returns the kernel, or NULL if the scalar code should be
+	 *   used.
+	 */
+	static LogicTransitionKernel get_logic_transition_kernel(
+		int unit_size);
+
+	/**
+	 * Gets the mip-map reduction kernel for a unit size.
+	 * @return Returns the kernel, or NULL if the scalar code should be
+	 *   used.
+	 */
+	static LogicReductionKernel get_logic_reduction_kernel(
+		int unit_size);
+
+	/**
+	 * Gets the analog envelope kernel.
+	 * @return Returns the kernel, or NULL if the scalar code should be
+	 *   used.
+	 */
+	static AnalogEnvelopeKernel get_analog_envelope_kernel();
+
+	/**
+	 * Gets the analog envelope reduction kernel.
+	 * @return Returns the kernel, or NULL if the scalar code should be
+	 *   used.
+	 */
+	static AnalogReductionKernel get_analog_reduction_kernel();
+
+private:
+	static Level detect_level();
+
+private:
+	static Level _max_level;
+};
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_SIMD_H
@@ -21,43 +21,366 @@
 #include "snapshot.h"
 
 #include <assert.h>
-#include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <new>
+
+#include <boost/foreach.hpp>
+
 using namespace boost;
+using namespace std;
 
 namespace pv {
 namespace data {
 
-Snapshot::Snapshot(int unit_size) :
-	_data(NULL),
+const int Snapshot::ChunkSizePower = 20;
+const uint64_t Snapshot::ChunkSize = 1ULL << ChunkSizePower;	// samples
+const uint64_t Snapshot::MaxDeferredSize = 16 << 20;	// bytes
+
+Snapshot::Pin::Pin(const Snapshot &snapshot) :
+	_snapshot(&snapshot),
+	_lock(snapshot._mutex)
+{
+}
+
+Snapshot::Snapshot(int unit_size, uint64_t ring_length) :
 	_sample_count(0),
-	_unit_size(unit_size)
+	_unit_size(unit_size),
+	_ring_chunk_count((ring_length == 0) ? 0 :
+		(ring_length + ChunkSize - 1) / ChunkSize + 1),
+	_ring_index_span(ChunkSize),
+	_first_chunk(0),
+	_discarded_sample((unit_size + 7) / 8, 0),
+	_indexed_sample_count(0),
+	_indexing_deferred(false),
+	_stop_indexing(false)
 {
-	lock_guard<recursive_mutex> lock(_mutex);
+	lock_guard<shared_mutex> lock(_mutex);
 	assert(_unit_size > 0);
+
+	// The ring keeps one chunk more than asked for, because the chunk
+	// being filled is not whole
+	while (_ring_index_span < 2 * _ring_chunk_count * ChunkSize)
+		_ring_index_span <<= 1;
 }
 
 Snapshot::~Snapshot()
 {
-	lock_guard<recursive_mutex> lock(_mutex);
-	free(_data);
+	stop_indexing_thread();
+
+	lock_guard<shared_mutex> lock(_mutex);
+	BOOST_FOREACH(uint8_t *chunk, _data_chunks)
+		_storage.release(chunk, ChunkSize * _unit_size +
+			sizeof(uint64_t));
+}
+
+int Snapshot::get_unit_size() const
+{
+	return _unit_size;
 }
 
 uint64_t Snapshot::get_sample_count() const
 {
-	lock_guard<recursive_mutex> lock(_mutex);
+	shared_lock<shared_mutex> lock(_mutex);
 	return _sample_count;
 }
 
-void Snapshot::append_data(void *data, uint64_t samples)
+uint64_t Snapshot::get_start_sample() const
+{
+	shared_lock<shared_mutex> lock(_mutex);
+	return _first_chunk << ChunkSizePower;
+}
+
+uint64_t Snapshot::get_start_sample(const Pin &pin) const
+{
+	assert_pinned(pin);
+	return _first_chunk << ChunkSizePower;
+}
+
+uint64_t Snapshot::get_memory_usage() const
+{
+	shared_lock<shared_mutex> lock(_mutex);
+	return _storage.get_usage();
+}
+
+bool Snapshot::reserve(uint64_t sample_count)
+{
+	lock_guard<shared_mutex> lock(_mutex);
+	return reserve_samples(sample_count);
+}
+
+void Snapshot::flush()
+{
+	lock_guard<shared_mutex> lock(_mutex);
+	if (!_deferred.empty()) {
+		append_samples(&_deferred[0], _deferred.size() / _unit_size);
+		vector<uint8_t>().swap(_deferred);
+	}
+
+	if (_indexing_deferred) {
+		_indexing_deferred = false;
+		build_index();
+		_indexed_sample_count = _sample_count;
+	} else
+		index_samples(_sample_count);
+}
+
+void Snapshot::start_indexing_thread()
+{
+	assert(!_indexing_deferred);
+	if (!_indexing_thread.get())
+		_indexing_thread.reset(new boost::thread(
+			&Snapshot::indexing_thread_proc, this));
+}
+
+void Snapshot::defer_indexing()
+{
+	lock_guard<shared_mutex> lock(_mutex);
+	assert(!_indexing_thread.get());
+	_indexing_deferred = true;
+}
+
+uint64_t Snapshot::get_indexed_sample_count() const
+{
+	shared_lock<shared_mutex> lock(_mutex);
+	return _indexed_sample_count;
+}
+
+void Snapshot::stop_indexing_thread()
+{
+	if (!_indexing_thread.get())
+		return;
+
+	{
+		lock_guard<shared_mutex> lock(_mutex);
+		_stop_indexing = true;
+		_indexing_cond.notify_one();
+	}
+
+	_indexing_thread->join();
+	_indexing_thread.reset();
+}
+
+void Snapshot::append_or_defer(const void *data, uint64_t samples)
+{
+	const uint64_t length = samples * _unit_size;
+
+	unique_lock<shared_mutex> lock(_mutex, try_to_lock);
+	if (!lock.owns_lock()) {
+		// Hold the samples back rather than wait for the readers,
+		// unless too many have built up already
+		if (_deferred.size() + length <= MaxDeferredSize) {
+			const uint8_t *const src = (const uint8_t*)data;
+			_deferred.insert(_deferred.end(), src, src + length);
+			return;
+		}
+
+		lock.lock();
+	}
+
+	if (!_deferred.empty()) {
+		append_samples(&_deferred[0], _deferred.size() / _unit_size);
+		_deferred.clear();
+	}
+
+	append_samples(data, samples);
+
+	if (_indexing_thread.get())
+		_indexing_cond.notify_one();
+	else if (!_indexing_deferred)
+		index_samples(_sample_count);
+}
+
+void Snapshot::build_index()
+{
+	update_index(_sample_count);
+}
+
+bool Snapshot::reserve_samples(uint64_t sample_count)
+{
+	return reserve_data_chunks(sample_count);
+}
+
+uint64_t Snapshot::get_ring_mask(unsigned int block_power) const
+{
+	if (_ring_chunk_count == 0)
+		return ~0ULL;
+
+	const uint64_t length = _ring_index_span >> block_power;
+	return (length >= 2) ? length - 1 : 0;
+}
+
+uint64_t Snapshot::get_ring_length(uint64_t length, uint64_t mask)
+{
+	return (length > mask) ? mask + 1 : length;
+}
+
+bool Snapshot::reserve_data_chunks(uint64_t sample_count)
+{
+	const size_t prev_chunk_count = _data_chunks.size();
+	uint64_t chunk_count =
+		((sample_count + ChunkSize - 1) >> ChunkSizePower) -
+		min(_first_chunk, sample_count >> ChunkSizePower);
+	if (_ring_chunk_count != 0)
+		chunk_count = min(chunk_count, _ring_chunk_count);
+
+	while (_data_chunks.size() < chunk_count)
+		if (!allocate_data_chunk()) {
+			while (_data_chunks.size() > prev_chunk_count) {
+				_storage.release(_data_chunks.back(),
+					ChunkSize * _unit_size + sizeof(uint64_t));
+				_data_chunks.pop_back();
+			}
+			return false;
+		}
+
+	return true;
+}
+
+void Snapshot::append_data(const void *data, uint64_t samples)
 {
-	lock_guard<recursive_mutex> lock(_mutex);
-	_data = realloc(_data, (_sample_count + samples) * _unit_size +
-		sizeof(uint64_t));
-	memcpy((uint8_t*)_data + _sample_count * _unit_size,
-		data, samples * _unit_size);
-	_sample_count += samples;
+	const uint8_t *src_ptr = (const uint8_t*)data;
+	while (samples > 0)
+	{
+		const uint64_t chunk = _sample_count >> ChunkSizePower;
+		const uint64_t offset = _sample_count & (ChunkSize - 1);
+
+		if (chunk == _first_chunk + _data_chunks.size()) {
+			if (_ring_chunk_count != 0 &&
+				_data_chunks.size() == _ring_chunk_count)
+				recycle_data_chunk();
+			else if (!allocate_data_chunk())
+				throw bad_alloc();
+		}
+
+		// Fill the current chunk up to its end
+		const uint64_t length = min(samples, ChunkSize - offset);
+		memcpy(_data_chunks[chunk - _first_chunk] +
+			offset * _unit_size, src_ptr, length * _unit_size);
+
+		src_ptr += length * _unit_size;
+		samples -= length;
+		_sample_count += length;
+	}
+}
+
+void Snapshot::assert_pinned(const Pin &pin) const
+{
+	(void)pin;
+	assert(pin._snapshot == this);
+	assert(pin._lock.owns_lock());
+}
+
+const uint8_t* Snapshot::get_raw_sample(uint64_t index) const
+{
+	assert(index < _sample_count);
+	assert((index >> ChunkSizePower) >= _first_chunk);
+	return _data_chunks[(index >> ChunkSizePower) - _first_chunk] +
+		(index & (ChunkSize - 1)) * _unit_size;
+}
+
+const uint8_t* Snapshot::get_raw_samples(uint64_t start, uint64_t end,
+	uint64_t &length) const
+{
+	assert(start < end);
+	assert(end <= _sample_count);
+	assert((start >> ChunkSizePower) >= _first_chunk);
+
+	const uint64_t offset = start & (ChunkSize - 1);
+	length = min(end - start, ChunkSize - offset);
+	return _data_chunks[(start >> ChunkSizePower) - _first_chunk] +
+		offset * _unit_size;
+}
+
+void Snapshot::copy_raw_samples(void *dest, uint64_t start,
+	uint64_t end) const
+{
+	uint64_t length;
+	uint8_t *dest_ptr = (uint8_t*)dest;
+
+	assert(start <= end);
+
+	while (start < end)
+	{
+		const uint8_t *const src_ptr =
+			get_raw_samples(start, end, length);
+		memcpy(dest_ptr, src_ptr, length * _unit_size);
+		dest_ptr += length * _unit_size;
+		start += length;
+	}
+}
+
+void Snapshot::prefetch_raw_samples(uint64_t start, uint64_t end) const
+{
+	uint64_t length;
+
+	assert(start <= end);
+
+	while (start < end)
+	{
+		const uint8_t *const ptr = get_raw_samples(start, end, length);
+		_storage.prefetch(ptr, length * _unit_size);
+		start += length;
+	}
+}
+
+bool Snapshot::allocate_data_chunk()
+{
+	// Padding is added to allow for the uint64_t read word
+	const size_t chunk_bytes = ChunkSize * _unit_size;
+	uint8_t *const new_chunk = (uint8_t*)_storage.allocate(
+		chunk_bytes + sizeof(uint64_t));
+	if (!new_chunk)
+		return false;
+	memset(new_chunk + chunk_bytes, 0, sizeof(uint64_t));
+	_data_chunks.push_back(new_chunk);
+	return true;
+}
+
+void Snapshot::recycle_data_chunk()
+{
+	assert(!_data_chunks.empty());
+
+	// The index is built from the samples, so it must be brought up
+	// to date before any of them are discarded
+	if (_indexed_sample_count < ((_first_chunk + 1) << ChunkSizePower))
+		index_samples(_sample_count);
+
+	uint8_t *const chunk = _data_chunks.front();
+	fill(_discarded_sample.begin(), _discarded_sample.end(), 0);
+	memcpy(&_discarded_sample[0], chunk + (ChunkSize - 1) * _unit_size,
+		_unit_size);
+
+	_data_chunks.erase(_data_chunks.begin());
+	_data_chunks.push_back(chunk);
+	_first_chunk++;
+}
+
+void Snapshot::index_samples(uint64_t end)
+{
+	update_index(end);
+	_indexed_sample_count = end;
+}
+
+void Snapshot::indexing_thread_proc()
+{
+	unique_lock<shared_mutex> lock(_mutex);
+	while (!_stop_indexing)
+	{
+		if (_indexed_sample_count == _sample_count) {
+			_indexing_cond.wait(lock);
+			continue;
+		}
+
+		// Catch up a chunk at a time, letting readers and appending
+		// in between, so that a long backlog does not hold them up
+		index_samples(min(_sample_count,
+			_indexed_sample_count + ChunkSize));
+		lock.unlock();
+		boost::this_thread::yield();
+		lock.lock();
+	}
 }
 
 } // namespace data
@@ -25,26 +25,290 @@
 
 #include <boost/thread.hpp>
 
+#include "storage.h"
+
+#include <memory>
+#include <vector>
+
 namespace pv {
 namespace data {
 
 class Snapshot
 {
+protected:
+	static const int ChunkSizePower;
+	static const uint64_t ChunkSize;
+	static const uint64_t MaxDeferredSize;
+
 public:
-	Snapshot(int unit_size);
+	/**
+	 * Holds the snapshot for reading. While a pin is held, samples
+	 * are neither appended nor indexed, so views into the snapshot
+	 * storage stay valid. The other getters take the lock themselves,
+	 * so they must not be called by a thread which holds a pin.
+	 */
+	class Pin
+	{
+	public:
+		Pin(const Snapshot &snapshot);
+
+	private:
+		const Snapshot *const _snapshot;
+		boost::shared_lock<boost::shared_mutex> _lock;
+
+		friend class Snapshot;
+	};
+
+public:
+	/**
+	 * Constructor.
+	 * @param unit_size The size of a sample in bytes.
+	 * @param ring_length The number of samples to keep, or 0 to keep
+	 *   them all. Once the snapshot has grown past this length, the
+	 *   oldest chunk of samples is discarded for each new one, so
+	 *   that the snapshot stays at a fixed size.
+	 */
+	Snapshot(int unit_size, uint64_t ring_length = 0);
 
 	virtual ~Snapshot();
 
+	/**
+	 * Gets the size of a sample in bytes.
+	 */
+	int get_unit_size() const;
+
 	uint64_t get_sample_count() const;
 
+	/**
+	 * Gets the index of the first sample which has not been discarded.
+	 * Samples keep their index as older ones are discarded, so this
+	 * is 0 unless the snapshot is a ring buffer.
+	 */
+	uint64_t get_start_sample() const;
+
+	/**
+	 * Gets the index of the first sample which has not been discarded,
+	 * while a pin is held.
+	 */
+	uint64_t get_start_sample(const Pin &pin) const;
+
+	/**
+	 * Gets the number of bytes held by the snapshot, counting its
+	 * samples and the index built over them.
+	 */
+	uint64_t get_memory_usage() const;
+
+	/**
+	 * Reserves the storage for the expected length of the snapshot up
+	 * front, so that buffers need not be grown while samples arrive.
+	 * @param sample_count The expected number of samples.
+	 * @return Returns false if the storage could not be reserved. The
+	 *   sample buffers reserved so far are then released, and the
+	 *   snapshot grows as samples arrive, as it does without a
+	 *   reservation.
+	 */
+	bool reserve(uint64_t sample_count);
+
+	/**
+	 * Appends any samples which were held back while readers held the
+	 * snapshot. This waits for the readers, so it should be called
+	 * once, after the last payload of an acquisition.
+	 */
+	void flush();
+
+	/**
+	 * Starts a worker thread which builds the index of the snapshot,
+	 * such as a mip-map, as samples are appended. Appending then only
+	 * stores the samples, so slow index building cannot hold up the
+	 * data feed.
+	 */
+	void start_indexing_thread();
+
+	/**
+	 * Stops appending from building the index, for snapshots which
+	 * are read in whole before they are shown, such as those loaded
+	 * from a file. The samples are then only stored as they arrive,
+	 * and flush builds the index over all of them at once, which
+	 * lets the work be spread across the cores. This is used in place
+	 * of the indexing thread.
+	 */
+	void defer_indexing();
+
+	/**
+	 * Gets the number of samples the index has been built for. Beyond
+	 * this, readers have to look at the samples themselves.
+	 */
+	uint64_t get_indexed_sample_count() const;
+
 protected:
-	void append_data(void *data, uint64_t samples);
+	/**
+	 * Appends samples, unless readers currently hold the snapshot. In
+	 * that case the samples are held back and appended ahead of a
+	 * later payload, so that acquisition never waits for painting.
+	 * Readers therefore always see a consistent snapshot, which may
+	 * lag slightly behind the acquisition.
+	 * @param data The samples.
+	 * @param samples The number of samples.
+	 */
+	void append_or_defer(const void *data, uint64_t samples);
+
+	/**
+	 * Appends samples to the snapshot, and brings the derived data up
+	 * to date. This is called with the mutex exclusively locked.
+	 * @param data The samples.
+	 * @param samples The number of samples.
+	 */
+	virtual void append_samples(const void *data, uint64_t samples) = 0;
+
+	/**
+	 * Brings the index up to date with the appended samples. This is
+	 * called with the mutex exclusively locked, either after appending
+	 * or from the indexing thread.
+	 * @param end The index of the sample after the last one to index.
+	 *   The indexing thread indexes a slice of samples at a time, so
+	 *   this may be short of the sample count.
+	 */
+	virtual void update_index(uint64_t end) = 0;
+
+	/**
+	 * Builds the index over the samples appended while indexing was
+	 * deferred. This is called with the mutex exclusively locked. By
+	 * default it brings the index up to date as update_index does.
+	 */
+	virtual void build_index();
+
+	/**
+	 * Stops the indexing thread. Subclasses must call this from their
+	 * destructors, before the data the thread works on is torn down.
+	 */
+	void stop_indexing_thread();
+
+	/**
+	 * Reserves the sample buffers and the index for a number of
+	 * samples. This is called with the mutex exclusively locked.
+	 * @param sample_count The expected number of samples.
+	 * @return Returns false if the buffers could not be reserved.
+	 */
+	virtual bool reserve_samples(uint64_t sample_count);
+
+	/**
+	 * Gets the mask which wraps the offsets of an index level around
+	 * its buffer. In a ring buffer snapshot, each level of the index
+	 * is held in a ring twice the length of the samples which are
+	 * kept, so that it always covers them.
+	 * @param block_power The power of two of the number of samples
+	 *   summarised by each entry of the level.
+	 * @return Returns ~0 if the snapshot is not a ring buffer, or 0 if
+	 *   the level is too coarse to be kept.
+	 */
+	uint64_t get_ring_mask(unsigned int block_power) const;
+
+	/**
+	 * Gets the number of entries of an index level which are held in
+	 * its buffer.
+	 * @param length The number of entries in the level.
+	 * @param mask The mask which wraps the offsets of the level.
+	 */
+	static uint64_t get_ring_length(uint64_t length, uint64_t mask);
+
+	/**
+	 * Allocates the chunks of the sample store for a number of
+	 * samples. If they cannot all be allocated, the chunks allocated
+	 * by this call are released again.
+	 * @param sample_count The expected number of samples.
+	 * @return Returns false if the chunks could not be allocated.
+	 */
+	bool reserve_data_chunks(uint64_t sample_count);
+
+	void append_data(const void *data, uint64_t samples);
+
+	/**
+	 * Checks that a pin is held on this snapshot.
+	 */
+	void assert_pinned(const Pin &pin) const;
+
+	/**
+	 * Gets a pointer to a single sample in the chunked sample store.
+	 * @param index The index of the sample.
+	 * @return Returns a pointer to the first byte of the sample. At
+	 *   least sizeof(uint64_t) bytes may be read from the pointer.
+	 */
+	const uint8_t* get_raw_sample(uint64_t index) const;
+
+	/**
+	 * Gets a pointer to a run of samples which are stored
+	 * contiguously in a single chunk.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one wanted.
+	 * @param[out] length The number of samples from start that can be
+	 *   read from the returned pointer. This stops at the end of the
+	 *   chunk, so it may be less than end - start.
+	 *
+	 * @return Returns a pointer to the first byte of the start sample.
+	 */
+	const uint8_t* get_raw_samples(uint64_t start, uint64_t end,
+		uint64_t &length) const;
+
+	/**
+	 * Copies a range of samples out of the chunked store.
+	 * @param dest The buffer to copy the samples into.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one to copy.
+	 */
+	void copy_raw_samples(void *dest, uint64_t start, uint64_t end) const;
+
+	/**
+	 * Hints that a range of samples is about to be walked, so that
+	 * samples which have been spilled to disk can be read in ahead.
+	 * @param start The index of the first sample.
+	 * @param end The index of the sample after the last one.
+	 */
+	void prefetch_raw_samples(uint64_t start, uint64_t end) const;
+
+private:
+	bool allocate_data_chunk();
+
+	/**
+	 * Moves the oldest chunk of a ring buffer to the back, to take
+	 * the samples after the current last one.
+	 */
+	void recycle_data_chunk();
+
+	void index_samples(uint64_t end);
+
+	void indexing_thread_proc();
 
 protected:
-	mutable boost::recursive_mutex _mutex;
-	void *_data;
+	/// Readers take the mutex shared, appending takes it exclusively.
+	mutable boost::shared_mutex _mutex;
+	Storage _storage;
+	std::vector<uint8_t*> _data_chunks;
 	uint64_t _sample_count;
 	int _unit_size;
+
+	/// The number of chunks kept by a ring buffer, or 0 to keep all.
+	const uint64_t _ring_chunk_count;
+
+	/// The length in samples of the rings which hold the index.
+	uint64_t _ring_index_span;
+
+	/// The index of the chunk at the front of _data_chunks.
+	uint64_t _first_chunk;
+
+	/// The last sample before the first one which is kept, so that
+	/// the first sample can still be compared against it. It is held
+	/// in 64-bit words, so that samples of any width can be read whole.
+	std::vector<uint64_t> _discarded_sample;
+
+	/// Samples which were held back while readers held the snapshot.
+	std::vector<uint8_t> _deferred;
+
+private:
+	uint64_t _indexed_sample_count;
+	bool _indexing_deferred;
+	std::auto_ptr<boost::thread> _indexing_thread;
+	boost::condition_variable_any _indexing_cond;
+	bool _stop_indexing;
 };
 
 } // namespace data
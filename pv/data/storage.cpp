@@ -0,0 +1,467 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "storage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace boost;
+using namespace std;
+
+namespace pv {
+namespace data {
+
+const uint64_t Storage::GrowableSpan = 1ULL << 36;	// bytes
+
+mutex Storage::_heap_mutex;
+uint64_t Storage::_ram_threshold = Storage::default_ram_threshold();
+uint64_t Storage::_heap_usage = 0;
+
+Storage::Storage() :
+	_usage(0),
+	_fd(-1),
+	_file_end(0),
+	_file_length(0),
+	_mapped_length(0)
+{
+}
+
+Storage::~Storage()
+{
+	assert(_usage == 0);
+
+	for (std::map<void*, Mapping>::const_iterator i = _mappings.begin();
+		i != _mappings.end(); i++)
+		unmap((*i).first, (*i).second);
+
+#ifndef _WIN32
+	if (_fd >= 0)
+		close(_fd);
+#endif
+}
+
+uint64_t Storage::get_ram_threshold()
+{
+	lock_guard<mutex> lock(_heap_mutex);
+	return _ram_threshold;
+}
+
+void Storage::set_ram_threshold(uint64_t threshold)
+{
+	lock_guard<mutex> lock(_heap_mutex);
+	_ram_threshold = threshold;
+}
+
+uint64_t Storage::get_heap_usage()
+{
+	lock_guard<mutex> lock(_heap_mutex);
+	return _heap_usage;
+}
+
+void* Storage::allocate(uint64_t size)
+{
+	assert(size > 0);
+
+	void *const data = acquire(size);
+	if (data)
+		_usage += size;
+	return data;
+}
+
+void* Storage::reallocate(void *data, uint64_t old_size, uint64_t new_size)
+{
+	if (!data)
+		old_size = 0;
+
+	// realloc may free the buffer and return NULL for a size of zero,
+	// so the buffer is released here instead
+	if (new_size == 0) {
+		release(data, old_size);
+		return NULL;
+	}
+
+	void *const new_data = resize(data, old_size, new_size);
+	if (new_data)
+		_usage = _usage - old_size + new_size;
+	return new_data;
+}
+
+void Storage::release(void *data, uint64_t size)
+{
+	if (!data)
+		return;
+
+	assert(_usage >= size);
+	_usage -= size;
+
+	const std::map<void*, Mapping>::iterator i = _mappings.find(data);
+	if (i != _mappings.end()) {
+		unmap(data, (*i).second);
+		free_span((*i).second.offset, (*i).second.span);
+		_mappings.erase(i);
+		return;
+	}
+
+	free(data);
+	unreserve_heap(size);
+}
+
+uint64_t Storage::get_usage() const
+{
+	return _usage;
+}
+
+void Storage::prefetch(const void *data, uint64_t length) const
+{
+#ifndef _WIN32
+	if (_mappings.empty() || length == 0)
+		return;
+
+	const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	const uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+	madvise((void*)start, (uintptr_t)data + length - start,
+		MADV_WILLNEED);
+#else
+	(void)data;
+	(void)length;
+#endif
+}
+
+void* Storage::acquire(uint64_t size)
+{
+	void *data;
+
+	if (reserve_heap(size)) {
+		if ((data = malloc(size)))
+			return data;
+		unreserve_heap(size);
+	}
+
+	if ((data = map(size, size)))
+		return data;
+
+	// If there is no file to spill to, the heap is the last resort. A
+	// full disk fails the allocation instead, so that buffers past the
+	// threshold are bounded by the free space.
+	if (_fd >= 0)
+		return NULL;
+	if ((data = malloc(size)))
+		reserve_heap(size, true);
+	return data;
+}
+
+void* Storage::resize(void *data, uint64_t old_size, uint64_t new_size)
+{
+	void *new_data;
+
+	// Grow spilled buffers in place within their reserved span
+	const std::map<void*, Mapping>::iterator i = _mappings.find(data);
+	if (i != _mappings.end())
+		return remap(data, (*i).second, new_size);
+
+	if (new_size <= old_size) {
+		if ((new_data = realloc(data, new_size)))
+			unreserve_heap(old_size - new_size);
+		return new_data;
+	}
+
+	if (reserve_heap(new_size - old_size)) {
+		if ((new_data = realloc(data, new_size)))
+			return new_data;
+		unreserve_heap(new_size - old_size);
+	}
+
+	// Move the buffer out of the heap
+	if ((new_data = map(new_size, GrowableSpan))) {
+		if (old_size)
+			memcpy(new_data, data, old_size);
+		free(data);
+		unreserve_heap(old_size);
+		return new_data;
+	}
+
+	if (_fd >= 0)
+		return NULL;
+	if ((new_data = realloc(data, new_size)))
+		reserve_heap(new_size - old_size, true);
+	return new_data;
+}
+
+uint64_t Storage::default_ram_threshold()
+{
+#ifndef _WIN32
+	// By default, allow snapshots to take half of the physical memory
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long page_size = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && page_size > 0)
+		return (uint64_t)pages * page_size / 2;
+#endif
+	return numeric_limits<uint64_t>::max();
+}
+
+uint64_t Storage::page_ceil(uint64_t x)
+{
+#ifndef _WIN32
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+#else
+	const uint64_t page_size = 4096;
+#endif
+	return (x + page_size - 1) / page_size * page_size;
+}
+
+bool Storage::reserve_heap(uint64_t size, bool force)
+{
+	lock_guard<mutex> lock(_heap_mutex);
+	if (!force && _heap_usage + size > _ram_threshold)
+		return false;
+	_heap_usage += size;
+	return true;
+}
+
+void Storage::unreserve_heap(uint64_t size)
+{
+	lock_guard<mutex> lock(_heap_mutex);
+	assert(_heap_usage >= size);
+	_heap_usage -= size;
+}
+
+bool Storage::open_file()
+{
+#ifndef _WIN32
+	const char *const dir = getenv("TMPDIR");
+	const string path = string(dir ? dir : "/tmp") +
+		"/pulseview-XXXXXX";
+
+	vector<char> name(path.begin(), path.end());
+	name.push_back('\0');
+
+	if ((_fd = mkstemp(&name[0])) < 0)
+		return false;
+
+	// The file is kept open, but is removed when it is closed
+	unlink(&name[0]);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Storage::reserve_disk(uint64_t size) const
+{
+#ifndef _WIN32
+	// The file is sparse, so the pages of the buffers which have not
+	// been written yet take no space on the disk. They are counted
+	// against the free space along with the new pages.
+	struct stat st;
+	struct statvfs vfs;
+	if (fstat(_fd, &st) != 0 || fstatvfs(_fd, &vfs) != 0)
+		return false;
+
+	const uint64_t written = min((uint64_t)st.st_blocks * 512,
+		_mapped_length);
+	return _mapped_length - written + size <=
+		(uint64_t)vfs.f_bavail * vfs.f_frsize;
+#else
+	(void)size;
+	return false;
+#endif
+}
+
+bool Storage::grow_file(uint64_t end)
+{
+#ifndef _WIN32
+	if (end <= _file_length)
+		return true;
+
+	if (ftruncate(_fd, end) != 0)
+		return false;
+	_file_length = end;
+	return true;
+#else
+	(void)end;
+	return false;
+#endif
+}
+
+uint64_t Storage::take_span(uint64_t span)
+{
+	for (std::map<uint64_t, uint64_t>::iterator i = _free_spans.begin();
+		i != _free_spans.end(); i++) {
+		if ((*i).second < span)
+			continue;
+
+		const uint64_t offset = (*i).first;
+		const uint64_t rest = (*i).second - span;
+		_free_spans.erase(i);
+		if (rest != 0)
+			_free_spans[offset + span] = rest;
+		return offset;
+	}
+
+	const uint64_t offset = _file_end;
+	_file_end += span;
+	return offset;
+}
+
+void Storage::free_span(uint64_t offset, uint64_t span)
+{
+	// Merge the span with the free spans either side of it
+	std::map<uint64_t, uint64_t>::iterator next =
+		_free_spans.lower_bound(offset);
+	if (next != _free_spans.end() && (*next).first == offset + span) {
+		span += (*next).second;
+		_free_spans.erase(next++);
+	}
+
+	if (next != _free_spans.begin()) {
+		std::map<uint64_t, uint64_t>::iterator prev = next;
+		prev--;
+		if ((*prev).first + (*prev).second == offset) {
+			offset = (*prev).first;
+			span += (*prev).second;
+			_free_spans.erase(prev);
+		}
+	}
+
+#ifndef _WIN32
+	if (offset + span == _file_end) {
+		_file_end = offset;
+		if (_file_length > offset && ftruncate(_fd, offset) == 0)
+			_file_length = offset;
+		return;
+	}
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+	// Give the pages back to the file system. Where holes cannot be
+	// punched, the span is only reused.
+	if (_file_length > offset)
+		fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			offset, min(span, _file_length - offset));
+#endif
+#endif
+
+	_free_spans[offset] = span;
+}
+
+void* Storage::map(uint64_t size, uint64_t span)
+{
+#ifndef _WIN32
+	if (_fd < 0 && !open_file())
+		return NULL;
+
+	if (!reserve_disk(page_ceil(size)))
+		return NULL;
+
+	span = page_ceil(max(size, span));
+	const Mapping m = {take_span(span), span, size};
+
+	void *data = MAP_FAILED;
+	if (grow_file(m.offset + page_ceil(size)))
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			_fd, m.offset);
+	if (data == MAP_FAILED) {
+		free_span(m.offset, m.span);
+		return NULL;
+	}
+
+	_mapped_length += page_ceil(size);
+	_mappings[data] = m;
+	return data;
+#else
+	(void)size;
+	(void)span;
+	return NULL;
+#endif
+}
+
+void* Storage::remap(void *data, Mapping &m, uint64_t new_size)
+{
+#ifndef _WIN32
+	if (new_size > m.span) {
+		// The buffer has outgrown its span, so move it to a new one
+		void *const new_data = map(new_size,
+			max(GrowableSpan, new_size));
+		if (!new_data)
+			return NULL;
+
+		memcpy(new_data, data, min(m.length, new_size));
+		unmap(data, m);
+		free_span(m.offset, m.span);
+		_mappings.erase(data);
+		return new_data;
+	}
+
+	const uint64_t old_pages = page_ceil(m.length);
+	const uint64_t new_pages = page_ceil(new_size);
+	if (new_pages > old_pages && (!reserve_disk(new_pages - old_pages) ||
+		!grow_file(m.offset + new_pages)))
+		return NULL;
+
+	// Map the larger range before unmapping the old one, so that the
+	// buffer survives if the new mapping cannot be made
+	void *const new_data = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED, _fd, m.offset);
+	if (new_data == MAP_FAILED)
+		return NULL;
+
+	Mapping new_m = m;
+	new_m.length = new_size;
+
+	unmap(data, m);
+	_mappings.erase(data);
+	_mapped_length += new_pages;
+	_mappings[new_data] = new_m;
+	return new_data;
+#else
+	(void)data;
+	(void)m;
+	(void)new_size;
+	return NULL;
+#endif
+}
+
+void Storage::unmap(void *data, const Mapping &m)
+{
+#ifndef _WIN32
+	munmap(data, m.length);
+	_mapped_length -= page_ceil(m.length);
+#else
+	(void)data;
+	(void)m;
+#endif
+}
+
+} // namespace data
+} // namespace pv
@@ -0,0 +1,194 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef PULSEVIEW_PV_DATA_STORAGE_H
+#define PULSEVIEW_PV_DATA_STORAGE_H
+
+#include <stdint.h>
+
+#include <map>
+
+#include <boost/thread.hpp>
+
+namespace LogicSnapshotTest {
+class SpillReuse;
+}
+
+namespace pv {
+namespace data {
+
+/**
+ * Allocates the buffers which hold snapshot samples and mip-maps.
+ *
+ * Buffers are taken from the heap until the process-wide RAM threshold
+ * has been reached. Past the threshold, buffers are placed in shared
+ * mappings of an unlinked temporary file, so the kernel can write them
+ * out to disk and page them back in as they are walked.
+ */
+class Storage
+{
+private:
+	struct Mapping
+	{
+		uint64_t offset;
+		uint64_t span;
+		uint64_t length;
+	};
+
+private:
+	static const uint64_t GrowableSpan;
+
+public:
+	/**
+	 * Gets the number of bytes of heap memory which snapshots may use
+	 * before further buffers are spilled to disk.
+	 */
+	static uint64_t get_ram_threshold();
+
+	/**
+	 * Sets the number of bytes of heap memory which snapshots may use
+	 * before further buffers are spilled to disk.
+	 */
+	static void set_ram_threshold(uint64_t threshold);
+
+	/**
+	 * Gets the number of bytes of heap memory currently held by all
+	 * snapshots.
+	 */
+	static uint64_t get_heap_usage();
+
+public:
+	Storage();
+
+	~Storage();
+
+	/**
+	 * Allocates a buffer which will not be resized.
+	 * @param size The size of the buffer in bytes.
+	 *
+	 * @return Returns the buffer, or NULL if it could not be allocated.
+	 */
+	void* allocate(uint64_t size);
+
+	/**
+	 * Resizes a buffer, preserving its contents.
+	 * @param data The buffer to resize, or NULL to allocate a new one.
+	 * @param old_size The current size of the buffer in bytes.
+	 * @param new_size The new size of the buffer in bytes.
+	 *
+	 * @return Returns the resized buffer, which may have moved, or NULL
+	 *   if it could not be resized. In that case the original buffer is
+	 *   left untouched. If new_size is zero, the buffer is released and
+	 *   NULL is returned.
+	 */
+	void* reallocate(void *data, uint64_t old_size, uint64_t new_size);
+
+	/**
+	 * Releases a buffer.
+	 * @param data The buffer to release. May be NULL.
+	 * @param size The size of the buffer in bytes.
+	 */
+	void release(void *data, uint64_t size);
+
+	/**
+	 * Gets the number of bytes in the buffers currently allocated,
+	 * whether they are held on the heap or spilled to disk.
+	 */
+	uint64_t get_usage() const;
+
+	/**
+	 * Hints that a range of a buffer is about to be read, so that
+	 * spilled pages can be read in ahead of the reader.
+	 * @param data The first byte of the range.
+	 * @param length The length of the range in bytes.
+	 */
+	void prefetch(const void *data, uint64_t length) const;
+
+private:
+	Storage(const Storage&);
+	Storage& operator=(const Storage&);
+
+	static uint64_t default_ram_threshold();
+	static uint64_t page_ceil(uint64_t x);
+
+	static bool reserve_heap(uint64_t size, bool force = false);
+	static void unreserve_heap(uint64_t size);
+
+	void* acquire(uint64_t size);
+	void* resize(void *data, uint64_t old_size, uint64_t new_size);
+
+	bool open_file();
+
+	/**
+	 * Checks that the disk has the space for more pages of spilled
+	 * buffers. The file is sparse, so without the check a reservation
+	 * would only fail once the buffers were written, with SIGBUS.
+	 * @param size The number of bytes to be mapped.
+	 * @return Returns false if the pages could not be held.
+	 */
+	bool reserve_disk(uint64_t size) const;
+
+	bool grow_file(uint64_t end);
+
+	/**
+	 * Takes a span of the file for a new buffer, reusing one which was
+	 * released if it is long enough.
+	 * @return Returns the offset of the span.
+	 */
+	uint64_t take_span(uint64_t span);
+
+	/**
+	 * Gives back the span of a released buffer. The file is cut back
+	 * if the span is at its end, otherwise its pages are given back to
+	 * the file system and it is kept to be reused.
+	 */
+	void free_span(uint64_t offset, uint64_t span);
+
+	void* map(uint64_t size, uint64_t span);
+	void* remap(void *data, Mapping &m, uint64_t new_size);
+	void unmap(void *data, const Mapping &m);
+
+private:
+	static boost::mutex _heap_mutex;
+	static uint64_t _ram_threshold;
+	static uint64_t _heap_usage;
+
+	uint64_t _usage;
+
+	int _fd;
+	uint64_t _file_end;
+	uint64_t _file_length;
+
+	/// The number of bytes of the file which are mapped by buffers.
+	uint64_t _mapped_length;
+
+	std::map<void*, Mapping> _mappings;
+
+	/// The lengths of the spans which were released before the end of
+	/// the file, by their offsets.
+	std::map<uint64_t, uint64_t> _free_spans;
+
+	friend class LogicSnapshotTest::SpillReuse;
+};
+
+} // namespace data
+} // namespace pv
+
+#endif // PULSEVIEW_PV_DATA_STORAGE_H
@@ -26,6 +26,7 @@
 #include <QApplication>
 #include <QButtonGroup>
 #include <QFileDialog>
+#include <QLabel>
 #include <QMessageBox>
 #include <QMenu>
 #include <QMenuBar>
@@ -94,6 +95,15 @@ void MainWindow::setup_ui()
 	_menu_file->setTitle(QApplication::translate(
 		"MainWindow", "&File", 0, QApplication::UnicodeUTF8));
 
+	_action_new_window = new QAction(this);
+	_action_new_window->setText(QApplication::translate(
+		"MainWindow", "&New Window", 0, QApplication::UnicodeUTF8));
+	_action_new_window->setIcon(QIcon::fromTheme("window-new"));
+	_action_new_window->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_N));
+	_action_new_window->setObjectName(
+		QString::fromUtf8("actionNewWindow"));
+	_menu_file->addAction(_action_new_window);
+
 	_action_open = new QAction(this);
 	_action_open->setText(QApplication::translate(
 		"MainWindow", "&Open...", 0, QApplication::UnicodeUTF8));
@@ -102,6 +112,23 @@ void MainWindow::setup_ui()
 	_action_open->setObjectName(QString::fromUtf8("actionOpen"));
 	_menu_file->addAction(_action_open);
 
+	_action_save = new QAction(this);
+	_action_save->setText(QApplication::translate(
+		"MainWindow", "&Save", 0, QApplication::UnicodeUTF8));
+	_action_save->setIcon(QIcon::fromTheme("document-save"));
+	_action_save->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_S));
+	_action_save->setObjectName(QString::fromUtf8("actionSave"));
+	_menu_file->addAction(_action_save);
+
+	_action_save_as = new QAction(this);
+	_action_save_as->setText(QApplication::translate(
+		"MainWindow", "Save &As...", 0, QApplication::UnicodeUTF8));
+	_action_save_as->setIcon(QIcon::fromTheme("document-save-as"));
+	_action_save_as->setShortcut(QKeySequence(
+		Qt::CTRL + Qt::SHIFT + Qt::Key_S));
+	_action_save_as->setObjectName(QString::fromUtf8("actionSaveAs"));
+	_menu_file->addAction(_action_save_as);
+
 	_menu_file->addSeparator();
 
 	_action_connect = new QAction(this);
@@ -194,7 +221,24 @@ void MainWindow::setup_ui()
 	// Setup _session events
 	connect(&_session, SIGNAL(capture_state_changed(int)), this,
 		SLOT(capture_state_changed(int)));
-
+	connect(&_session, SIGNAL(data_updated()), this,
+		SLOT(update_memory_usage()));
+	connect(&_session, SIGNAL(data_appended(double, double)), this,
+		SLOT(update_memory_usage()));
+	connect(&_session, SIGNAL(load_progress(int)), this,
+		SLOT(show_load_progress(int)));
+	connect(&_session, SIGNAL(save_progress(int)), this,
+		SLOT(show_save_progress(int)));
+	connect(&_session, SIGNAL(save_finished()), this,
+		SLOT(save_finished()));
+	connect(&_session, SIGNAL(data_updated()), this,
+		SLOT(update_save_actions()));
+
+	// Show the memory taken by the captured data
+	_memory_usage_label = new QLabel(this);
+	statusBar()->addPermanentWidget(_memory_usage_label);
+	update_memory_usage();
+	update_save_actions();
 }
 
 void MainWindow::scan_devices()
@@ -222,6 +266,23 @@ void MainWindow::session_error(
 		Q_ARG(QString, info_text));
 }
 
+void MainWindow::save_file(QString file_name)
+{
+	_session.save_file(file_name.toStdString(),
+		boost::bind(&MainWindow::session_error, this,
+			QString("Failed to save file %1").arg(file_name), _1));
+	update_save_actions();
+}
+
+void MainWindow::update_save_actions()
+{
+	const bool can_save = !_session.is_saving() &&
+		_session.get_capture_state() == SigSession::Stopped &&
+		!_session.get_signals().empty();
+	_action_save->setEnabled(can_save);
+	_action_save_as->setEnabled(can_save);
+}
+
 void MainWindow::load_file(QString file_name)
 {
 	const QString errorMessage(
@@ -243,6 +304,14 @@ void MainWindow::show_session_error(
 	msg.exec();
 }
 
+void MainWindow::on_actionNewWindow_triggered()
+{
+	// Each window has its own session, with its own data and view
+	MainWindow *const window = new MainWindow();
+	window->setAttribute(Qt::WA_DeleteOnClose);
+	window->show();
+}
+
 void MainWindow::on_actionOpen_triggered()
 {
 	const QString file_name = QFileDialog::getOpenFileName(
@@ -251,6 +320,29 @@ void MainWindow::on_actionOpen_triggered()
 	load_file(file_name);
 }
 
+void MainWindow::on_actionSave_triggered()
+{
+	if (_save_file_name.isEmpty())
+		on_actionSaveAs_triggered();
+	else
+		save_file(_save_file_name);
+}
+
+void MainWindow::on_actionSaveAs_triggered()
+{
+	QString file_name = QFileDialog::getSaveFileName(
+		this, tr("Save File"), _save_file_name,
+		tr("Sigrok Sessions (*.sr)"));
+	if (file_name.isEmpty())
+		return;
+
+	if (!file_name.endsWith(".sr", Qt::CaseInsensitive))
+		file_name += ".sr";
+
+	_save_file_name = file_name;
+	save_file(file_name);
+}
+
 void MainWindow::on_actionConnect_triggered()
 {
 	dialogs::Connect dlg(this);
@@ -298,6 +390,8 @@ void MainWindow::run_stop()
 {
 	switch(_session.get_capture_state()) {
 	case SigSession::Stopped:
+		// Save asks where to save each new capture
+		_save_file_name.clear();
 		_session.start_capture(
 			_sampling_bar->get_selected_device(),
 			_sampling_bar->get_record_length(),
@@ -314,6 +408,41 @@ void MainWindow::run_stop()
 void MainWindow::capture_state_changed(int state)
 {
 	_sampling_bar->set_sampling(state != SigSession::Stopped);
+
+	if (state == SigSession::Stopped)
+		statusBar()->clearMessage();
+
+	update_save_actions();
+}
+
+void MainWindow::show_load_progress(int percent)
+{
+	statusBar()->showMessage(tr("Loading... %1%").arg(percent));
+}
+
+void MainWindow::show_save_progress(int percent)
+{
+	statusBar()->showMessage(tr("Saving... %1%").arg(percent));
+}
+
+void MainWindow::save_finished()
+{
+	statusBar()->clearMessage();
+	update_save_actions();
+}
+
+void MainWindow::update_memory_usage()
+{
+	const double MiB = 1 << 20;
+	const uint64_t budget = SigSession::get_memory_budget();
+	const QString usage = QString::number(
+		_session.get_memory_usage() / MiB, 'f', 1);
+
+	if (budget == 0)
+		_memory_usage_label->setText(tr("Memory: %1 MiB").arg(usage));
+	else
+		_memory_usage_label->setText(tr("Memory: %1 of %2 MiB")
+			.arg(usage).arg(budget / MiB, 0, 'f', 1));
 }
 
 } // namespace pv
@@ -28,6 +28,7 @@
 #include "sigsession.h"
 
 class QAction;
+class QLabel;
 class QMenuBar;
 class QMenu;
 class QVBoxLayout;
@@ -59,6 +60,11 @@ private:
 
 	void session_error(const QString text, const QString info_text);
 
+	/**
+	 * Saves the capture to a file on a background thread.
+	 */
+	void save_file(QString file_name);
+
 private slots:
 	void load_file(QString file_name);
 
@@ -66,7 +72,10 @@ private slots:
 	void show_session_error(
 		const QString text, const QString info_text);
 
+	void on_actionNewWindow_triggered();
 	void on_actionOpen_triggered();
+	void on_actionSave_triggered();
+	void on_actionSaveAs_triggered();
 	void on_actionQuit_triggered();
 
 	void on_actionConnect_triggered();
@@ -83,6 +92,20 @@ private slots:
 
 	void capture_state_changed(int state);
 
+	void show_load_progress(int percent);
+
+	void show_save_progress(int percent);
+
+	void save_finished();
+
+	/**
+	 * Enables the save actions while there is a capture which can be
+	 * saved.
+	 */
+	void update_save_actions();
+
+	void update_memory_usage();
+
 private:
 
 	SigSession _session;
@@ -92,7 +115,10 @@ private:
 
 	QMenuBar *_menu_bar;
 	QMenu *_menu_file;
+	QAction *_action_new_window;
 	QAction *_action_open;
+	QAction *_action_save;
+	QAction *_action_save_as;
 	QAction *_action_connect;
 	QAction *_action_quit;
 
@@ -109,6 +135,12 @@ private:
 
 	QToolBar *_toolbar;
 	toolbars::SamplingBar *_sampling_bar;
+
+	QLabel *_memory_usage_label;
+
+	/// The file the capture was last saved to, which Save writes to
+	/// again.
+	QString _save_file_name;
 };
 
 } // namespace pv
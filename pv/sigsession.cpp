@@ -22,12 +22,21 @@
 
 #include "data/analog.h"
 #include "data/analogsnapshot.h"
+#include "data/atomic.h"
 #include "data/logic.h"
 #include "data/logicsnapshot.h"
+#include "data/sessionfile.h"
+#include "data/sessionfilewriter.h"
 #include "view/analogsignal.h"
 #include "view/logicsignal.h"
 
 #include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 
 #include <QDebug>
 
@@ -36,14 +45,44 @@ using namespace std;
 
 namespace pv {
 
-// TODO: This should not be necessary
-SigSession* SigSession::_session = NULL;
+mutex SigSession::_session_mutex;
+SigSession* SigSession::_running_session = NULL;
+
+const size_t SigSession::PacketQueueCapacity = 64;	// packets
+
+double SigSession::_ring_duration = 0;
+uint64_t SigSession::_memory_budget = 0;
+double SigSession::_frame_rate = 30;
 
 SigSession::SigSession() :
-	_capture_state(Stopped)
+	_capture_state(Stopped),
+	_record_length(0),
+	_loading_file(false),
+	_load_percent(0),
+	_stop_loading(false),
+	_save_percent(0),
+	_saving(false),
+	_packet_queue(PacketQueueCapacity),
+	_stop_storing(false),
+	_queue_stall_count(0),
+	_storage_sleeping(false),
+	_queue_full_waiting(false),
+	_session_stop_pending(false),
+	_update_pending(false),
+	_update_start(0),
+	_update_end(0),
+	_update_count(0),
+	_coalesced_update_count(0)
 {
-	// TODO: This should not be necessary
-	_session = this;
+	// Updates are asked for on the sampling thread, and emitted on
+	// the GUI thread
+	connect(this, SIGNAL(update_requested()),
+		this, SLOT(on_update_requested()), Qt::QueuedConnection);
+
+	_update_timer.setSingleShot(true);
+	connect(&_update_timer, SIGNAL(timeout()),
+		this, SLOT(on_update_requested()));
+	_update_time.start();
 }
 
 SigSession::~SigSession()
@@ -54,19 +93,142 @@ SigSession::~SigSession()
 		_sampling_thread->join();
 	_sampling_thread.reset();
 
-	// TODO: This should not be necessary
-	_session = NULL;
+	// The file being saved is finished, rather than left part written
+	if (_saving_thread.get())
+		_saving_thread->join();
+	_saving_thread.reset();
+
+	assert(_running_session != this);
+}
+
+void SigSession::set_ring_duration(double seconds)
+{
+	assert(seconds >= 0);
+	_ring_duration = seconds;
+}
+
+uint64_t SigSession::get_memory_budget()
+{
+	return _memory_budget;
+}
+
+void SigSession::set_memory_budget(uint64_t bytes)
+{
+	_memory_budget = bytes;
+}
+
+void SigSession::set_frame_rate(double frame_rate)
+{
+	assert(frame_rate > 0);
+	_frame_rate = frame_rate;
 }
 
 void SigSession::load_file(const string &name,
 	function<void (const QString)> error_handler)
 {
 	stop_capture();
+
+	{
+		lock_guard<mutex> lock(_sampling_mutex);
+		_stop_loading = false;
+	}
+
 	_sampling_thread.reset(new boost::thread(
 		&SigSession::load_thread_proc, this, name,
 		error_handler));
 }
 
+void SigSession::save_file(const string &name,
+	function<void (const QString)> error_handler)
+{
+	{
+		lock_guard<mutex> lock(_sampling_mutex);
+		if (_capture_state == Running) {
+			error_handler(tr("Stop the capture before saving."));
+			return;
+		}
+
+		if (_saving) {
+			error_handler(tr(
+				"The capture is already being saved."));
+			return;
+		}
+	}
+
+	// The names of the probes are taken from the signals
+	vector< pair<int, string> > probes;
+	string analog_name;
+	{
+		lock_guard<mutex> lock(_signals_mutex);
+		BOOST_FOREACH(const shared_ptr<view::Signal> &s, _signals) {
+			assert(s);
+			const string signal_name =
+				s->get_name().toUtf8().constData();
+
+			const shared_ptr<view::LogicSignal> logic_signal =
+				dynamic_pointer_cast<view::LogicSignal>(s);
+			if (logic_signal)
+				probes.push_back(make_pair(
+					logic_signal->get_probe_index(),
+					signal_name));
+			else if (analog_name.empty())
+				analog_name = signal_name;
+		}
+	}
+
+	// The writer holds on to the newest snapshots, so that they are
+	// not freed if they are discarded while the file is written
+	shared_ptr<data::SessionFileWriter> writer;
+	{
+		lock_guard<mutex> data_lock(_data_mutex);
+
+		const bool has_logic = _logic_data && !probes.empty() &&
+			!_logic_data->get_snapshots().empty();
+		const bool has_analog = _analog_data &&
+			!_analog_data->get_snapshots().empty();
+		if (!has_logic && !has_analog) {
+			error_handler(tr("There is no capture to save."));
+			return;
+		}
+
+		const double samplerate = has_logic ?
+			_logic_data->get_samplerate() :
+			_analog_data->get_samplerate();
+		writer.reset(new data::SessionFileWriter(
+			(uint64_t)(samplerate + 0.5)));
+
+		if (has_logic) {
+			sort(probes.begin(), probes.end());
+			writer->set_logic(_logic_data->get_snapshots().back(),
+				probes);
+		}
+
+		if (has_analog)
+			writer->set_analog(_analog_data->get_snapshots().back(),
+				analog_name);
+	}
+
+	// The last save has finished, so its thread only needs joining
+	if (_saving_thread.get())
+		_saving_thread->join();
+
+	{
+		lock_guard<mutex> lock(_sampling_mutex);
+		_saving = true;
+	}
+
+	_save_percent = -1;
+	_saving_thread.reset(new boost::thread(
+		&SigSession::save_thread_proc, this, name, writer,
+		error_handler));
+}
+
+bool SigSession::is_saving() const
+{
+	lock_guard<mutex> lock(_sampling_mutex);
+	return _saving;
+}
+
 SigSession::capture_state SigSession::get_capture_state() const
 {
 	lock_guard<mutex> lock(_sampling_mutex);
@@ -104,9 +266,17 @@ void SigSession::stop_capture()
 	if (get_capture_state() == Stopped)
 		return;
 
+	{
+		lock_guard<mutex> lock(_sampling_mutex);
+		_stop_loading = true;
+	}
+
+	// The libsigrok session may belong to another window, while this
+	// one loads a file directly
 	{
 		lock_guard<mutex> lock(_session_mutex);
-		sr_session_stop();
+		if (_running_session == this)
+			sr_session_stop();
 	}
 
 	// Check that sampling stopped
@@ -126,6 +296,56 @@ boost::shared_ptr<data::Logic> SigSession::get_data()
 	return _logic_data;
 }
 
+uint64_t SigSession::get_memory_usage() const
+{
+	lock_guard<mutex> lock(_data_mutex);
+
+	uint64_t usage = 0;
+	if (_logic_data)
+		usage += _logic_data->get_memory_usage();
+	if (_analog_data)
+		usage += _analog_data->get_memory_usage();
+	return usage;
+}
+
+uint64_t SigSession::get_update_count() const
+{
+	lock_guard<mutex> lock(_update_mutex);
+	return _update_count;
+}
+
+uint64_t SigSession::get_coalesced_update_count() const
+{
+	lock_guard<mutex> lock(_update_mutex);
+	return _coalesced_update_count;
+}
+
+size_t SigSession::get_packet_queue_depth() const
+{
+	return _packet_queue.get_depth();
+}
+
+size_t SigSession::get_packet_queue_high_water_mark() const
+{
+	return _packet_queue.get_high_water_mark();
+}
+
+size_t SigSession::get_packet_buffer_allocation_count() const
+{
+	return _packet_queue.get_allocation_count();
+}
+
+size_t SigSession::get_packet_buffer_pool_size() const
+{
+	return _packet_queue.get_pool_size();
+}
+
+uint64_t SigSession::get_packet_queue_stall_count() const
+{
+	lock_guard<mutex> lock(_storage_mutex);
+	return _queue_stall_count;
+}
+
 void SigSession::set_capture_state(capture_state state)
 {
 	lock_guard<mutex> lock(_sampling_mutex);
@@ -136,16 +356,38 @@ void SigSession::set_capture_state(capture_state state)
 void SigSession::load_thread_proc(const string name,
 	function<void (const QString)> error_handler)
 {
+	_record_length = 0;
+	_loading_file = true;
+	_error_handler = error_handler;
+	reset_update_counts();
+
+	// Logic captures are read straight from the file, rather than
+	// replayed through libsigrok a packet at a time
+	data::SessionFile file;
+	if (file.open(name)) {
+		load_session_file(file);
+		return;
+	}
+
 	{
 		lock_guard<mutex> lock(_session_mutex);
+		if (!claim_sr_session()) {
+			error_handler(tr("Another window is capturing."));
+			return;
+		}
+
 		if (sr_session_load(name.c_str()) != SR_OK) {
+			_running_session = NULL;
 			error_handler(tr("Failed to load file."));
 			return;
 		}
 
 		sr_session_datafeed_callback_add(data_feed_in_proc);
 
+		start_storage_thread();
 		if (sr_session_start() != SR_OK) {
+			stop_storage_thread();
+			_running_session = NULL;
 			error_handler(tr("Failed to start session."));
 			return;
 		}
@@ -154,15 +396,193 @@ void SigSession::load_thread_proc(const string name,
 	set_capture_state(Running);
 
 	sr_session_run();
+	stop_storage_thread();
 
 	{
 		lock_guard<mutex> lock(_session_mutex);
 		sr_session_destroy();
+		_running_session = NULL;
 	}
 
 	set_capture_state(Stopped);
 }
 
+void SigSession::load_session_file(const data::SessionFile &file)
+{
+	set_capture_state(Running);
+
+	// The previous capture is dropped first, to free its memory for
+	// the file
+	{
+		lock_guard<mutex> data_lock(_data_mutex);
+		_logic_data.reset();
+		_analog_data.reset();
+	}
+
+	{
+		lock_guard<mutex> lock(_signals_mutex);
+		_signals.clear();
+		signals_changed();
+	}
+
+	shared_ptr<data::LogicSnapshot> snapshot;
+	if (!file.get_probes().empty()) {
+		sr_datafeed_logic logic;
+		logic.length = 0;
+		logic.unitsize = file.get_unit_size();
+		logic.data = NULL;
+
+		snapshot.reset(new data::LogicSnapshot(logic));
+		snapshot->defer_indexing();
+
+		_record_length = file.get_sample_count();
+		if (!snapshot->reserve(_record_length)) {
+			_error_handler(tr("Not enough memory to record "
+				"%1 samples.").arg(_record_length));
+			set_capture_state(Stopped);
+			return;
+		}
+	}
+
+	shared_ptr<data::AnalogSnapshot> analog_snapshot;
+	if (file.has_analog()) {
+		sr_datafeed_analog analog;
+		memset(&analog, 0, sizeof(analog));
+
+		analog_snapshot.reset(new data::AnalogSnapshot(analog));
+		analog_snapshot->defer_indexing();
+
+		if (!analog_snapshot->reserve(
+			file.get_analog_sample_count())) {
+			_error_handler(tr("Not enough memory to record "
+				"%1 samples.").arg(
+				file.get_analog_sample_count()));
+			set_capture_state(Stopped);
+			return;
+		}
+	}
+
+	// The snapshots are read and indexed before they are published,
+	// so the view never paints the unindexed samples, and building the
+	// index never keeps a painting thread waiting
+	_load_percent = -1;
+	const unsigned int thread_count =
+		max(boost::thread::hardware_concurrency(), 1U);
+	data::SessionFile::LogicHandler logic_handler;
+	if (snapshot)
+		logic_handler = bind(&data::LogicSnapshot::append_payload,
+			snapshot.get(), _1);
+	data::SessionFile::AnalogHandler analog_handler;
+	if (analog_snapshot)
+		analog_handler = bind(&data::AnalogSnapshot::append_payload,
+			analog_snapshot.get(), _1);
+
+	// A stopped load keeps the samples read so far, as a stopped
+	// capture does
+	if (!file.read(logic_handler, analog_handler,
+		bind(&SigSession::notify_load_progress, this, _1, _2),
+		thread_count, bind(&SigSession::is_load_stopped, this)) &&
+		!is_load_stopped())
+		_error_handler(tr("Failed to read file."));
+
+	// Index whatever was read across all the cores
+	if (snapshot)
+		snapshot->flush();
+	if (analog_snapshot)
+		analog_snapshot->flush();
+
+	{
+		lock_guard<mutex> data_lock(_data_mutex);
+
+		if (snapshot) {
+			_logic_data.reset(new data::Logic(
+				file.get_probes().size(),
+				file.get_samplerate()));
+			_logic_data->push_snapshot(snapshot);
+		}
+
+		if (analog_snapshot) {
+			_analog_data.reset(new data::Analog(
+				file.get_samplerate()));
+			_analog_data->push_snapshot(analog_snapshot);
+		}
+
+		apply_memory_budget();
+	}
+
+	{
+		lock_guard<mutex> lock(_signals_mutex);
+
+		for (vector< pair<int, string> >::const_iterator i =
+			file.get_probes().begin();
+			i != file.get_probes().end(); i++)
+			_signals.push_back(shared_ptr<view::Signal>(
+				new view::LogicSignal(
+					QString::fromUtf8((*i).second.c_str()),
+					_logic_data, (*i).first)));
+
+		if (analog_snapshot)
+			_signals.push_back(shared_ptr<view::Signal>(
+				new view::AnalogSignal(QString::fromUtf8(
+					file.get_analog_probe().second.c_str()),
+					_analog_data,
+					file.get_analog_probe().first)));
+
+		signals_changed();
+	}
+
+	data_updated();
+	set_capture_state(Stopped);
+}
+
+void SigSession::notify_load_progress(uint64_t done, uint64_t total)
+{
+	const int percent = (total == 0) ? 100 : (int)(done * 100 / total);
+	if (percent == _load_percent)
+		return;
+
+	_load_percent = percent;
+	load_progress(percent);
+}
+
+bool SigSession::is_load_stopped() const
+{
+	lock_guard<mutex> lock(_sampling_mutex);
+	return _stop_loading;
+}
+
+void SigSession::save_thread_proc(const string name,
+	shared_ptr<data::SessionFileWriter> writer,
+	function<void (const QString)> error_handler)
+{
+	assert(writer);
+	assert(error_handler);
+
+	const unsigned int thread_count =
+		max(boost::thread::hardware_concurrency(), 1U);
+	if (!writer->write(name,
+		bind(&SigSession::notify_save_progress, this, _1, _2),
+		thread_count))
+		error_handler(tr("Failed to save file."));
+
+	{
+		lock_guard<mutex> lock(_sampling_mutex);
+		_saving = false;
+	}
+
+	save_finished();
+}
+
+void SigSession::notify_save_progress(uint64_t done, uint64_t total)
+{
+	const int percent = (total == 0) ? 100 : (int)(done * 100 / total);
+	if (percent == _save_percent)
+		return;
+
+	_save_percent = percent;
+	save_progress(percent);
+}
+
 void SigSession::sample_thread_proc(struct sr_dev_inst *sdi,
 	uint64_t record_length,
 	function<void (const QString)> error_handler)
@@ -170,27 +590,44 @@ void SigSession::sample_thread_proc(struct sr_dev_inst *sdi,
 	assert(sdi);
 	assert(error_handler);
 
+	_record_length = record_length;
+	_loading_file = false;
+	_error_handler = error_handler;
+	reset_update_counts();
+
 	{
 		lock_guard<mutex> lock(_session_mutex);
+		if (!claim_sr_session()) {
+			error_handler(tr("Another window is capturing."));
+			return;
+		}
+
 		sr_session_new();
 		sr_session_datafeed_callback_add(data_feed_in_proc);
 
 		if (sr_session_dev_add(sdi) != SR_OK) {
 			error_handler(tr("Failed to use device."));
 			sr_session_destroy();
+			_running_session = NULL;
 			return;
 		}
 
-		// Set the sample limit
-		if (sr_config_set(sdi, SR_CONF_LIMIT_SAMPLES,
+		// Set the sample limit, unless the capture runs until it
+		// is stopped
+		if (_ring_duration == 0 &&
+			sr_config_set(sdi, SR_CONF_LIMIT_SAMPLES,
 			g_variant_new_uint64(record_length)) != SR_OK) {
 			error_handler(tr("Failed to configure "
 				"time-based sample limit."));
 			sr_session_destroy();
+			_running_session = NULL;
 			return;
 		}
 
+		start_storage_thread();
 		if (sr_session_start() != SR_OK) {
+			stop_storage_thread();
+			_running_session = NULL;
 			error_handler(tr("Failed to start session."));
 			return;
 		}
@@ -199,20 +636,102 @@ void SigSession::sample_thread_proc(struct sr_dev_inst *sdi,
 	set_capture_state(Running);
 
 	sr_session_run();
+	stop_storage_thread();
 
 	{
 		lock_guard<mutex> lock(_session_mutex);
 		sr_session_destroy();
+		_running_session = NULL;
 	}
 
 	set_capture_state(Stopped);
 }
 
-void SigSession::feed_in_header(const sr_dev_inst *sdi)
+bool SigSession::claim_sr_session()
+{
+	if (_running_session)
+		return false;
+
+	_running_session = this;
+	return true;
+}
+
+void SigSession::start_storage_thread()
+{
+	assert(!_storage_thread.get());
+
+	// Nothing is pushed until the session starts
+	_packet_queue.reset_high_water_mark();
+	_stop_storing = false;
+	_queue_stall_count = 0;
+	_session_stop_pending = false;
+
+	_storage_thread.reset(new boost::thread(
+		&SigSession::storage_thread_proc, this));
+}
+
+void SigSession::stop_storage_thread()
+{
+	if (!_storage_thread.get())
+		return;
+
+	{
+		lock_guard<mutex> lock(_storage_mutex);
+		_stop_storing = true;
+		_storage_cond.notify_one();
+	}
+
+	_storage_thread->join();
+	_storage_thread.reset();
+
+	// The buffers are only recycled within a capture
+	_packet_queue.clear_pool();
+}
+
+void SigSession::storage_thread_proc()
+{
+	while (true)
+	{
+		// Packets are stored without taking the lock
+		const data::PacketQueue::Packet *const packet =
+			_packet_queue.front();
+		if (packet) {
+			data_feed_in(*packet);
+			_packet_queue.pop();
+
+			data::memory_fence();
+			if (data::load_acquire(&_queue_full_waiting)) {
+				lock_guard<mutex> lock(_storage_mutex);
+				_queue_space_cond.notify_one();
+			}
+			continue;
+		}
+
+		// Say that this thread is about to sleep, then look at the
+		// queue again, so that either this thread sees a packet
+		// pushed meanwhile, or the session thread sees the flag
+		unique_lock<mutex> lock(_storage_mutex);
+		data::store_release(&_storage_sleeping, true);
+		data::memory_fence();
+
+		const bool empty = !_packet_queue.front();
+		if (empty && _stop_storing) {
+			// The session has stopped, and every packet it sent
+			// has been stored
+			data::store_release(&_storage_sleeping, false);
+			break;
+		}
+
+		if (empty)
+			_storage_cond.wait(lock);
+		data::store_release(&_storage_sleeping, false);
+	}
+}
+
+void SigSession::feed_in_header(const sr_dev_inst *sdi,
+	uint64_t sample_rate)
 {
 	shared_ptr<view::Signal> signal;
-	GVariant *gvar;
-	uint64_t sample_rate = 0;
 	unsigned int logic_probe_count = 0;
 	unsigned int analog_probe_count = 0;
 
@@ -233,15 +752,6 @@ void SigSession::feed_in_header(const sr_dev_inst *sdi)
 		}
 	}
 
-	// Read out the sample rate
-	assert(sdi->driver);
-
-	const int ret = sr_config_get(sdi->driver, SR_CONF_SAMPLERATE,
-		&gvar, sdi);
-	assert(ret == SR_OK);
-	sample_rate = g_variant_get_uint64(gvar);
-	g_variant_unref(gvar);
-
 	// Create data containers for the coming data snapshots
 	{
 		lock_guard<mutex> data_lock(_data_mutex);
@@ -324,17 +834,41 @@ void SigSession::feed_in_logic(const sr_datafeed_logic &logic)
 	if (!_cur_logic_snapshot)
 	{
 		// Create a new data snapshot
+		const uint64_t ring_length =
+			get_ring_length(_logic_data->get_samplerate());
 		_cur_logic_snapshot = shared_ptr<data::LogicSnapshot>(
-			new data::LogicSnapshot(logic));
+			new data::LogicSnapshot(logic,
+				data::LogicSnapshot::get_default_layout(),
+				ring_length));
+		reserve_snapshot(*_cur_logic_snapshot, ring_length);
+
+		// The samples of a file are indexed in one pass across all
+		// the cores once they have all been read
+		if (_loading_file)
+			_cur_logic_snapshot->defer_indexing();
+		else
+			_cur_logic_snapshot->start_indexing_thread();
+
+		// A ring buffer capture only keeps its newest snapshot
+		if (_ring_duration != 0)
+			_logic_data->clear_snapshots();
 		_logic_data->push_snapshot(_cur_logic_snapshot);
+		apply_memory_budget();
+
+		// Until it is indexed, the file would be slow to paint
+		if (!_loading_file)
+			data_updated();
 	}
 	else
 	{
 		// Append to the existing data snapshot
+		const uint64_t start = _cur_logic_snapshot->get_sample_count();
 		_cur_logic_snapshot->append_payload(logic);
-	}
 
-	data_updated();
+		if (!_loading_file)
+			notify_data_appended(*_logic_data, start,
+				_cur_logic_snapshot->get_sample_count());
+	}
 }
 
 void SigSession::feed_in_analog(const sr_datafeed_analog &analog)
@@ -350,52 +884,153 @@ void SigSession::feed_in_analog(const sr_datafeed_analog &analog)
 	if (!_cur_analog_snapshot)
 	{
 		// Create a new data snapshot
+		const uint64_t ring_length =
+			get_ring_length(_analog_data->get_samplerate());
 		_cur_analog_snapshot = shared_ptr<data::AnalogSnapshot>(
-			new data::AnalogSnapshot(analog));
+			new data::AnalogSnapshot(analog, ring_length));
+		reserve_snapshot(*_cur_analog_snapshot, ring_length);
+		_cur_analog_snapshot->start_indexing_thread();
+
+		if (_ring_duration != 0)
+			_analog_data->clear_snapshots();
 		_analog_data->push_snapshot(_cur_analog_snapshot);
+		apply_memory_budget();
+
+		if (!_loading_file)
+			data_updated();
 	}
 	else
 	{
 		// Append to the existing data snapshot
+		const uint64_t start = _cur_analog_snapshot->get_sample_count();
 		_cur_analog_snapshot->append_payload(analog);
+
+		if (!_loading_file)
+			notify_data_appended(*_analog_data, start,
+				_cur_analog_snapshot->get_sample_count());
 	}
+}
 
-	data_updated();
+void SigSession::notify_data_appended(const data::SignalData &data,
+	uint64_t start, uint64_t end)
+{
+	// Samples which were held back while the snapshot was being read
+	// are counted when they are appended with a later payload
+	if (start == end)
+		return;
+
+	// Samples are shown 1s apart when the sample rate is unknown
+	const double samplerate = (data.get_samplerate() != 0.0) ?
+		data.get_samplerate() : 1.0;
+
+	{
+		lock_guard<mutex> lock(_update_mutex);
+		if (_update_pending) {
+			// Pass the samples on with the update already asked for
+			_update_start = min(_update_start, start / samplerate);
+			_update_end = max(_update_end, end / samplerate);
+			_coalesced_update_count++;
+			return;
+		}
+
+		_update_pending = true;
+		_update_start = start / samplerate;
+		_update_end = end / samplerate;
+	}
+
+	update_requested();
 }
 
-void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
-	const struct sr_datafeed_packet *packet)
+void SigSession::reserve_snapshot(data::Snapshot &snapshot,
+	uint64_t ring_length)
 {
-	assert(sdi);
-	assert(packet);
+	const uint64_t length = (ring_length != 0) ?
+		ring_length : _record_length;
+	if (length == 0 || snapshot.reserve(length))
+		return;
 
-	switch (packet->type) {
-	case SR_DF_HEADER:
-		feed_in_header(sdi);
-		break;
+	_error_handler(tr("Not enough memory to record %1 samples.")
+		.arg(length));
 
-	case SR_DF_META:
-		assert(packet->payload);
-		feed_in_meta(sdi,
-			*(const sr_datafeed_meta*)packet->payload);
+	data::store_release(&_session_stop_pending, true);
+}
+
+uint64_t SigSession::get_ring_length(double samplerate)
+{
+	if (_ring_duration == 0)
+		return 0;
+
+	// Keep at least one sample when the sample rate is unknown
+	const uint64_t length = (uint64_t)(_ring_duration * samplerate);
+	return (length != 0) ? length : 1;
+}
+
+void SigSession::apply_memory_budget()
+{
+	if (_memory_budget == 0)
+		return;
+
+	uint64_t logic_usage = _logic_data ?
+		_logic_data->get_memory_usage() : 0;
+	uint64_t analog_usage = _analog_data ?
+		_analog_data->get_memory_usage() : 0;
+
+	// Logic and analog snapshots are captured side by side, so their
+	// oldest snapshots are discarded together
+	while (logic_usage + analog_usage > _memory_budget) {
+		bool discarded = false;
+
+		if (_logic_data && _logic_data->discard_oldest_snapshot()) {
+			logic_usage = _logic_data->get_memory_usage();
+			discarded = true;
+		}
+
+		if (_analog_data && _analog_data->discard_oldest_snapshot()) {
+			analog_usage = _analog_data->get_memory_usage();
+			discarded = true;
+		}
+
+		// Only the newest snapshots are left
+		if (!discarded)
+			break;
+	}
+}
+
+void SigSession::data_feed_in(const data::PacketQueue::Packet &packet)
+{
+	assert(packet.sdi);
+
+	switch (packet.type) {
+	case SR_DF_HEADER:
+		feed_in_header(packet.sdi, packet.samplerate);
 		break;
 
 	case SR_DF_LOGIC:
-		assert(packet->payload);
-		feed_in_logic(*(const sr_datafeed_logic*)packet->payload);
+		feed_in_logic(packet.logic);
 		break;
 
 	case SR_DF_ANALOG:
-		assert(packet->payload);
-		feed_in_analog(*(const sr_datafeed_analog*)packet->payload);
+		feed_in_analog(packet.analog);
 		break;
 
 	case SR_DF_END:
 	{
 		{
 			lock_guard<mutex> lock(_data_mutex);
+
+			// Append any samples held back while painting, and
+			// finish building the indexes
+			if (_cur_logic_snapshot)
+				_cur_logic_snapshot->flush();
+			if (_cur_analog_snapshot)
+				_cur_analog_snapshot->flush();
+
 			_cur_logic_snapshot.reset();
 			_cur_analog_snapshot.reset();
+
+			// The finished snapshots may have outgrown their
+			// reservations
+			apply_memory_budget();
 		}
 		data_updated();
 		break;
@@ -403,11 +1038,104 @@ void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
 	}
 }
 
+void SigSession::reset_update_counts()
+{
+	lock_guard<mutex> lock(_update_mutex);
+	_update_count = 0;
+	_coalesced_update_count = 0;
+}
+
+void SigSession::on_update_requested()
+{
+	// Put the update off until the end of the frame
+	const qint64 frame_time = (qint64)(1000 / _frame_rate);
+	const qint64 elapsed = _update_time.elapsed();
+	if (elapsed < frame_time) {
+		if (!_update_timer.isActive())
+			_update_timer.start(frame_time - elapsed);
+		return;
+	}
+
+	double start, end;
+	{
+		lock_guard<mutex> lock(_update_mutex);
+		if (!_update_pending)
+			return;
+
+		_update_pending = false;
+		start = _update_start;
+		end = _update_end;
+		_update_count++;
+	}
+
+	_update_time.restart();
+	data_appended(start, end);
+}
+
 void SigSession::data_feed_in_proc(const struct sr_dev_inst *sdi,
 	const struct sr_datafeed_packet *packet)
 {
-	assert(_session);
-	_session->data_feed_in(sdi, packet);
+	// The callback is made on the sampling thread of the session
+	// which claimed libsigrok, so it needs no lock
+	SigSession *const session = _running_session;
+	assert(session);
+	assert(sdi);
+	assert(packet);
+
+	// The configuration list of a meta packet only lives for the
+	// callback. Reading it takes no locks, so it is read here
+	if (packet->type == SR_DF_META) {
+		assert(packet->payload);
+		session->feed_in_meta(sdi,
+			*(const sr_datafeed_meta*)packet->payload);
+		return;
+	}
+
+	// The samplerate is read while libsigrok makes the callback, as the
+	// meta packets are, rather than on the storage thread. The session
+	// mutex may already be held by this thread, since drivers send the
+	// header from sr_session_start
+	uint64_t sample_rate = 0;
+	if (packet->type == SR_DF_HEADER) {
+		GVariant *gvar;
+		assert(sdi->driver);
+		const int ret = sr_config_get(sdi->driver,
+			SR_CONF_SAMPLERATE, &gvar, sdi);
+		assert(ret == SR_OK);
+		sample_rate = g_variant_get_uint64(gvar);
+		g_variant_unref(gvar);
+	}
+
+	if (!session->_packet_queue.push(sdi, *packet, sample_rate)) {
+		// Wait for the storage thread if it has fallen behind by a
+		// whole queue, rather than drop samples. The flag is set
+		// before the push is tried again, as the storage thread sets
+		// its own before it sleeps
+		unique_lock<mutex> lock(session->_storage_mutex);
+		session->_queue_stall_count++;
+		data::store_release(&session->_queue_full_waiting, true);
+		data::memory_fence();
+		while (!session->_packet_queue.push(sdi, *packet,
+			sample_rate))
+			session->_queue_space_cond.wait(lock);
+		data::store_release(&session->_queue_full_waiting, false);
+	}
+
+	// The lock is only taken to wake the storage thread if it sleeps.
+	// It looks at the queue again once it has set the flag, so it
+	// cannot miss the packet
+	data::memory_fence();
+	if (data::load_acquire(&session->_storage_sleeping)) {
+		lock_guard<mutex> lock(session->_storage_mutex);
+		session->_storage_cond.notify_one();
+	}
+
+	// The session is stopped here on behalf of the storage thread,
+	// since this thread owns it
+	if (data::load_acquire(&session->_session_stop_pending)) {
+		data::store_release(&session->_session_stop_pending, false);
+		sr_session_stop();
+	}
 }
 
 } // namespace pv
@@ -29,11 +29,15 @@
 #include <utility>
 #include <vector>
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QString>
+#include <QTimer>
 
 #include <libsigrok/libsigrok.h>
 
+#include "data/packetqueue.h"
+
 namespace pv {
 
 namespace data {
@@ -41,6 +45,10 @@ class Analog;
 class AnalogSnapshot;
 class Logic;
 class LogicSnapshot;
+class SessionFile;
+class SessionFileWriter;
+class SignalData;
+class Snapshot;
 }
 
 namespace view {
@@ -51,6 +59,9 @@ class SigSession : public QObject
 {
 	Q_OBJECT
 
+private:
+	static const size_t PacketQueueCapacity;
+
 public:
 	enum capture_state {
 		Stopped,
@@ -62,9 +73,51 @@ public:
 
 	~SigSession();
 
+	/**
+	 * Sets the number of seconds of samples captures keep, or 0 to
+	 * keep every sample. When set, captures run until they are
+	 * stopped, and keep their samples in ring buffers of a fixed
+	 * size.
+	 */
+	static void set_ring_duration(double seconds);
+
+	/**
+	 * Gets the number of bytes the snapshots of the session may take,
+	 * or 0 if there is no limit.
+	 */
+	static uint64_t get_memory_budget();
+
+	/**
+	 * Sets the number of bytes the snapshots of the session may take,
+	 * or 0 for no limit. Past the budget, the oldest snapshots are
+	 * discarded as new ones are captured. The snapshots being
+	 * captured are always kept.
+	 */
+	static void set_memory_budget(uint64_t bytes);
+
+	/**
+	 * Sets the most times a second the view is updated with samples
+	 * as they are captured, however fast packets arrive. Samples
+	 * appended in between are passed on together in one update.
+	 */
+	static void set_frame_rate(double frame_rate);
+
 	void load_file(const std::string &name,
 		boost::function<void (const QString)> error_handler);
 
+	/**
+	 * Saves the newest snapshots to a session file on a background
+	 * thread. save_progress is emitted as the file is written, and
+	 * save_finished once it is done.
+	 */
+	void save_file(const std::string &name,
+		boost::function<void (const QString)> error_handler);
+
+	/**
+	 * Returns true while a file is being saved.
+	 */
+	bool is_saving() const;
+
 	capture_state get_capture_state() const;
 
 	void start_capture(struct sr_dev_inst* sdi,
@@ -78,6 +131,54 @@ public:
 
 	boost::shared_ptr<data::Logic> get_data();
 
+	/**
+	 * Gets the number of bytes held by the snapshots of the session,
+	 * including the indices built over them.
+	 */
+	uint64_t get_memory_usage() const;
+
+	/**
+	 * Gets the number of data_appended updates emitted since the
+	 * capture began.
+	 */
+	uint64_t get_update_count() const;
+
+	/**
+	 * Gets the number of packets since the capture began whose samples
+	 * were passed on in the update of an earlier packet, rather than
+	 * in an update of their own.
+	 */
+	uint64_t get_coalesced_update_count() const;
+
+	/**
+	 * Gets the number of packets waiting to be stored.
+	 */
+	size_t get_packet_queue_depth() const;
+
+	/**
+	 * Gets the most packets which have waited to be stored at once
+	 * since the capture began.
+	 */
+	size_t get_packet_queue_high_water_mark() const;
+
+	/**
+	 * Gets the number of packet buffers allocated since the capture
+	 * began. Once the buffers have grown to fit the packets of the
+	 * device, this stops rising.
+	 */
+	size_t get_packet_buffer_allocation_count() const;
+
+	/**
+	 * Gets the bytes held by the pool of packet buffers.
+	 */
+	size_t get_packet_buffer_pool_size() const;
+
+	/**
+	 * Gets the number of packets since the capture began which had to
+	 * wait for the storage thread to make room in the queue.
+	 */
+	uint64_t get_packet_queue_stall_count() const;
+
 private:
 	void set_capture_state(capture_state state);
 
@@ -85,11 +186,58 @@ private:
 	void load_thread_proc(const std::string name,
 		boost::function<void (const QString)> error_handler);
 
+	/**
+	 * Loads the logic and analog data of a session file which was
+	 * opened directly, without going through libsigrok.
+	 */
+	void load_session_file(const data::SessionFile &file);
+
+	/**
+	 * Emits load_progress when the load has moved on by a percent.
+	 */
+	void notify_load_progress(uint64_t done, uint64_t total);
+
+	/**
+	 * Returns true once stop_capture has asked the load to stop.
+	 */
+	bool is_load_stopped() const;
+
+	void save_thread_proc(const std::string name,
+		boost::shared_ptr<data::SessionFileWriter> writer,
+		boost::function<void (const QString)> error_handler);
+
+	/**
+	 * Emits save_progress when the save has moved on by a percent.
+	 */
+	void notify_save_progress(uint64_t done, uint64_t total);
+
 	void sample_thread_proc(struct sr_dev_inst *sdi,
 		uint64_t record_length,
 		boost::function<void (const QString)> error_handler);
 
-	void feed_in_header(const sr_dev_inst *sdi);
+	/**
+	 * Starts the thread which stores the packets of the session.
+	 */
+	void start_storage_thread();
+
+	/**
+	 * Stores the packets still waiting in the queue, stops the
+	 * storage thread and frees the packet buffers. This is called
+	 * once the session has stopped sending packets.
+	 */
+	void stop_storage_thread();
+
+	void storage_thread_proc();
+
+	/**
+	 * Makes this the session which libsigrok is running for, unless
+	 * another session is running already. This is called with the
+	 * session mutex locked.
+	 * @return false if another session is running.
+	 */
+	bool claim_sr_session();
+
+	void feed_in_header(const sr_dev_inst *sdi, uint64_t sample_rate);
 
 	void feed_in_meta(const sr_dev_inst *sdi,
 		const sr_datafeed_meta &meta);
@@ -98,12 +246,63 @@ private:
 
 	void feed_in_analog(const sr_datafeed_analog &analog);
 
-	void data_feed_in(const struct sr_dev_inst *sdi,
-		const struct sr_datafeed_packet *packet);
+	/**
+	 * Adds a range of samples appended to the current snapshot of
+	 * some data to the next data_appended update. This is called on
+	 * the storage thread, and asks the GUI thread for an update
+	 * unless one is pending already.
+	 * @param start The index of the first sample appended.
+	 * @param end The index of the sample after the last one appended.
+	 */
+	void notify_data_appended(const data::SignalData &data,
+		uint64_t start, uint64_t end);
+
+	/**
+	 * Zeroes the update counters, at the start of a capture.
+	 */
+	void reset_update_counts();
+
+	/**
+	 * Reserves the storage of a new snapshot for the record length,
+	 * or for the whole of its ring buffer if it has a ring length.
+	 * If it cannot be reserved, the capture is stopped straight away,
+	 * rather than failing once memory has run out. The stop is left to
+	 * the session thread, since this is called on the storage thread
+	 * with the data mutex held.
+	 */
+	void reserve_snapshot(data::Snapshot &snapshot,
+		uint64_t ring_length);
+
+	/**
+	 * Gets the ring length of new snapshots at a sample rate, or 0 if
+	 * captures keep every sample.
+	 */
+	static uint64_t get_ring_length(double samplerate);
+
+	/**
+	 * Discards the oldest snapshots until the session is back within
+	 * its memory budget. This is called with the data mutex locked.
+	 */
+	void apply_memory_budget();
+
+	void data_feed_in(const data::PacketQueue::Packet &packet);
 
+	/**
+	 * Copies a packet into the packet queue, and wakes the storage
+	 * thread to store it. This is called on the libsigrok session
+	 * thread, and only waits if the queue is full.
+	 */
 	static void data_feed_in_proc(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet);
 
+private slots:
+	/**
+	 * Emits data_appended for the samples appended since the last
+	 * update, unless that was less than a frame ago. The update is
+	 * then put off until the frame is over.
+	 */
+	void on_update_requested();
+
 private:
 	mutable boost::mutex _sampling_mutex;
 	capture_state _capture_state;
@@ -117,26 +316,156 @@ private:
 	boost::shared_ptr<data::Analog> _analog_data;
 	boost::shared_ptr<data::AnalogSnapshot> _cur_analog_snapshot;
 
+
+	std::auto_ptr<boost::thread> _sampling_thread;
+
+	/// The number of samples expected from the capture, or 0 if this
+	/// is not known.
+	uint64_t _record_length;
+
+	/// True while a file is being loaded. The logic snapshots of a
+	/// file are indexed once they have been read in whole, and are
+	/// only shown then.
+	bool _loading_file;
+
+	/// The percentage of the file loaded, as last reported.
+	int _load_percent;
+
+	/// Set by stop_capture to stop a file which is read directly,
+	/// since libsigrok cannot stop it. This is guarded by the
+	/// sampling mutex.
+	bool _stop_loading;
+
+	/// Writes the file being saved, while the capture and the view
+	/// carry on. It holds on to the snapshots it is writing.
+	std::auto_ptr<boost::thread> _saving_thread;
+
+	/// The percentage of the file saved, as last reported.
+	int _save_percent;
+
+	/// True while a file is being saved. This is guarded by the
+	/// sampling mutex.
+	bool _saving;
+
+	boost::function<void (const QString)> _error_handler;
+
+	/// Passes packets from the libsigrok session thread to the storage
+	/// thread, so that the session thread never waits for the data
+	/// mutex.
+	data::PacketQueue _packet_queue;
+
+	std::auto_ptr<boost::thread> _storage_thread;
+
+	/// Guards _stop_storing and _queue_stall_count, and the waits on
+	/// the conditions. The session thread only takes it to wake the
+	/// storage thread while that sleeps, or to wait for room in a full
+	/// queue. The storage thread never holds it while storing.
+	mutable boost::mutex _storage_mutex;
+
+	/// Signalled when a packet is pushed while the storage thread
+	/// sleeps, or storing should stop.
+	boost::condition_variable _storage_cond;
+
+	/// Signalled when a packet is popped while the session thread
+	/// waits for room in the queue.
+	boost::condition_variable _queue_space_cond;
+
+	bool _stop_storing;
+	uint64_t _queue_stall_count;
+
+	/// Set while the storage thread waits for a packet. It is read
+	/// with an atomic load, so that the session thread only takes the
+	/// mutex to wake a sleeping storage thread.
+	bool _storage_sleeping;
+
+	/// Set while the session thread waits for room in the queue.
+	bool _queue_full_waiting;
+
+	/// Set by the storage thread to have the session thread stop the
+	/// libsigrok session, from the next packet it is sent. The storage
+	/// thread cannot stop the session itself, because the session
+	/// thread may hold the session mutex while it waits for the queue.
+	bool _session_stop_pending;
+
+	/// Guards the samples waiting to be passed on to the view.
+	mutable boost::mutex _update_mutex;
+
+	/// True while the GUI thread has been asked for an update which
+	/// it has not emitted yet.
+	bool _update_pending;
+
+	/// The time range of the samples appended since the last update.
+	double _update_start;
+	double _update_end;
+
+	uint64_t _update_count;
+	uint64_t _coalesced_update_count;
+
+	/// Measures the time since the last update.
+	QElapsedTimer _update_time;
+
+	/// Fires at the end of a frame, when an update was put off.
+	QTimer _update_timer;
+
+	static double _ring_duration;
+	static uint64_t _memory_budget;
+	static double _frame_rate;
+
 	/**
 	 * Mutex protects thread safety of libsigrok calls from
-	 * different threads.
+	 * different threads, and guards _running_session.
 	 */
-	mutable boost::mutex _session_mutex;
+	static boost::mutex _session_mutex;
 
-	std::auto_ptr<boost::thread> _sampling_thread;
+	/// The session whose capture or file libsigrok is running, or NULL.
+	/// libsigrok runs one session per process, and its datafeed
+	/// callback carries no pointer back to the SigSession, so packets
+	/// are passed to this session.
+	static SigSession *_running_session;
 
 signals:
 	void capture_state_changed(int state);
 
 	void signals_changed();
 
+	/**
+	 * Emitted when snapshots are added or finished, or when a file
+	 * has been loaded. The whole of the data may have changed.
+	 */
 	void data_updated();
 
-private:
-	// TODO: This should not be necessary. Multiple concurrent
-	// sessions should should be supported and it should be
-	// possible to associate a pointer with a sr_session.
-	static SigSession *_session;
+	/**
+	 * Emitted when samples are appended to the current snapshots.
+	 * Nothing outside the time range of the new samples has changed.
+	 * @param start The time of the first new sample in seconds.
+	 * @param end The time of the sample after the last new one.
+	 */
+	void data_appended(double start, double end);
+
+	/**
+	 * Emitted as a session file is read directly.
+	 * @param percent The percentage of the samples read so far.
+	 */
+	void load_progress(int percent);
+
+	/**
+	 * Emitted as a session file is saved.
+	 * @param percent The percentage of the samples written so far.
+	 */
+	void save_progress(int percent);
+
+	/**
+	 * Emitted once a session file has been saved, or has failed to
+	 * be.
+	 */
+	void save_finished();
+
+	/**
+	 * Emitted on the storage thread to ask the GUI thread for an
+	 * update.
+	 */
+	void update_requested();
+
 };
 
 } // namespace pv
@@ -64,12 +64,12 @@ void AnalogSignal::paint(QPainter &p, int y, int left, int right, double scale,
 
 	paint_axis(p, y, left, right);
 
-	const deque< shared_ptr<pv::data::AnalogSnapshot> > &snapshots =
+	const deque< shared_ptr<pv::data::AnalogSnapshot> > snapshots =
 		_data->get_snapshots();
 	if (snapshots.empty())
 		return;
 
-	const shared_ptr<pv::data::AnalogSnapshot> &snapshot =
+	const shared_ptr<pv::data::AnalogSnapshot> snapshot =
 		snapshots.front();
 
 	const double pixels_offset = offset / scale;
@@ -80,47 +80,66 @@ void AnalogSignal::paint(QPainter &p, int y, int left, int right, double scale,
 	const double start = samplerate * (offset - start_time);
 	const double end = start + samples_per_pixel * (right - left);
 
+	const int64_t first_sample = snapshot->get_start_sample();
 	const int64_t start_sample = min(max((int64_t)floor(start),
-		(int64_t)0), last_sample);
+		first_sample), last_sample);
 	const int64_t end_sample = min(max((int64_t)ceil(end) + 1,
 		(int64_t)0), last_sample);
 
-	if (samples_per_pixel < EnvelopeThreshold)
+	if (samples_per_pixel < EnvelopeThreshold) {
 		paint_trace(p, snapshot, y, left,
 			start_sample, end_sample,
 			pixels_offset, samples_per_pixel);
-	else
-		paint_envelope(p, snapshot, y, left,
-			start_sample, end_sample,
+		return;
+	}
+
+	// Beyond the part of the snapshot the envelope has been built for,
+	// draw the samples themselves
+	const int64_t indexed_sample = max(start_sample, min(end_sample,
+		(int64_t)snapshot->get_indexed_sample_count()));
+
+	paint_envelope(p, snapshot, y, left,
+		start_sample, indexed_sample,
+		pixels_offset, samples_per_pixel);
+	if (indexed_sample < end_sample)
+		paint_trace(p, snapshot, y, left,
+			indexed_sample, end_sample,
 			pixels_offset, samples_per_pixel);
 }
 
 void AnalogSignal::paint_trace(QPainter &p,
 	const shared_ptr<pv::data::AnalogSnapshot> &snapshot,
-	int y, int left, const int64_t start, const int64_t end,
+	int y, int left, int64_t start, const int64_t end,
 	const double pixels_offset, const double samples_per_pixel)
 {
-	const int64_t sample_count = end - start;
+	using pv::data::AnalogSnapshot;
 
-	const float *const samples = snapshot->get_samples(start, end);
-	assert(samples);
+	const AnalogSnapshot::Pin pin(*snapshot);
 
-	p.setPen(_colour);
+	// In a ring buffer, samples may have been discarded since the
+	// range was chosen
+	start = max(start, (int64_t)snapshot->get_start_sample(pin));
+	if (start >= end)
+		return;
 
-	QPointF *points = new QPointF[sample_count];
-	QPointF *point = points;
+	p.setPen(_colour);
 
-	for (int64_t sample = start; sample != end; sample++) {
-		const float x = (sample / samples_per_pixel -
-			pixels_offset) + left;
-		*point++ = QPointF(x,
-			y - samples[sample - start] * _scale);
+	_points.resize(end - start);
+	QPointF *point = &_points[0];
+
+	// The samples are read in place, a chunk at a time
+	uint64_t length;
+	for (int64_t index = start; index != end; index += length) {
+		const float *const samples = snapshot->get_samples(pin,
+			index, end, length);
+		for (uint64_t i = 0; i != length; i++) {
+			const float x = ((index + i) / samples_per_pixel -
+				pixels_offset) + left;
+			*point++ = QPointF(x, y - samples[i] * _scale);
+		}
 	}
 
-	p.drawPolyline(points, point - points);
-
-	delete[] samples;
-	delete[] points;
+	p.drawPolyline(&_points[0], point - &_points[0]);
 }
 
 void AnalogSignal::paint_envelope(QPainter &p,
@@ -131,42 +150,64 @@ void AnalogSignal::paint_envelope(QPainter &p,
 	using namespace Qt;
 	using pv::data::AnalogSnapshot;
 
-	AnalogSnapshot::EnvelopeSection e;
-	snapshot->get_envelope_section(e, start, end, samples_per_pixel);
-
-	if (e.length < 2)
-		return;
+	const AnalogSnapshot::Pin pin(*snapshot);
 
 	p.setPen(QPen(NoPen));
 	p.setBrush(_colour);
 
-	QRectF *const rects = new QRectF[e.length];
-	QRectF *rect = rects;
+	QRectF *rect = NULL;
+	const AnalogSnapshot::EnvelopeSample *prev = NULL;
+	float prev_x = 0.0f;
 
-	for(uint64_t sample = 0; sample < e.length-1; sample++) {
-		const float x = ((e.scale * sample + e.start) /
-			samples_per_pixel - pixels_offset) + left;
-		const AnalogSnapshot::EnvelopeSample *const s =
-			e.samples + sample;
-
-		// We overlap this sample with the next so that vertical
-		// gaps do not appear during steep rising or falling edges
-		const float b = y - max(s->max, (s+1)->min) * _scale;
-		const float t = y - min(s->min, (s+1)->max) * _scale;
-
-		float h = b - t;
-		if(h >= 0.0f && h <= 1.0f)
-			h = 1.0f;
-		if(h <= 0.0f && h >= -1.0f)
-			h = -1.0f;
-
-		*rect++ = QRectF(x, t, 1.0f, h);
+	// The envelope of a ring buffer is returned in several sections,
+	// one either side of the point where it wraps around
+	AnalogSnapshot::EnvelopeSection e;
+	for (int64_t index = start; index < end;
+		index = e.start + e.length * e.scale) {
+		snapshot->get_envelope_section(pin, e, index, end,
+			samples_per_pixel);
+		if (e.length == 0)
+			break;
+
+		if (!rect) {
+			_rects.resize(e.length + (end - e.start) / e.scale);
+			rect = &_rects[0];
+		}
+
+		for (uint64_t sample = 0; sample < e.length; sample++) {
+			const float x = ((e.scale * sample + e.start) /
+				samples_per_pixel - pixels_offset) + left;
+			const AnalogSnapshot::EnvelopeSample *const s =
+				e.samples + sample;
+
+			if (prev) {
+				// We overlap this sample with the previous so
+				// that vertical gaps do not appear during steep
+				// rising or falling edges
+				const float b = y - max(prev->max, s->min) *
+					_scale;
+				const float t = y - min(prev->min, s->max) *
+					_scale;
+
+				float h = b - t;
+				if(h >= 0.0f && h <= 1.0f)
+					h = 1.0f;
+				if(h <= 0.0f && h >= -1.0f)
+					h = -1.0f;
+
+				assert(rect < &_rects[0] + _rects.size());
+				*rect++ = QRectF(prev_x, t, 1.0f, h);
+			}
+
+			prev = s;
+			prev_x = x;
+		}
 	}
 
-	p.drawRects(rects, e.length);
+	if (!rect)
+		return;
 
-	delete[] rects;
-	delete[] e.samples;
+	p.drawRects(&_rects[0], rect - &_rects[0]);
 }
 
 } // namespace view
@@ -25,6 +25,11 @@
 
 #include <boost/shared_ptr.hpp>
 
+#include <vector>
+
+#include <QPointF>
+#include <QRectF>
+
 namespace pv {
 
 namespace data {
@@ -55,7 +60,7 @@ public:
 	 * @param right the x-coordinate of the right edge of the signal.
 	 * @param scale the scale in seconds per pixel.
 	 * @param offset the time to show at the left hand edge of
-	 *   the view in seconds.
+	 *   the signal in seconds.
 	 **/
 	void paint(QPainter &p, int y, int left, int right, double scale,
 		double offset);
@@ -74,6 +79,11 @@ private:
 private:
 	boost::shared_ptr<pv::data::Analog> _data;
 	float _scale;
+
+	/// Scratch buffers which are kept between paints, so that painting
+	/// does not allocate once they have grown to fit the view.
+	std::vector<QPointF> _points;
+	std::vector<QRectF> _rects;
 };
 
 } // namespace view
@@ -62,6 +62,11 @@ LogicSignal::LogicSignal(QString name, shared_ptr<data::Logic> data,
 	_colour = SignalColours[_probe_index % countof(SignalColours)];
 }
 
+int LogicSignal::get_probe_index() const
+{
+	return _probe_index;
+}
+
 void LogicSignal::paint(QPainter &p, int y, int left, int right,
 		double scale, double offset)
 {
@@ -69,8 +74,6 @@ void LogicSignal::paint(QPainter &p, int y, int left, int right,
 
 	QLineF *line;
 
-	vector< pair<int64_t, bool> > edges;
-
 	assert(scale > 0);
 	assert(_data);
 	assert(right >= left);
@@ -80,12 +83,12 @@ void LogicSignal::paint(QPainter &p, int y, int left, int right,
 	const float high_offset = y - View::SignalHeight + 0.5f;
 	const float low_offset = y + 0.5f;
 
-	const deque< shared_ptr<pv::data::LogicSnapshot> > &snapshots =
+	const deque< shared_ptr<pv::data::LogicSnapshot> > snapshots =
 		_data->get_snapshots();
 	if (snapshots.empty())
 		return;
 
-	const shared_ptr<pv::data::LogicSnapshot> &snapshot =
+	const shared_ptr<pv::data::LogicSnapshot> snapshot =
 		snapshots.front();
 
 	double samplerate = _data->get_samplerate();
@@ -101,8 +104,12 @@ void LogicSignal::paint(QPainter &p, int y, int left, int right,
 	const double start = samplerate * (offset - start_time);
 	const double end = start + samples_per_pixel * (right - left);
 
-	snapshot->get_subsampled_edges(edges,
-		min(max((int64_t)floor(start), (int64_t)0), last_sample),
+	// The edges of all the probes are extracted in one pass, and
+	// shared between the signals of the data
+	const vector< pair<int64_t, bool> > &edges =
+		_data->get_subsampled_edges(snapshot,
+		min(max((int64_t)floor(start),
+			(int64_t)snapshot->get_start_sample()), last_sample),
 		min(max((int64_t)ceil(end), (int64_t)0), last_sample),
 		samples_per_pixel / Oversampling, _probe_index);
 	assert(edges.size() >= 2);
@@ -139,7 +146,7 @@ void LogicSignal::paint(QPainter &p, int y, int left, int right,
 }
 
 void LogicSignal::paint_caps(QPainter &p, QLineF *const lines,
-	vector< pair<int64_t, bool> > &edges, bool level,
+	const vector< pair<int64_t, bool> > &edges, bool level,
 	double samples_per_pixel, double pixels_offset, float x_offset,
 	float y_offset)
 {
@@ -49,6 +49,11 @@ public:
 		boost::shared_ptr<pv::data::Logic> data,
 		int probe_index);
 
+	/**
+	 * Gets the index of the probe this signal shows.
+	 */
+	int get_probe_index() const;
+
 	/**
 	 * Paints the signal with a QPainter
 	 * @param p the QPainter to paint into.
@@ -57,7 +62,7 @@ public:
 	 * @param right the x-coordinate of the right edge of the signal.
 	 * @param scale the scale in seconds per pixel.
 	 * @param offset the time to show at the left hand edge of
-	 *   the view in seconds.
+	 *   the signal in seconds.
 	 **/
 	void paint(QPainter &p, int y, int left, int right, double scale,
 		double offset);
@@ -65,7 +70,7 @@ public:
 private:
 
 	void paint_caps(QPainter &p, QLineF *const lines,
-		std::vector< std::pair<int64_t, bool> > &edges,
+		const std::vector< std::pair<int64_t, bool> > &edges,
 		bool level, double samples_per_pixel, double pixels_offset,
 		float x_offset, float y_offset);
 
@@ -99,7 +99,7 @@ public:
 	 * @param right the x-coordinate of the right edge of the signal
 	 * @param scale the scale in seconds per pixel.
 	 * @param offset the time to show at the left hand edge of
-	 *   the view in seconds.
+	 *   the signal in seconds.
 	 **/
 	virtual void paint(QPainter &p, int y, int left, int right,
 		double scale, double offset) = 0;
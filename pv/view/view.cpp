@@ -67,6 +67,7 @@ View::View(SigSession &session, QWidget *parent) :
 	_ruler(new Ruler(*this)),
 	_header(new Header(*this)),
 	_data_length(0),
+	_data_start(0),
 	_scale(1e-6),
 	_offset(0),
 	_v_offset(0),
@@ -85,6 +86,8 @@ View::View(SigSession &session, QWidget *parent) :
 		this, SLOT(signals_changed()));
 	connect(&_session, SIGNAL(data_updated()),
 		this, SLOT(data_updated()));
+	connect(&_session, SIGNAL(data_appended(double, double)),
+		this, SLOT(data_appended(double, double)));
 
 	connect(&_cursors.first, SIGNAL(time_changed()),
 		this, SLOT(marker_time_changed()));
@@ -188,14 +191,25 @@ void View::normalize_layout()
 	v_scroll_value_changed(verticalScrollBar()->sliderPosition());
 }
 
+double View::get_data_start_time() const
+{
+	const shared_ptr<data::SignalData> sig_data = _session.get_data();
+	if (!sig_data || _data_start == 0)
+		return 0;
+
+	return _data_start / sig_data->get_samplerate();
+}
+
 void View::get_scroll_layout(double &length, double &offset) const
 {
 	const shared_ptr<data::SignalData> sig_data = _session.get_data();
 	if (!sig_data)
 		return;
 
-	length = _data_length / (sig_data->get_samplerate() * _scale);
-	offset = _offset / _scale;
+	// The scroll bar only covers the samples that are still held
+	length = (_data_length - _data_start) /
+		(sig_data->get_samplerate() * _scale);
+	offset = (_offset - get_data_start_time()) / _scale;
 }
 
 void View::update_scroll()
@@ -219,7 +233,7 @@ void View::update_scroll()
 	} else {
 		horizontalScrollBar()->setRange(0, MaxScrollValue);
 		horizontalScrollBar()->setSliderPosition(
-			_offset * MaxScrollValue / (_scale * length));
+			offset * MaxScrollValue / length);
 	}
 
 	_updating_scroll = false;
@@ -306,6 +320,7 @@ void View::h_scroll_value_changed(int value)
 		get_scroll_layout(length, offset);
 		_offset = _scale * length * value / MaxScrollValue;
 	}
+	_offset += get_data_start_time();
 
 	_ruler->update();
 	_viewport->update();
@@ -323,20 +338,33 @@ void View::signals_changed()
 	reset_signal_layout();
 }
 
-void View::data_updated()
+void View::update_data_length()
 {
 	// Get the new data length
 	_data_length = 0;
+	_data_start = 0;
 	shared_ptr<data::Logic> sig_data = _session.get_data();
 	if (sig_data) {
-		deque< shared_ptr<data::LogicSnapshot> > &snapshots =
+		const deque< shared_ptr<data::LogicSnapshot> > snapshots =
 			sig_data->get_snapshots();
 		BOOST_FOREACH(shared_ptr<data::LogicSnapshot> s, snapshots)
-			if (s)
+			if (s) {
 				_data_length = max(_data_length,
 					s->get_sample_count());
+				_data_start = max(_data_start,
+					s->get_start_sample());
+			}
 	}
 
+	// Keep the view inside a ring buffer as it moves on, which
+	// follows the newest samples
+	_offset = max(_offset, get_data_start_time());
+}
+
+void View::data_updated()
+{
+	update_data_length();
+
 	// Update the scroll bars
 	update_scroll();
 
@@ -344,6 +372,32 @@ void View::data_updated()
 	_viewport->update();
 }
 
+void View::data_appended(double start, double end)
+{
+	const double prev_offset = _offset;
+	update_data_length();
+	update_scroll();
+
+	// The view has moved on with a ring buffer, so all of it changed
+	if (_offset != prev_offset) {
+		_ruler->update();
+		_viewport->update();
+		return;
+	}
+
+	// Take in a pixel more on each side, for the edges and caps which
+	// join the new samples onto those around them
+	const double left = floor((start - _offset) / _scale) - 1;
+	const double right = ceil((end - _offset) / _scale) + 1;
+	if (right < 0 || left >= _viewport->width())
+		return;
+
+	const int x = (int)max(left, 0.0);
+	_viewport->update(x, 0,
+		(int)min(right, (double)_viewport->width()) - x,
+		_viewport->height());
+}
+
 void View::marker_time_changed()
 {
 	_ruler->update();
@@ -113,10 +113,18 @@ signals:
 	void signals_moved();
 
 private:
+	double get_data_start_time() const;
+
 	void get_scroll_layout(double &length, double &offset) const;
 	
 	void update_scroll();
 
+	/**
+	 * Gets the extent of the data from its snapshots, and keeps the
+	 * view within it.
+	 */
+	void update_data_length();
+
 	void reset_signal_layout();
 
 private:
@@ -134,6 +142,14 @@ private slots:
 	void signals_changed();
 	void data_updated();
 
+	/**
+	 * Repaints the part of the view which samples appended to the
+	 * data fall in, or nothing if they are off screen.
+	 * @param start The time of the first new sample in seconds.
+	 * @param end The time of the sample after the last new one.
+	 */
+	void data_appended(double start, double end);
+
 	void marker_time_changed();
 
 	void on_signals_moved();
@@ -147,6 +163,10 @@ private:
 
 	uint64_t _data_length;
 
+	/// The first sample still held, when the data is kept in a ring
+	/// buffer.
+	uint64_t _data_start;
+
 	/// The view time scale in seconds per pixel.
 	double _scale;
 
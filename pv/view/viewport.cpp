@@ -59,7 +59,7 @@ int Viewport::get_total_height() const
 	return h;
 }
 
-void Viewport::paintEvent(QPaintEvent*)
+void Viewport::paintEvent(QPaintEvent *event)
 {
 	const vector< shared_ptr<Signal> > sigs(
 		_view.session().get_signals());
@@ -69,13 +69,15 @@ void Viewport::paintEvent(QPaintEvent*)
 
 	draw_cursors_background(p);
 
-	// Plot the signal
+	// Plot the signal, only across the part being repainted
 	const int v_offset = _view.v_offset();
+	const QRect &rect = event->rect();
+	const double offset = _view.offset() + rect.left() * _view.scale();
 	BOOST_FOREACH(const shared_ptr<Signal> s, sigs)
 	{
 		assert(s);
-		s->paint(p, s->get_v_offset() - v_offset, 0, width(),
-			_view.scale(), _view.offset());
+		s->paint(p, s->get_v_offset() - v_offset, rect.left(),
+			rect.right() + 1, _view.scale(), offset);
 	}
 
 	draw_cursors_foreground(p);
@@ -22,14 +22,18 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 #include <boost/test/unit_test.hpp>
 
 #include "../../pv/data/analogsnapshot.h"
+#include "../../pv/data/simd.h"
 
 using namespace std;
 
 using pv::data::AnalogSnapshot;
+using pv::data::Simd;
 
 BOOST_AUTO_TEST_SUITE(AnalogSnapshotTest)
 
@@ -122,4 +126,194 @@ BOOST_AUTO_TEST_CASE(Basic)
 	BOOST_CHECK_EQUAL(e1.samples[0].max, 1.0f);
 }
 
+BOOST_AUTO_TEST_CASE(SimdKernels)
+{
+	// Enough samples to fill five envelope levels, pushed in packets
+	// which do not line up with the envelope blocks
+	const int Length = (1 << 20) * 3 + 1000;
+	const int PacketLength = 54321;
+	const Simd::Level Levels[] = {Simd::None, Simd::SSE2, Simd::AVX2};
+	const int LevelCount = sizeof(Levels) / sizeof(Levels[0]);
+
+	// Mix in signed zeros, repeated values and NaNs, which the kernels
+	// must order exactly as the scalar code does
+	float *const data = new float[Length];
+	uint32_t x = 1;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		switch (x >> 29) {
+		case 0: data[i] = 0.0f; break;
+		case 1: data[i] = -0.0f; break;
+		case 2: data[i] = (x & 0x100) ? NAN : 1.0f; break;
+		default: data[i] = (float)(int)(x >> 8) / 65536.0f; break;
+		}
+	}
+
+	sr_datafeed_analog analog;
+	AnalogSnapshot *snapshots[LevelCount];
+	for (int l = 0; l < LevelCount; l++) {
+		Simd::set_max_level(Levels[l]);
+		analog.num_samples = 0;
+		analog.data = NULL;
+		snapshots[l] = new AnalogSnapshot(analog);
+
+		for (int i = 0; i < Length; i += PacketLength) {
+			analog.num_samples = min(PacketLength, Length - i);
+			analog.data = data + i;
+			snapshots[l]->append_payload(analog);
+		}
+	}
+
+	Simd::set_max_level(Simd::AVX2);
+	delete[] data;
+
+	// Every level must be bit-exact with the scalar code
+	const AnalogSnapshot &ref = *snapshots[0];
+	BOOST_REQUIRE(ref._envelope_kernel == NULL);
+	BOOST_REQUIRE(ref._envelope_levels[4].length > 0);
+	for (int l = 1; l < LevelCount; l++)
+		for (unsigned int i = 0; i < AnalogSnapshot::ScaleStepCount;
+			i++) {
+			const AnalogSnapshot::Envelope &a =
+				snapshots[l]->_envelope_levels[i];
+			const AnalogSnapshot::Envelope &b =
+				ref._envelope_levels[i];
+			BOOST_REQUIRE_EQUAL(a.length, b.length);
+			BOOST_CHECK(memcmp(a.samples, b.samples, a.length *
+				sizeof(AnalogSnapshot::EnvelopeSample)) == 0);
+		}
+
+	for (int l = 0; l < LevelCount; l++)
+		delete snapshots[l];
+}
+
+BOOST_AUTO_TEST_CASE(Views)
+{
+	// Enough samples to span two chunks
+	const int Length = (1 << 20) + 5000;
+
+	sr_datafeed_analog analog;
+	float *const data = new float[Length];
+	for (int i = 0; i < Length; i++)
+		data[i] = (float)i;
+	analog.num_samples = Length;
+	analog.data = data;
+
+	AnalogSnapshot s(analog);
+
+	{
+		const AnalogSnapshot::Pin pin(s);
+
+		// The views must read the samples in place, and stop at the
+		// end of the chunk
+		uint64_t length;
+		const float *samples = s.get_samples(pin, 1000, Length, length);
+		BOOST_CHECK_EQUAL(length, (1 << 20) - 1000);
+		BOOST_CHECK(samples == (const float*)s._data_chunks[0] + 1000);
+
+		uint64_t index = 1000;
+		bool equal = true;
+		while (index < (uint64_t)Length) {
+			samples = s.get_samples(pin, index, Length, length);
+			equal = equal && memcmp(samples, data + index,
+				length * sizeof(float)) == 0;
+			index += length;
+		}
+		BOOST_CHECK(equal);
+		BOOST_CHECK_EQUAL(index, (uint64_t)Length);
+
+		// The envelope section must point into the envelope itself
+		AnalogSnapshot::EnvelopeSection e;
+		s.get_envelope_section(pin, e, 4096, Length, 300.0f);
+		BOOST_CHECK_EQUAL(e.scale, 256);
+		BOOST_CHECK_EQUAL(e.start, 4096);
+		BOOST_CHECK_EQUAL(e.length, Length / 256 - 16);
+		BOOST_CHECK(e.samples == s._envelope_levels[1].samples + 16);
+		BOOST_CHECK_EQUAL(e.samples[0].min, 4096.0f);
+		BOOST_CHECK_EQUAL(e.samples[0].max, 4096.0f + 255.0f);
+	}
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(RingBuffer)
+{
+	// Keep a little over two chunks of a stream many times longer
+	const uint64_t ChunkSize = 1 << 20;
+	const int Length = ChunkSize * 19 + 3000;
+	const int PacketLength = 65432;
+
+	float *const data = new float[Length];
+	uint32_t x = 1;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		data[i] = (float)(int)(x >> 8) / 65536.0f;
+	}
+
+	sr_datafeed_analog analog;
+	analog.num_samples = 0;
+	analog.data = NULL;
+	AnalogSnapshot ref(analog);
+	AnalogSnapshot s(analog, ChunkSize * 2 + 1);
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		analog.num_samples = min(PacketLength, Length - i);
+		analog.data = data + i;
+		ref.append_payload(analog);
+		s.append_payload(analog);
+	}
+
+	const uint64_t start = s.get_start_sample();
+	BOOST_CHECK_EQUAL(start, ChunkSize * 16);
+	BOOST_CHECK_EQUAL(s._data_chunks.size(), 4);
+	BOOST_CHECK_EQUAL(s._envelope_levels[0].data_length,
+		s._envelope_levels[0].mask + 1);
+
+	const AnalogSnapshot::Pin pin(s), ref_pin(ref);
+
+	uint64_t length;
+	bool equal = true;
+	for (uint64_t index = start; index < (uint64_t)Length;
+		index += length) {
+		const float *const samples = s.get_samples(pin, index,
+			Length, length);
+		equal = equal && memcmp(samples, data + index,
+			length * sizeof(float)) == 0;
+	}
+	BOOST_CHECK(equal);
+
+	// The sections must follow on from each other where the envelope
+	// wraps around the ring, and match the envelope of the whole
+	// stream
+	const float MinLengths[] = {20.0f, 300.0f, 5000.0f, 70000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++) {
+		AnalogSnapshot::EnvelopeSection e, ref_e;
+		ref.get_envelope_section(ref_pin, ref_e, start, Length,
+			MinLengths[i]);
+
+		uint64_t offset = 0;
+		equal = true;
+		for (uint64_t index = 0; index < Length;
+			index = e.start + e.length * e.scale) {
+			s.get_envelope_section(pin, e, index, Length,
+				MinLengths[i]);
+			if (e.length == 0)
+				break;
+
+			BOOST_CHECK_EQUAL(e.scale, ref_e.scale);
+			BOOST_CHECK_EQUAL(e.start,
+				ref_e.start + offset * ref_e.scale);
+			equal = equal && memcmp(e.samples,
+				ref_e.samples + offset, e.length *
+				sizeof(AnalogSnapshot::EnvelopeSample)) == 0;
+			offset += e.length;
+		}
+
+		BOOST_CHECK(equal);
+		BOOST_CHECK_EQUAL(offset, ref_e.length);
+	}
+
+	delete[] data;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
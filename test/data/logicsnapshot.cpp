@@ -26,10 +26,14 @@
 #include <boost/test/unit_test.hpp>
 
 #include "../../pv/data/logicsnapshot.h"
+#include "../../pv/data/simd.h"
+#include "../../pv/data/storage.h"
 
 using namespace std;
 
 using pv::data::LogicSnapshot;
+using pv::data::Simd;
+using pv::data::Storage;
 
 BOOST_AUTO_TEST_SUITE(LogicSnapshotTest)
 
@@ -533,4 +537,1380 @@ BOOST_AUTO_TEST_CASE(Sixteen)
 	BOOST_CHECK_EQUAL(edges.size(), 2);
 }
 
+/*
+ * This test pushes data in packets which straddle the boundaries between
+ * the storage chunks of the snapshot, and checks that edges on either side
+ * of, and exactly at, the boundaries are found.
+ */
+BOOST_AUTO_TEST_CASE(ChunkBoundaries)
+{
+	const int Length = 3 << 20;
+	const int PacketLength = 100000;
+	const int Edges[] = {
+		(1 << 20) - 1, 1 << 20, (1 << 20) + 3, (2 << 20) + 17
+	};
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot s(logic);
+
+	uint8_t *const data = new uint8_t[Length];
+	uint8_t state = 0;
+	for (int i = 0, e = 0; i < Length; i++) {
+		if (e < (int)countof(Edges) && i == Edges[e]) {
+			state = ~state;
+			e++;
+		}
+		data[i] = state;
+	}
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i);
+		logic.data = data + i;
+		s.append_payload(logic);
+	}
+
+	delete[] data;
+
+	BOOST_CHECK_EQUAL(s.get_sample_count(), (uint64_t)Length);
+	BOOST_CHECK_EQUAL(s._mip_map[0].length, (uint64_t)Length / 16);
+
+	vector<LogicSnapshot::EdgePair> edges;
+	s.get_subsampled_edges(edges, 0, Length-1, 1, 0);
+	BOOST_REQUIRE_EQUAL(edges.size(), countof(Edges) + 2);
+
+	for (unsigned int i = 0; i < countof(Edges); i++) {
+		BOOST_CHECK_EQUAL(edges[i+1].first, Edges[i]);
+		BOOST_CHECK_EQUAL(edges[i+1].second, (i & 1) == 0);
+	}
+}
+
+/*
+ * This test spills a snapshot to disk by lowering the RAM threshold, and
+ * checks that it behaves exactly like a snapshot kept on the heap.
+ */
+BOOST_AUTO_TEST_CASE(Spilled)
+{
+	const int Length = (3 << 20) + 12345;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = Length;
+	logic.data = new uint8_t[Length];
+	uint8_t *data = (uint8_t*)logic.data;
+
+	for (int i = 0; i < Length; i++)
+		*data++ = (uint8_t)(i >> 9);
+
+	LogicSnapshot heap(logic);
+
+	const uint64_t threshold = Storage::get_ram_threshold();
+	const uint64_t heap_usage = Storage::get_heap_usage();
+	Storage::set_ram_threshold(0);
+
+	LogicSnapshot spilled(logic);
+	delete[] (uint8_t*)logic.data;
+
+	BOOST_CHECK_EQUAL(Storage::get_heap_usage(), heap_usage);
+	Storage::set_ram_threshold(threshold);
+
+	BOOST_REQUIRE_EQUAL(spilled.get_sample_count(), (uint64_t)Length);
+	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++)
+		BOOST_CHECK_EQUAL(spilled._mip_map[i].length,
+			heap._mip_map[i].length);
+
+	const float MinLengths[] = {0.5f, 1.0f, 17.0f, 300.0f, 5000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++)
+		for (int sig_index = 0; sig_index < 8; sig_index++) {
+			vector<LogicSnapshot::EdgePair> a, b;
+			heap.get_subsampled_edges(a, 0, Length-1,
+				MinLengths[i], sig_index);
+			spilled.get_subsampled_edges(b, 0, Length-1,
+				MinLengths[i], sig_index);
+			BOOST_CHECK(a == b);
+		}
+}
+
+BOOST_AUTO_TEST_CASE(ReallocateToZero)
+{
+	// Shrinking a buffer to nothing releases it, on the heap or spilled
+	const uint64_t threshold = Storage::get_ram_threshold();
+	const uint64_t heap_usage = Storage::get_heap_usage();
+
+	for (int spill = 0; spill < 2; spill++) {
+		if (spill)
+			Storage::set_ram_threshold(0);
+
+		Storage s;
+		void *data = s.allocate(4096);
+		BOOST_REQUIRE(data);
+		data = s.reallocate(data, 4096, 8192);
+		BOOST_REQUIRE(data);
+		BOOST_CHECK(!s.reallocate(data, 8192, 0));
+		BOOST_CHECK_EQUAL(s.get_usage(), 0);
+		BOOST_CHECK_EQUAL(Storage::get_heap_usage(), heap_usage);
+	}
+
+	Storage::set_ram_threshold(threshold);
+}
+
+BOOST_AUTO_TEST_CASE(SpillPastFreeSpace)
+{
+	// Spilled buffers are sparse, so they must be checked against the
+	// free disk space up front. This assumes less than 4TiB is free.
+	const uint64_t Size = 1ULL << 42;
+	const uint64_t threshold = Storage::get_ram_threshold();
+	Storage::set_ram_threshold(0);
+
+	{
+		Storage s;
+		void *const data = s.allocate(4096);
+		BOOST_REQUIRE(data);
+		BOOST_CHECK(!s.allocate(Size));
+		BOOST_CHECK(!s.reallocate(data, 4096, Size));
+		s.release(data, 4096);
+		BOOST_CHECK_EQUAL(s.get_usage(), 0);
+	}
+
+	Storage::set_ram_threshold(threshold);
+}
+
+BOOST_AUTO_TEST_CASE(SpillReuse)
+{
+	// The spans of released buffers are reused, and the file is cut
+	// back once the buffers at its end are released
+	const uint64_t threshold = Storage::get_ram_threshold();
+	Storage::set_ram_threshold(0);
+
+	{
+		Storage s;
+		const uint64_t page = Storage::page_ceil(1);
+
+		void *const a = s.allocate(page);
+		void *const b = s.allocate(page);
+		void *const c = s.allocate(page);
+		BOOST_REQUIRE(a && b && c);
+		BOOST_CHECK_EQUAL(s._file_end, 3 * page);
+
+		s.release(a, page);
+		s.release(b, page);
+		BOOST_REQUIRE_EQUAL(s._free_spans.size(), 1);
+		BOOST_CHECK_EQUAL(s._free_spans[0], 2 * page);
+
+		void *const d = s.allocate(page);
+		BOOST_REQUIRE(d);
+		BOOST_CHECK_EQUAL(s._file_end, 3 * page);
+		BOOST_CHECK_EQUAL(s._mappings[d].offset, 0);
+
+		s.release(c, page);
+		BOOST_CHECK_EQUAL(s._file_end, page);
+		BOOST_CHECK_EQUAL(s._file_length, page);
+		BOOST_CHECK(s._free_spans.empty());
+
+		s.release(d, page);
+		BOOST_CHECK_EQUAL(s._file_end, 0);
+		BOOST_CHECK_EQUAL(s._file_length, 0);
+	}
+
+	Storage::set_ram_threshold(threshold);
+}
+
+/*
+ * This test checks that a run-length compressed snapshot gives the same
+ * results as an interleaved one, both for sparse data which compresses
+ * well, and for noisy data which must be stored raw.
+ */
+BOOST_AUTO_TEST_CASE(RunLength)
+{
+	const int Length = (2 << 16) + 4321;
+	const int PacketLength = 10000;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 2;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot raw(logic, LogicSnapshot::Interleaved);
+	LogicSnapshot rle(logic, LogicSnapshot::RunLength);
+	BOOST_CHECK_EQUAL(rle.get_layout(), LogicSnapshot::RunLength);
+
+	// The first block is sparse, the second is noise
+	uint16_t *const data = new uint16_t[Length];
+	for (int i = 0; i < Length; i++)
+		data[i] = (i < (1 << 16)) ? ((i / 1000) * 0x0101) :
+			(uint16_t)(i * 2654435761U >> 7);
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i) * 2;
+		logic.data = data + i;
+		raw.append_payload(logic);
+		rle.append_payload(logic);
+	}
+
+	delete[] data;
+
+	BOOST_REQUIRE_EQUAL(rle.get_sample_count(), (uint64_t)Length);
+	BOOST_CHECK_EQUAL(rle.get_indexed_sample_count(), (uint64_t)Length);
+	BOOST_REQUIRE_EQUAL(rle._run_blocks.size(), 2);
+	BOOST_CHECK_EQUAL(rle._run_blocks[0].run_count, 66);
+	BOOST_CHECK_EQUAL(rle._run_blocks[1].run_count, 0);
+
+	for (int i = 0; i < Length; i++)
+		if ((raw.get_sample(i) & 0xFFFF) !=
+			(rle.get_sample(i) & 0xFFFF))
+			BOOST_FAIL("Sample " << i << " differs");
+
+	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++) {
+		BOOST_REQUIRE_EQUAL(rle._mip_map[i].length,
+			raw._mip_map[i].length);
+		BOOST_CHECK(memcmp(rle._mip_map[i].data,
+			raw._mip_map[i].data,
+			rle._mip_map[i].length * 2) == 0);
+	}
+
+	const float MinLengths[] = {0.5f, 1.0f, 17.0f, 300.0f, 5000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++)
+		for (int sig_index = 0; sig_index < 16; sig_index++) {
+			vector<LogicSnapshot::EdgePair> a, b;
+			raw.get_subsampled_edges(a, 0, Length-1,
+				MinLengths[i], sig_index);
+			rle.get_subsampled_edges(b, 0, Length-1,
+				MinLengths[i], sig_index);
+			BOOST_CHECK(a == b);
+		}
+}
+
+BOOST_AUTO_TEST_CASE(RunLengthIndexingThread)
+{
+	// Full blocks are held raw until the indexing thread has passed
+	// over them, then compressed
+	const int Length = (3 << 16) + 1234;
+	const int PacketLength = 10000;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot inline_index(logic, LogicSnapshot::RunLength);
+	LogicSnapshot threaded_index(logic, LogicSnapshot::RunLength);
+	threaded_index.start_indexing_thread();
+
+	uint8_t *const data = new uint8_t[Length];
+	for (int i = 0; i < Length; i++)
+		data[i] = (uint8_t)(i / 1000);
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i);
+		logic.data = data + i;
+		inline_index.append_payload(logic);
+		threaded_index.append_payload(logic);
+	}
+
+	delete[] data;
+
+	for (int i = 0; i < 10000; i++) {
+		if (threaded_index.get_indexed_sample_count() ==
+			(uint64_t)Length)
+			break;
+		boost::this_thread::sleep(
+			boost::posix_time::milliseconds(1));
+	}
+	BOOST_REQUIRE_EQUAL(threaded_index.get_indexed_sample_count(),
+		(uint64_t)Length);
+
+	LogicSnapshot::Pin pin(threaded_index);
+	BOOST_REQUIRE_EQUAL(threaded_index._run_blocks.size(), 3);
+	for (int b = 0; b < 3; b++)
+		BOOST_CHECK_EQUAL(threaded_index._run_blocks[b].run_count,
+			inline_index._run_blocks[b].run_count);
+	BOOST_CHECK(threaded_index._run_blocks[0].run_count != 0);
+
+	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++) {
+		BOOST_REQUIRE_EQUAL(threaded_index._mip_map[i].length,
+			inline_index._mip_map[i].length);
+		BOOST_CHECK(memcmp(threaded_index._mip_map[i].data,
+			inline_index._mip_map[i].data,
+			inline_index._mip_map[i].length) == 0);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(SimdKernels)
+{
+	// Enough samples to fill five mip-map levels, pushed in packets
+	// which do not line up with the mip-map blocks
+	const int Length = (1 << 21) + 1000;
+	const int PacketLength = 12345;
+	const int UnitSizes[] = {1, 2, 4, 8};
+	const Simd::Level Levels[] = {Simd::None, Simd::SSE2, Simd::AVX2};
+
+	for (unsigned int u = 0; u < countof(UnitSizes); u++) {
+		const int unit_size = UnitSizes[u];
+
+		// Flip random bits now and again
+		uint8_t *const data = new uint8_t[Length * unit_size];
+		uint64_t value = 0, x = unit_size;
+		for (int i = 0; i < Length; i++) {
+			x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+			if ((x >> 60) == 0)
+				value ^= 1ULL << ((x >> 24) & 63);
+			memcpy(data + i * unit_size, &value, unit_size);
+		}
+
+		sr_datafeed_logic logic;
+		logic.unitsize = unit_size;
+		logic.length = 0;
+		logic.data = NULL;
+
+		LogicSnapshot *snapshots[countof(Levels)];
+		for (unsigned int l = 0; l < countof(Levels); l++) {
+			Simd::set_max_level(Levels[l]);
+			logic.length = 0;
+			snapshots[l] = new LogicSnapshot(logic,
+				LogicSnapshot::Interleaved);
+
+			for (int i = 0; i < Length; i += PacketLength) {
+				logic.length = min(PacketLength, Length - i) *
+					unit_size;
+				logic.data = data + i * unit_size;
+				snapshots[l]->append_payload(logic);
+			}
+		}
+
+		Simd::set_max_level(Simd::AVX2);
+		delete[] data;
+
+		// Every level must match the scalar code exactly
+		const LogicSnapshot &ref = *snapshots[0];
+		BOOST_REQUIRE(ref._transition_kernel == NULL);
+		BOOST_REQUIRE(ref._mip_map[4].length > 0);
+		for (unsigned int l = 1; l < countof(Levels); l++)
+			for (unsigned int i = 0;
+				i < LogicSnapshot::ScaleStepCount; i++) {
+				const LogicSnapshot &s = *snapshots[l];
+				BOOST_REQUIRE_EQUAL(s._mip_map[i].length,
+					ref._mip_map[i].length);
+				BOOST_CHECK(memcmp(s._mip_map[i].data,
+					ref._mip_map[i].data,
+					s._mip_map[i].length * unit_size) == 0);
+			}
+
+		for (unsigned int l = 0; l < countof(Levels); l++)
+			delete snapshots[l];
+	}
+}
+
+BOOST_AUTO_TEST_CASE(BitPlane)
+{
+	// Push packets of odd lengths over a chunk boundary, so that both
+	// the aligned and the unaligned paths of the transposition are
+	// taken
+	const int Length = (1 << 20) + 5000;
+	const int PacketLength = 777;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 2;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot raw(logic, LogicSnapshot::Interleaved);
+	LogicSnapshot planes(logic, LogicSnapshot::BitPlane);
+	BOOST_CHECK_EQUAL(planes.get_layout(), LogicSnapshot::BitPlane);
+
+	// Each probe toggles at its own rate, with some noise on the top
+	// byte
+	uint16_t *const data = new uint16_t[Length];
+	for (int i = 0; i < Length; i++)
+		data[i] = (uint16_t)((i / 3) ^ (i / 1000) ^
+			(((i * 2654435761U) >> 13) & 0x8000));
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i) * 2;
+		logic.data = data + i;
+		raw.append_payload(logic);
+		planes.append_payload(logic);
+	}
+
+	delete[] data;
+
+	BOOST_REQUIRE_EQUAL(planes.get_sample_count(), (uint64_t)Length);
+	BOOST_CHECK(planes._data_chunks.empty());
+	BOOST_CHECK_EQUAL(planes._bit_plane_chunks.size(), 2);
+
+	for (int i = 0; i < Length; i++)
+		if ((raw.get_sample(i) & 0xFFFF) != planes.get_sample(i))
+			BOOST_FAIL("Sample " << i << " differs");
+
+	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++) {
+		BOOST_REQUIRE_EQUAL(planes._mip_map[i].length,
+			raw._mip_map[i].length);
+		for (uint64_t j = 0; j < raw._mip_map[i].length; j++)
+			if ((planes.get_subsample(i, j) & 0xFFFF) !=
+				(raw.get_subsample(i, j) & 0xFFFF))
+				BOOST_FAIL("Mip-map level " << i <<
+					" sample " << j << " differs");
+	}
+
+	const float MinLengths[] = {0.5f, 1.0f, 17.0f, 300.0f, 5000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++)
+		for (int sig_index = 0; sig_index < 16; sig_index++) {
+			vector<LogicSnapshot::EdgePair> a, b;
+			raw.get_subsampled_edges(a, 10, Length-1,
+				MinLengths[i], sig_index);
+			planes.get_subsampled_edges(b, 10, Length-1,
+				MinLengths[i], sig_index);
+			BOOST_CHECK(a == b);
+		}
+}
+
+BOOST_AUTO_TEST_CASE(Deferred)
+{
+	using boost::shared_lock;
+	using boost::shared_mutex;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot s(logic);
+	push_logic(s, 100, 0x55);
+
+	// Appending must not wait for a reader, but hold the samples back
+	{
+		shared_lock<shared_mutex> lock(s._mutex);
+		push_logic(s, 1000, 0xAA);
+		BOOST_CHECK_EQUAL(s._sample_count, 100);
+		BOOST_CHECK_EQUAL(s._mip_map[0].length, 6);
+	}
+
+	// The held back samples are appended ahead of the next payload
+	push_logic(s, 12, 0xFF);
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 1112);
+	BOOST_CHECK_EQUAL(s._mip_map[0].length, 69);
+	BOOST_CHECK(s._deferred.empty());
+	BOOST_CHECK_EQUAL(s.get_sample(99) & 0xFF, 0x55);
+	BOOST_CHECK_EQUAL(s.get_sample(100) & 0xFF, 0xAA);
+	BOOST_CHECK_EQUAL(s.get_sample(1100) & 0xFF, 0xFF);
+
+	// Flushing appends them once the readers are done
+	{
+		shared_lock<shared_mutex> lock(s._mutex);
+		push_logic(s, 50, 0x00);
+		BOOST_CHECK_EQUAL(s._sample_count, 1112);
+	}
+
+	s.flush();
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 1162);
+	BOOST_CHECK_EQUAL(s.get_sample(1161) & 0xFF, 0x00);
+}
+
+BOOST_AUTO_TEST_CASE(IndexingThread)
+{
+	const int Length = 3 << 20;
+	const int PacketLength = 10000;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot inline_index(logic);
+	LogicSnapshot threaded_index(logic);
+	threaded_index.start_indexing_thread();
+
+	uint8_t *const data = new uint8_t[PacketLength];
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i);
+		for (uint64_t j = 0; j < logic.length; j++)
+			data[j] = (uint8_t)((i + j) / 777);
+		logic.data = data;
+		inline_index.append_payload(logic);
+		threaded_index.append_payload(logic);
+	}
+
+	delete[] data;
+
+	// The thread catches up with whatever was appended
+	for (int i = 0; i < 10000; i++) {
+		if (threaded_index.get_indexed_sample_count() ==
+			threaded_index.get_sample_count())
+			break;
+		boost::this_thread::sleep(
+			boost::posix_time::milliseconds(1));
+	}
+	BOOST_CHECK_EQUAL(threaded_index.get_indexed_sample_count(),
+		threaded_index.get_sample_count());
+
+	// Flushing leaves the snapshot fully indexed
+	threaded_index.flush();
+	BOOST_REQUIRE_EQUAL(threaded_index.get_sample_count(),
+		(uint64_t)Length);
+	BOOST_CHECK_EQUAL(threaded_index.get_indexed_sample_count(),
+		(uint64_t)Length);
+
+	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++) {
+		BOOST_REQUIRE_EQUAL(threaded_index._mip_map[i].length,
+			inline_index._mip_map[i].length);
+		BOOST_CHECK(memcmp(threaded_index._mip_map[i].data,
+			inline_index._mip_map[i].data,
+			inline_index._mip_map[i].length) == 0);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(IndexingThreadBacklog)
+{
+	// A payload of several chunks is indexed a slice at a time, and
+	// comes out as if it had been indexed in one go
+	const int Length = (3 << 20) + 1234;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = Length;
+	logic.data = new uint8_t[Length];
+	uint8_t *const data = (uint8_t*)logic.data;
+	for (int i = 0; i < Length; i++)
+		data[i] = (uint8_t)(i / 555);
+
+	LogicSnapshot inline_index(logic);
+
+	logic.length = 0;
+	LogicSnapshot threaded_index(logic);
+	threaded_index.start_indexing_thread();
+	logic.length = Length;
+	threaded_index.append_payload(logic);
+	delete[] data;
+
+	for (int i = 0; i < 10000; i++) {
+		if (threaded_index.get_indexed_sample_count() ==
+			(uint64_t)Length)
+			break;
+		boost::this_thread::sleep(
+			boost::posix_time::milliseconds(1));
+	}
+	BOOST_REQUIRE_EQUAL(threaded_index.get_indexed_sample_count(),
+		(uint64_t)Length);
+
+	{
+		LogicSnapshot::Pin pin(threaded_index);
+		for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount;
+			i++) {
+			BOOST_REQUIRE_EQUAL(threaded_index._mip_map[i].length,
+				inline_index._mip_map[i].length);
+			BOOST_CHECK(memcmp(threaded_index._mip_map[i].data,
+				inline_index._mip_map[i].data,
+				inline_index._mip_map[i].length) == 0);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(EdgeQueries)
+{
+	// Bursts of edges separated by long idle stretches, so that the
+	// searches have to climb several levels of the mip-map
+	const int Length = (1 << 21) + 4321;
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	uint8_t *const data = new uint8_t[Length];
+	uint32_t x = 1;
+	uint8_t value = 0x01;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		if ((i & 0x3FFFF) < 0x400 && (x >> 28) == 0)
+			value ^= 1 << ((x >> 8) & 7);
+		data[i] = value;
+	}
+
+	for (unsigned int l = 0; l < countof(Layouts); l++) {
+		sr_datafeed_logic logic;
+		logic.unitsize = 1;
+		logic.length = Length;
+		logic.data = data;
+		const LogicSnapshot s(logic, Layouts[l]);
+
+		for (int sig_index = 0; sig_index < 8; sig_index++) {
+			const uint8_t mask = 1 << sig_index;
+
+			// Work out the answers the slow way
+			vector<uint64_t> edges;
+			for (int i = 1; i < Length; i++)
+				if ((data[i] ^ data[i - 1]) & mask)
+					edges.push_back(i);
+
+			BOOST_CHECK_EQUAL(s.get_edge_count(0, Length,
+				sig_index), edges.size());
+
+			for (int q = 0; q < 200; q++) {
+				x = x * 1103515245 + 12345;
+				const uint64_t index = (q == 0) ? 0 :
+					(x >> 8) % Length;
+				x = x * 1103515245 + 12345;
+				const uint64_t end = index + (x >> 8) %
+					(Length - index);
+
+				LogicSnapshot::EdgePair edge;
+				vector<uint64_t>::const_iterator i = upper_bound(
+					edges.begin(), edges.end(), index);
+				if (i == edges.end())
+					BOOST_CHECK(!s.find_next_edge(index,
+						sig_index, edge));
+				else {
+					BOOST_REQUIRE(s.find_next_edge(index,
+						sig_index, edge));
+					BOOST_CHECK_EQUAL(edge.first, *i);
+					BOOST_CHECK_EQUAL(edge.second,
+						(data[*i] & mask) != 0);
+				}
+
+				i = lower_bound(edges.begin(), edges.end(),
+					index);
+				if (i == edges.begin())
+					BOOST_CHECK(!s.find_previous_edge(index,
+						sig_index, edge));
+				else {
+					BOOST_REQUIRE(s.find_previous_edge(index,
+						sig_index, edge));
+					BOOST_CHECK_EQUAL(edge.first, *(i - 1));
+				}
+
+				BOOST_CHECK_EQUAL(s.get_edge_count(index, end,
+					sig_index), (uint64_t)(lower_bound(
+					edges.begin(), edges.end(), end) - i));
+			}
+		}
+	}
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(MultiProbeEdges)
+{
+	// Bursts of edges at different rates on each probe, separated by
+	// idle stretches
+	const int Length = (1 << 20) + 999;
+
+	uint16_t *const data = new uint16_t[Length];
+	uint32_t x = 1;
+	uint16_t value = 0;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		if ((i & 0xFFFF) < 0x2000 && (x >> 29) == 0)
+			value ^= 1 << ((x >> 8) & 15);
+		data[i] = value;
+	}
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 2;
+	logic.length = Length * 2;
+	logic.data = data;
+	LogicSnapshot s(logic);
+
+	delete[] data;
+
+	const float MinLengths[] = {0.5f, 1.0f, 3.0f, 17.0f, 300.0f,
+		5000.0f};
+	const uint64_t Ranges[][2] = {{0, Length - 1}, {12345, 500000},
+		{70000, 70100}};
+	for (unsigned int i = 0; i < countof(MinLengths); i++)
+		for (unsigned int r = 0; r < countof(Ranges); r++) {
+			// Leave out some of the probes
+			vector< vector<LogicSnapshot::EdgePair> > edges;
+			s.get_subsampled_edges(edges, Ranges[r][0],
+				Ranges[r][1], MinLengths[i], 0x7FF7);
+			BOOST_REQUIRE_EQUAL(edges.size(), 16);
+
+			for (int sig_index = 0; sig_index < 16; sig_index++) {
+				if (!((0x7FF7 >> sig_index) & 1)) {
+					BOOST_CHECK(edges[sig_index].empty());
+					continue;
+				}
+
+				vector<LogicSnapshot::EdgePair> single;
+				s.get_subsampled_edges(single, Ranges[r][0],
+					Ranges[r][1], MinLengths[i], sig_index);
+				BOOST_CHECK(edges[sig_index] == single);
+			}
+		}
+}
+
+BOOST_AUTO_TEST_CASE(Reserve)
+{
+	const int Length = (1 << 20) * 2 + 777;
+	const int PacketLength = 40000;
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	uint8_t *const data = new uint8_t[Length];
+	for (int i = 0; i < Length; i++)
+		data[i] = (i >> 5) ^ (i >> 13);
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+
+	for (unsigned int l = 0; l < countof(Layouts); l++) {
+		logic.length = 0;
+		logic.data = NULL;
+		LogicSnapshot ref(logic, Layouts[l]);
+		LogicSnapshot s(logic, Layouts[l]);
+
+		BOOST_REQUIRE(s.reserve(Length));
+		BOOST_CHECK_EQUAL(s.get_sample_count(), 0);
+
+		void *mip_map[LogicSnapshot::ScaleStepCount];
+		for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++)
+			mip_map[i] = s._mip_map[i].data;
+		const vector<uint8_t*> data_chunks = s._data_chunks;
+		const vector<uint64_t*> bit_plane_chunks = s._bit_plane_chunks;
+		const uint64_t *const transition_counts = s._transition_counts;
+
+		BOOST_CHECK_EQUAL(data_chunks.size(),
+			Layouts[l] == LogicSnapshot::Interleaved ? 3 : 0);
+		BOOST_CHECK_EQUAL(bit_plane_chunks.size(),
+			Layouts[l] == LogicSnapshot::BitPlane ? 3 : 0);
+
+		for (int i = 0; i < Length; i += PacketLength) {
+			logic.length = min(PacketLength, Length - i);
+			logic.data = data + i;
+			ref.append_payload(logic);
+			s.append_payload(logic);
+		}
+
+		// Nothing may have been reallocated while appending
+		for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++)
+			BOOST_CHECK(s._mip_map[i].data == mip_map[i]);
+		BOOST_CHECK(s._data_chunks == data_chunks);
+		BOOST_CHECK(s._bit_plane_chunks == bit_plane_chunks);
+		BOOST_CHECK(s._transition_counts == transition_counts);
+
+		// The reservation must not show in the contents
+		BOOST_REQUIRE_EQUAL(s.get_sample_count(), Length);
+		for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount;
+			i++) {
+			BOOST_REQUIRE_EQUAL(s._mip_map[i].length,
+				ref._mip_map[i].length);
+			BOOST_CHECK(memcmp(s._mip_map[i].data,
+				ref._mip_map[i].data,
+				s._mip_map[i].length) == 0);
+		}
+
+		bool equal = true;
+		for (int i = 0; i < Length; i++)
+			equal = equal && (s.get_sample(i) & 0xFF) == data[i];
+		BOOST_CHECK(equal);
+		BOOST_CHECK_EQUAL(s.get_edge_count(0, Length, 3),
+			ref.get_edge_count(0, Length, 3));
+	}
+
+	// A reservation which cannot be met must leave the snapshot as it
+	// was
+	logic.length = 1000;
+	logic.data = data;
+	LogicSnapshot s(logic);
+	BOOST_CHECK(!s.reserve(1ULL << 62));
+	BOOST_CHECK_EQUAL(s._data_chunks.size(), 1);
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 1000);
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(MemoryUsage)
+{
+	const uint64_t ChunkSize = 1 << 20;
+	const int PacketLength = 1 << 16;
+
+	uint8_t *const data = new uint8_t[PacketLength];
+	for (int i = 0; i < PacketLength; i++)
+		data[i] = i >> 3;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	LogicSnapshot s(logic, LogicSnapshot::Interleaved);
+	LogicSnapshot ring(logic, LogicSnapshot::Interleaved,
+		ChunkSize * 2);
+	BOOST_CHECK_EQUAL(s.get_memory_usage(), 0);
+
+	logic.length = PacketLength;
+	logic.data = data;
+
+	// The usage counts the samples and the mip-map
+	uint64_t ring_usage = 0;
+	for (uint64_t i = 0; i < ChunkSize * 16; i += PacketLength) {
+		s.append_payload(logic);
+		ring.append_payload(logic);
+
+		// Once the index rings have been filled too
+		if (i == ChunkSize * 10)
+			ring_usage = ring.get_memory_usage();
+	}
+
+	BOOST_CHECK_EQUAL(s._data_chunks.size(), 16);
+	BOOST_CHECK_GT(s.get_memory_usage(), ChunkSize * 16);
+	BOOST_CHECK_GT(s.get_memory_usage(), ring.get_memory_usage());
+
+	// A ring buffer stays at the same size once it is full
+	BOOST_CHECK_EQUAL(ring.get_memory_usage(), ring_usage);
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(RingBuffer)
+{
+	// Keep three chunks and a bit of a stream many times longer, with
+	// bursts of edges on most probes, and rare edges on the last one
+	const uint64_t ChunkSize = 1 << 20;
+	const int Length = ChunkSize * 24 + 4321;
+	const int PacketLength = 77777;
+
+	uint8_t *const data = new uint8_t[Length];
+	uint32_t x = 1;
+	uint8_t value = 0x01;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		if ((i & 0x3FFFF) < 0x400 && (x >> 28) == 0)
+			value ^= 1 << ((x >> 8) % 7);
+		if (i % (ChunkSize * 3) == 12345)
+			value ^= 0x80;
+		data[i] = value;
+	}
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+	LogicSnapshot ref(logic);
+	LogicSnapshot s(logic, LogicSnapshot::RunLength,
+		ChunkSize * 2 + 1000);
+	BOOST_CHECK_EQUAL(s.get_layout(), LogicSnapshot::Interleaved);
+	s.start_indexing_thread();
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i);
+		logic.data = data + i;
+		ref.append_payload(logic);
+		s.append_payload(logic);
+	}
+	s.flush();
+
+	// The snapshot must have stayed at a fixed size
+	const uint64_t start = s.get_start_sample();
+	BOOST_CHECK_EQUAL(start, ChunkSize * 21);
+	BOOST_CHECK_EQUAL(s.get_sample_count(), Length);
+	BOOST_CHECK_EQUAL(s._data_chunks.size(), 4);
+	BOOST_CHECK_EQUAL(s._mip_map[0].data_length,
+		s._mip_map[0].mask + 1);
+
+	bool equal = true;
+	for (uint64_t i = start; i < (uint64_t)Length; i++)
+		equal = equal && (s.get_sample(i) & 0xFF) == data[i];
+	BOOST_CHECK(equal);
+
+	// The mip-map must match that of the whole stream wherever it
+	// covers the samples which are kept
+	for (unsigned int level = 0; level < LogicSnapshot::ScaleStepCount;
+		level++) {
+		const int level_scale_power =
+			(level + 1) * LogicSnapshot::MipMapScalePower;
+		if (s._mip_map[level].mask == 0) {
+			BOOST_CHECK(s._mip_map[level].data == NULL);
+			continue;
+		}
+
+		BOOST_REQUIRE_EQUAL(s._mip_map[level].length,
+			ref._mip_map[level].length);
+		equal = true;
+		for (uint64_t i = start >> level_scale_power;
+			i < s._mip_map[level].length; i++)
+			equal = equal && ((s.get_subsample(level, i) ^
+				ref.get_subsample(level, i)) & 0xFF) == 0;
+		BOOST_CHECK(equal);
+	}
+
+	for (int sig_index = 0; sig_index < 8; sig_index++) {
+		const uint8_t mask = 1 << sig_index;
+
+		vector<uint64_t> edges;
+		for (int i = 1; i < Length; i++)
+			if ((data[i] ^ data[i - 1]) & mask)
+				edges.push_back(i);
+
+		for (int q = 0; q < 100; q++) {
+			x = x * 1103515245 + 12345;
+			const uint64_t index = (q == 0) ? start :
+				start + (x >> 8) % (Length - start);
+			x = x * 1103515245 + 12345;
+			const uint64_t end = index + (x >> 8) % (Length - index);
+
+			LogicSnapshot::EdgePair edge;
+			vector<uint64_t>::const_iterator i = upper_bound(
+				edges.begin(), edges.end(), index);
+			if (i == edges.end())
+				BOOST_CHECK(!s.find_next_edge(index,
+					sig_index, edge));
+			else {
+				BOOST_REQUIRE(s.find_next_edge(index,
+					sig_index, edge));
+				BOOST_CHECK_EQUAL(edge.first, *i);
+			}
+
+			// Edges at the first sample kept cannot be seen,
+			// because the sample before has been discarded
+			i = lower_bound(edges.begin(), edges.end(), index);
+			if (i == edges.begin() || *(i - 1) <= start)
+				BOOST_CHECK(!s.find_previous_edge(index,
+					sig_index, edge));
+			else {
+				BOOST_REQUIRE(s.find_previous_edge(index,
+					sig_index, edge));
+				BOOST_CHECK_EQUAL(edge.first, *(i - 1));
+			}
+
+			BOOST_CHECK_EQUAL(s.get_edge_count(index, end,
+				sig_index), ref.get_edge_count(index, end,
+				sig_index));
+		}
+	}
+
+	// Edges must be extracted as they are from the whole stream
+	const float MinLengths[] = {0.5f, 3.0f, 17.0f, 300.0f, 5000.0f,
+		70000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++) {
+		vector< vector<LogicSnapshot::EdgePair> > edges, ref_edges;
+		s.get_subsampled_edges(edges, start + 999, Length - 1,
+			MinLengths[i], ~0ULL);
+		ref.get_subsampled_edges(ref_edges, start + 999, Length - 1,
+			MinLengths[i], ~0ULL);
+		BOOST_CHECK(edges == ref_edges);
+
+		vector<LogicSnapshot::EdgePair> single, ref_single;
+		s.get_subsampled_edges(single, 0, Length - 1,
+			MinLengths[i], 7);
+		ref.get_subsampled_edges(ref_single, start, Length - 1,
+			MinLengths[i], 7);
+		BOOST_CHECK(single == ref_single);
+	}
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(WideProbes)
+{
+	// Units wider than 64 probes, both a whole number of words and one
+	// with a narrow last word, with bursts of edges on every probe
+	const int UnitSizes[] = {9, 16};
+	const int Length = (1 << 20) + 3333;
+	const int PacketLength = 55555;
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	for (unsigned int u = 0; u < countof(UnitSizes); u++) {
+		const int unit_size = UnitSizes[u];
+		const int probe_count = unit_size * 8;
+
+		uint8_t *const data = new uint8_t[Length * unit_size];
+		vector<uint8_t> value(unit_size, 0x5A);
+		uint32_t x = 1;
+		for (int i = 0; i < Length; i++) {
+			x = x * 1103515245 + 12345;
+			if ((i & 0xFFFF) < 0x1000 && (x >> 27) == 0) {
+				const int probe = (x >> 8) % probe_count;
+				value[probe / 8] ^= 1 << (probe % 8);
+			}
+			memcpy(data + i * unit_size, &value[0], unit_size);
+		}
+
+		for (unsigned int l = 0; l < countof(Layouts); l++) {
+			sr_datafeed_logic logic;
+			logic.unitsize = unit_size;
+			logic.length = 0;
+			logic.data = NULL;
+			LogicSnapshot s(logic, Layouts[l]);
+			BOOST_CHECK_EQUAL(s.get_probe_count(), probe_count);
+
+			for (int i = 0; i < Length; i += PacketLength) {
+				logic.length = min(PacketLength, Length - i) *
+					unit_size;
+				logic.data = data + i * unit_size;
+				s.append_payload(logic);
+			}
+
+			const int Probes[] = {0, 7, 63, 64, 65, 71,
+				probe_count - 1};
+			for (unsigned int p = 0; p < countof(Probes); p++) {
+				const int sig_index = Probes[p];
+				const int byte = sig_index / 8;
+				const uint8_t mask = 1 << (sig_index % 8);
+
+				vector<uint64_t> edges;
+				for (int i = 1; i < Length; i++)
+					if ((data[i * unit_size + byte] ^
+						data[(i - 1) * unit_size + byte]) &
+						mask)
+						edges.push_back(i);
+				BOOST_REQUIRE(!edges.empty());
+
+				BOOST_CHECK_EQUAL(s.get_edge_count(0, Length,
+					sig_index), edges.size());
+
+				for (int q = 0; q < 50; q++) {
+					x = x * 1103515245 + 12345;
+					const uint64_t index = (x >> 8) % Length;
+
+					LogicSnapshot::EdgePair edge;
+					vector<uint64_t>::const_iterator i =
+						upper_bound(edges.begin(),
+							edges.end(), index);
+					if (i == edges.end())
+						BOOST_CHECK(!s.find_next_edge(
+							index, sig_index, edge));
+					else {
+						BOOST_REQUIRE(s.find_next_edge(
+							index, sig_index, edge));
+						BOOST_CHECK_EQUAL(edge.first, *i);
+						BOOST_CHECK_EQUAL(edge.second,
+							(data[*i * unit_size +
+							byte] & mask) != 0);
+					}
+
+					i = lower_bound(edges.begin(),
+						edges.end(), index);
+					if (i == edges.begin())
+						BOOST_CHECK(!s.find_previous_edge(
+							index, sig_index, edge));
+					else {
+						BOOST_REQUIRE(s.find_previous_edge(
+							index, sig_index, edge));
+						BOOST_CHECK_EQUAL(edge.first,
+							*(i - 1));
+					}
+				}
+
+				// At full detail every edge is listed
+				vector<LogicSnapshot::EdgePair> single;
+				s.get_subsampled_edges(single, 0, Length - 1,
+					0.5f, sig_index);
+				BOOST_REQUIRE_EQUAL(single.size(),
+					edges.size() + 2);
+				bool equal = true;
+				for (unsigned int e = 0; e < edges.size(); e++)
+					equal = equal && single[e + 1].first ==
+						(int64_t)edges[e];
+				BOOST_CHECK(equal);
+			}
+
+			// The lists of each word must match those of the
+			// signals one at a time
+			const float MinLengths[] = {0.5f, 17.0f, 5000.0f};
+			for (unsigned int i = 0; i < countof(MinLengths); i++) {
+				vector< vector<LogicSnapshot::EdgePair> > edges;
+				for (unsigned int w = 0; w < 2; w++)
+					s.get_subsampled_edges(edges, 777,
+						Length - 1, MinLengths[i],
+						~0ULL, w);
+				BOOST_REQUIRE_EQUAL(edges.size(), probe_count);
+
+				bool equal = true;
+				for (int sig_index = 0;
+					sig_index < probe_count; sig_index++) {
+					vector<LogicSnapshot::EdgePair> single;
+					s.get_subsampled_edges(single, 777,
+						Length - 1, MinLengths[i],
+						sig_index);
+					equal = equal &&
+						edges[sig_index] == single;
+				}
+				BOOST_CHECK(equal);
+			}
+		}
+
+		// A ring buffer must count the edges of the probes of the
+		// upper word from the sample before its first one
+		sr_datafeed_logic logic;
+		logic.unitsize = unit_size;
+		logic.length = 0;
+		logic.data = NULL;
+		LogicSnapshot ref(logic);
+		LogicSnapshot ring(logic, LogicSnapshot::Interleaved, 5000);
+
+		for (int r = 0; r < 3; r++)
+			for (int i = 0; i < Length; i += PacketLength) {
+				logic.length = min(PacketLength, Length - i) *
+					unit_size;
+				logic.data = data + i * unit_size;
+				ref.append_payload(logic);
+				ring.append_payload(logic);
+			}
+
+		const uint64_t start = ring.get_start_sample();
+		BOOST_REQUIRE(start > 0);
+		for (int sig_index = 64; sig_index < probe_count; sig_index++)
+			BOOST_CHECK_EQUAL(ring.get_edge_count(start,
+				ring.get_sample_count(), sig_index),
+				ref.get_edge_count(start,
+				ref.get_sample_count(), sig_index));
+
+		delete[] data;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(SampleMask)
+{
+	// The bytes read past the end of a narrow word are cleared, even
+	// though they hold the next sample
+	const int UnitSizes[] = {3, 9};
+	const int Length = 1000;
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	for (unsigned int u = 0; u < countof(UnitSizes); u++) {
+		const int unit_size = UnitSizes[u];
+		vector<uint8_t> data(Length * unit_size);
+		for (int i = 1; i < Length; i += 2)
+			memset(&data[i * unit_size], 0xFF, unit_size);
+
+		sr_datafeed_logic logic;
+		logic.unitsize = unit_size;
+		logic.length = data.size();
+		logic.data = &data[0];
+
+		for (unsigned int l = 0; l < countof(Layouts); l++) {
+			const LogicSnapshot s(logic, Layouts[l]);
+			const unsigned int last = s.get_word_count() - 1;
+			for (int i = 0; i < Length; i += 2)
+				BOOST_CHECK_EQUAL(s.get_sample(i, last), 0);
+			BOOST_CHECK_EQUAL(s.get_sample(1, last),
+				s.get_word_mask(last));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(DeferredIndexing)
+{
+	// An index built in one pass by several threads must match the
+	// one built as the samples arrive, whether or not the first
+	// samples were indexed already
+	const uint64_t ChunkSize = 1 << 20;
+	const int Length = ChunkSize * 3 + 12345;
+	const int PacketLength = 77777;
+	const int UnitSizes[] = {1, 3, 9};
+	const int FirstLengths[] = {0, 1000};
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	for (unsigned int u = 0; u < countof(UnitSizes); u++) {
+		const int unit_size = UnitSizes[u];
+		const int probe_count = unit_size * 8;
+
+		uint8_t *const data = new uint8_t[Length * unit_size];
+		uint32_t x = 1;
+		for (int i = 0; i < Length * unit_size; i++) {
+			x = x * 1103515245 + 12345;
+			data[i] = ((x >> 20) == 0) ? (x >> 8) :
+				data[max(i - unit_size, 0)];
+		}
+
+		for (unsigned int l = 0; l < countof(Layouts); l++)
+		for (unsigned int f = 0; f < countof(FirstLengths); f++) {
+			sr_datafeed_logic logic;
+			logic.unitsize = unit_size;
+			logic.length = FirstLengths[f] * unit_size;
+			logic.data = data;
+			LogicSnapshot ref(logic, Layouts[l]);
+			LogicSnapshot s(logic, Layouts[l]);
+			s.defer_indexing();
+
+			for (int i = FirstLengths[f]; i < Length;
+				i += PacketLength) {
+				logic.length = min(PacketLength, Length - i) *
+					unit_size;
+				logic.data = data + i * unit_size;
+				ref.append_payload(logic);
+				s.append_payload(logic);
+			}
+
+			s.build_index(5);
+			s.flush();
+			BOOST_CHECK_EQUAL(s.get_indexed_sample_count(),
+				Length);
+
+			// Build the levels which are left to be built as
+			// they are read
+			s.build_lazy_levels();
+
+			for (unsigned int level = 0;
+				level < LogicSnapshot::ScaleStepCount; level++) {
+				const LogicSnapshot::MipMapLevel &m =
+					s._mip_map[level];
+				BOOST_REQUIRE_EQUAL(m.length,
+					ref._mip_map[level].length);
+				BOOST_CHECK(m.length == 0 || memcmp(m.data,
+					ref._mip_map[level].data,
+					m.length * unit_size) == 0);
+			}
+
+			BOOST_REQUIRE_EQUAL(s._transition_count_length,
+				ref._transition_count_length);
+			BOOST_CHECK(memcmp(s._transition_counts,
+				ref._transition_counts,
+				s._transition_count_length * probe_count *
+				sizeof(uint64_t)) == 0);
+			BOOST_CHECK(s._last_append_sample ==
+				ref._last_append_sample);
+		}
+
+		delete[] data;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(LazyMipMap)
+{
+	// Edges are searched for before the higher levels of the mip-map
+	// have been built, and must match those of a snapshot built as the
+	// samples arrived
+	const uint64_t ChunkSize = 1 << 20;
+	const int Length = ChunkSize * 6 + 777;
+	const int PacketLength = 99999;
+
+	uint16_t *const data = new uint16_t[Length];
+	uint32_t x = 1;
+	uint16_t value = 0;
+	for (int i = 0; i < Length; i++) {
+		x = x * 1103515245 + 12345;
+		if ((i & 0x3FFFF) < 0x800 && (x >> 28) == 0)
+			value ^= 1 << ((x >> 8) & 15);
+		data[i] = value;
+	}
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 2;
+	logic.length = 0;
+	logic.data = NULL;
+	LogicSnapshot ref(logic);
+	LogicSnapshot s(logic);
+	s.defer_indexing();
+
+	for (int i = 0; i < Length; i += PacketLength) {
+		logic.length = min(PacketLength, Length - i) * 2;
+		logic.data = data + i;
+		ref.append_payload(logic);
+		s.append_payload(logic);
+	}
+
+	s.flush();
+	BOOST_REQUIRE(s._lazy_mipmap);
+	BOOST_CHECK_EQUAL(s._mip_map[1].length, ref._mip_map[1].length);
+	BOOST_CHECK(find(s._lazy_blocks[1].begin(), s._lazy_blocks[1].end(),
+		1) == s._lazy_blocks[1].end());
+
+	// Only the blocks which the search reads are built
+	vector<LogicSnapshot::EdgePair> a, b;
+	s.get_subsampled_edges(a, 12345, ChunkSize, 300.0f, 3);
+	ref.get_subsampled_edges(b, 12345, ChunkSize, 300.0f, 3);
+	BOOST_CHECK(a == b);
+	BOOST_CHECK(find(s._lazy_blocks[1].begin(), s._lazy_blocks[1].end(),
+		0) != s._lazy_blocks[1].end());
+
+	const float MinLengths[] = {1.0f, 17.0f, 5000.0f, 70000.0f};
+	for (unsigned int i = 0; i < countof(MinLengths); i++) {
+		vector< vector<LogicSnapshot::EdgePair> > edges, ref_edges;
+		s.get_subsampled_edges(edges, 0, Length - 1, MinLengths[i],
+			~0ULL);
+		ref.get_subsampled_edges(ref_edges, 0, Length - 1,
+			MinLengths[i], ~0ULL);
+		BOOST_CHECK(edges == ref_edges);
+	}
+
+	for (int sig_index = 0; sig_index < 16; sig_index++) {
+		LogicSnapshot::EdgePair edge(0, false), ref_edge(0, false);
+		BOOST_CHECK_EQUAL(s.find_next_edge(Length / 2, sig_index, edge),
+			ref.find_next_edge(Length / 2, sig_index, ref_edge));
+		BOOST_CHECK(edge == ref_edge);
+		BOOST_CHECK_EQUAL(s.find_previous_edge(Length - 1, sig_index,
+			edge), ref.find_previous_edge(Length - 1, sig_index,
+			ref_edge));
+		BOOST_CHECK(edge == ref_edge);
+	}
+
+	// Appending to a lazy snapshot builds the rest of its mip-map
+	logic.length = PacketLength * 2;
+	logic.data = data;
+	ref.append_payload(logic);
+	s.append_payload(logic);
+	BOOST_CHECK(!s._lazy_mipmap);
+
+	for (unsigned int level = 0; level < LogicSnapshot::ScaleStepCount;
+		level++) {
+		const LogicSnapshot::MipMapLevel &m = s._mip_map[level];
+		BOOST_REQUIRE_EQUAL(m.length, ref._mip_map[level].length);
+		BOOST_CHECK(m.length == 0 || memcmp(m.data,
+			ref._mip_map[level].data, m.length * 2) == 0);
+	}
+
+	delete[] data;
+}
+
+BOOST_AUTO_TEST_CASE(GetSamples)
+{
+	// Runs of varying length, so that the run-length blocks hold both
+	// few runs and many, and a tail which is not yet compressed
+	const int Length = (1 << 18) + 1234;
+	const unsigned int UnitSizes[] = {1, 3, 9};
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	for (unsigned int u = 0; u < countof(UnitSizes); u++) {
+		const unsigned int unit_size = UnitSizes[u];
+		vector<uint8_t> data(Length * unit_size);
+		uint32_t x = 1;
+		for (int i = 0; i < Length; i++) {
+			if ((i & 0xFFFF) < 0x1000 || (x >> 26) == 0)
+				x = x * 1103515245 + 12345;
+			for (unsigned int b = 0; b < unit_size; b++)
+				data[i * unit_size + b] =
+					(uint8_t)(x >> (b % 3 * 8));
+		}
+
+		for (unsigned int l = 0; l < countof(Layouts); l++) {
+			sr_datafeed_logic logic;
+			logic.unitsize = unit_size;
+			logic.length = 0;
+			logic.data = NULL;
+			LogicSnapshot s(logic, Layouts[l]);
+
+			// Append in uneven packets
+			for (int i = 0; i < Length; ) {
+				const int n = min(Length - i, 1000 + i % 7777);
+				logic.length = n * unit_size;
+				logic.data = &data[i * unit_size];
+				s.append_payload(logic);
+				i += n;
+			}
+
+			const LogicSnapshot::Pin pin(s);
+			vector<uint8_t> samples(Length * unit_size);
+			s.get_samples(pin, &samples[0], 0, Length);
+			BOOST_REQUIRE(samples == data);
+
+			for (int q = 0; q < 50; q++) {
+				x = x * 1103515245 + 12345;
+				const uint64_t start = (x >> 8) % Length;
+				x = x * 1103515245 + 12345;
+				const uint64_t end = start + (x >> 8) %
+					(Length - start);
+
+				vector<uint8_t> range((end - start) * unit_size + 1);
+				s.get_samples(pin, &range[0], start, end);
+				BOOST_REQUIRE(equal(range.begin(), range.end() - 1,
+					data.begin() + start * unit_size));
+			}
+		}
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
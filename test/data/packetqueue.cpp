@@ -0,0 +1,251 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <extdef.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "../../pv/data/packetqueue.h"
+
+using namespace std;
+
+using pv::data::PacketQueue;
+
+BOOST_AUTO_TEST_SUITE(PacketQueueTest)
+
+// The queue only passes the device through, so any address will do
+static const sr_dev_inst *const TestDevice = (const sr_dev_inst*)&TestDevice;
+
+bool push_logic(PacketQueue &q, uint8_t first, unsigned int length)
+{
+	vector<uint8_t> data(length);
+	for (unsigned int i = 0; i < length; i++)
+		data[i] = (uint8_t)(first + i);
+
+	sr_datafeed_logic logic;
+	logic.length = length;
+	logic.unitsize = 1;
+	logic.data = data.empty() ? NULL : &data[0];
+
+	sr_datafeed_packet packet;
+	packet.type = SR_DF_LOGIC;
+	packet.payload = &logic;
+
+	// The queue keeps a copy, so the source buffer is freed here
+	return q.push(TestDevice, packet);
+}
+
+void check_logic(const PacketQueue::Packet *p, uint8_t first,
+	unsigned int length)
+{
+	BOOST_REQUIRE(p);
+	BOOST_CHECK(p->type == SR_DF_LOGIC);
+	BOOST_CHECK_EQUAL(p->sdi, TestDevice);
+	BOOST_REQUIRE_EQUAL(p->logic.length, length);
+	BOOST_CHECK_EQUAL(p->logic.unitsize, 1);
+
+	const uint8_t *const data = (const uint8_t*)p->logic.data;
+	for (unsigned int i = 0; i < length; i++)
+		BOOST_REQUIRE_EQUAL(data[i], (uint8_t)(first + i));
+}
+
+BOOST_AUTO_TEST_CASE(Basic)
+{
+	PacketQueue q(4);
+	BOOST_CHECK_EQUAL(q.get_capacity(), 4);
+	BOOST_CHECK_EQUAL(q.get_depth(), 0);
+	BOOST_CHECK(q.front() == NULL);
+
+	// Push packets of each kind
+	sr_datafeed_packet header;
+	header.type = SR_DF_HEADER;
+	header.payload = NULL;
+	BOOST_CHECK(q.push(TestDevice, header));
+
+	BOOST_CHECK(push_logic(q, 10, 100));
+
+	float samples[] = {1.0f, 2.0f, 3.0f};
+	sr_datafeed_analog analog;
+	memset(&analog, 0, sizeof(analog));
+	analog.num_samples = 3;
+	analog.data = samples;
+	sr_datafeed_packet analog_packet;
+	analog_packet.type = SR_DF_ANALOG;
+	analog_packet.payload = &analog;
+	BOOST_CHECK(q.push(TestDevice, analog_packet));
+
+	BOOST_CHECK_EQUAL(q.get_depth(), 3);
+	BOOST_CHECK_EQUAL(q.get_high_water_mark(), 3);
+
+	// Pop them off in order
+	const PacketQueue::Packet *p = q.front();
+	BOOST_REQUIRE(p);
+	BOOST_CHECK(p->type == SR_DF_HEADER);
+	q.pop();
+
+	check_logic(q.front(), 10, 100);
+	q.pop();
+
+	p = q.front();
+	BOOST_REQUIRE(p);
+	BOOST_CHECK(p->type == SR_DF_ANALOG);
+	BOOST_REQUIRE_EQUAL(p->analog.num_samples, 3);
+	BOOST_CHECK(p->analog.data != samples);
+	BOOST_CHECK_EQUAL(p->analog.data[0], 1.0f);
+	BOOST_CHECK_EQUAL(p->analog.data[2], 3.0f);
+	q.pop();
+
+	BOOST_CHECK(q.front() == NULL);
+	BOOST_CHECK_EQUAL(q.get_depth(), 0);
+	BOOST_CHECK_EQUAL(q.get_high_water_mark(), 3);
+
+	q.reset_high_water_mark();
+	BOOST_CHECK_EQUAL(q.get_high_water_mark(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Full)
+{
+	PacketQueue q(2);
+
+	BOOST_CHECK(push_logic(q, 0, 8));
+	BOOST_CHECK(push_logic(q, 1, 8));
+	BOOST_CHECK(!push_logic(q, 2, 8));
+	BOOST_CHECK_EQUAL(q.get_depth(), 2);
+
+	// Freeing a slot makes room for one more
+	check_logic(q.front(), 0, 8);
+	q.pop();
+	BOOST_CHECK(push_logic(q, 2, 8));
+	BOOST_CHECK(!push_logic(q, 3, 8));
+
+	check_logic(q.front(), 1, 8);
+	q.pop();
+	check_logic(q.front(), 2, 8);
+	q.pop();
+	BOOST_CHECK(q.front() == NULL);
+	BOOST_CHECK_EQUAL(q.get_high_water_mark(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Wrap)
+{
+	// Push packets of varying lengths many times around the ring, so
+	// that each slot reuses its buffer for longer and shorter packets
+	PacketQueue q(3);
+
+	for (unsigned int i = 0; i < 100; i++) {
+		const unsigned int length = (i * 37) % 200;
+		BOOST_REQUIRE(push_logic(q, (uint8_t)i, length));
+		if (i >= 2) {
+			const unsigned int j = i - 2;
+			check_logic(q.front(), (uint8_t)j, (j * 37) % 200);
+			q.pop();
+		}
+	}
+
+	BOOST_CHECK_EQUAL(q.get_depth(), 2);
+	BOOST_CHECK_EQUAL(q.get_high_water_mark(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(Pool)
+{
+	PacketQueue q(4);
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 0);
+	BOOST_CHECK_EQUAL(q.get_pool_size(), 0);
+
+	// Packets with no payload take no buffer
+	BOOST_REQUIRE(push_logic(q, 0, 0));
+	q.pop();
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 0);
+
+	// Fill each slot with the longest packet, then pass packets of
+	// varying lengths around the ring many times
+	for (unsigned int i = 0; i < 4; i++) {
+		BOOST_REQUIRE(push_logic(q, 0, 1000));
+		q.pop();
+	}
+
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 4);
+	BOOST_CHECK_EQUAL(q.get_pool_size(), 4 * 1024);
+
+	for (unsigned int i = 0; i < 1000; i++) {
+		const unsigned int length = 1 + (i * 37) % 1000;
+		BOOST_REQUIRE(push_logic(q, (uint8_t)i, length));
+		check_logic(q.front(), (uint8_t)i, length);
+		q.pop();
+	}
+
+	// No more buffers were allocated
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 4);
+	BOOST_CHECK_EQUAL(q.get_pool_size(), 4 * 1024);
+
+	// A longer packet only grows the buffer of its own slot
+	BOOST_REQUIRE(push_logic(q, 0, 1025));
+	q.pop();
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 5);
+	BOOST_CHECK_EQUAL(q.get_pool_size(), 3 * 1024 + 2048);
+
+	q.clear_pool();
+	BOOST_CHECK_EQUAL(q.get_allocation_count(), 0);
+	BOOST_CHECK_EQUAL(q.get_pool_size(), 0);
+}
+
+void produce(PacketQueue &q, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+		while (!push_logic(q, (uint8_t)i, 1 + i % 64))
+			boost::this_thread::yield();
+}
+
+BOOST_AUTO_TEST_CASE(Threads)
+{
+	// Pass packets between two threads, and check that each arrives
+	// whole and in order
+	const unsigned int Count = 100000;
+	PacketQueue q(8);
+
+	boost::thread producer(boost::bind(&produce, boost::ref(q), Count));
+
+	for (unsigned int i = 0; i < Count; i++) {
+		const PacketQueue::Packet *p;
+		while (!(p = q.front()))
+			boost::this_thread::yield();
+
+		const unsigned int length = 1 + i % 64;
+		BOOST_REQUIRE_EQUAL(p->logic.length, length);
+		const uint8_t *const data = (const uint8_t*)p->logic.data;
+		for (unsigned int j = 0; j < length; j++)
+			BOOST_REQUIRE_EQUAL(data[j], (uint8_t)(i + j));
+		q.pop();
+	}
+
+	producer.join();
+
+	BOOST_CHECK(q.front() == NULL);
+	BOOST_CHECK(q.get_high_water_mark() <= 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,511 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <extdef.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <zlib.h>
+
+#include "../../pv/data/sessionfile.h"
+
+using namespace std;
+
+using pv::data::SessionFile;
+
+BOOST_AUTO_TEST_SUITE(SessionFileTest)
+
+/**
+ * Writes a zip archive of named entries to a temporary file.
+ */
+class TestArchive
+{
+public:
+	TestArchive() :
+		_entry_count(0)
+	{
+		char name[] = "/tmp/pulseview-test-XXXXXX";
+		const int fd = mkstemp(name);
+		BOOST_REQUIRE(fd >= 0);
+		close(fd);
+		_path = name;
+	}
+
+	~TestArchive()
+	{
+		unlink(_path.c_str());
+	}
+
+	const string& path() const
+	{
+		return _path;
+	}
+
+	void add(const string &name, const vector<uint8_t> &data,
+		bool deflated = true)
+	{
+		vector<uint8_t> compressed;
+		if (deflated) {
+			compressed.resize(compressBound(data.size()) + 16);
+
+			z_stream z;
+			memset(&z, 0, sizeof(z));
+			BOOST_REQUIRE(deflateInit2(&z, Z_DEFAULT_COMPRESSION,
+				Z_DEFLATED, -MAX_WBITS, 8,
+				Z_DEFAULT_STRATEGY) == Z_OK);
+			z.next_in = (Bytef*)(data.empty() ? NULL : &data[0]);
+			z.avail_in = data.size();
+			z.next_out = &compressed[0];
+			z.avail_out = compressed.size();
+			BOOST_REQUIRE(deflate(&z, Z_FINISH) == Z_STREAM_END);
+			compressed.resize(z.total_out);
+			deflateEnd(&z);
+		} else
+			compressed = data;
+
+		const uint32_t crc = crc32(0, data.empty() ? NULL : &data[0],
+			data.size());
+		const uint16_t method = deflated ? Z_DEFLATED : 0;
+
+		// The local header, and the data
+		const uint32_t offset = _body.size();
+		put32(_body, 0x04034b50);
+		put16(_body, 20);
+		put16(_body, 0);
+		put16(_body, method);
+		put32(_body, 0);
+		put32(_body, crc);
+		put32(_body, compressed.size());
+		put32(_body, data.size());
+		put16(_body, name.size());
+		put16(_body, 0);
+		_body.insert(_body.end(), name.begin(), name.end());
+		_body.insert(_body.end(), compressed.begin(), compressed.end());
+
+		// The central directory header
+		put32(_directory, 0x02014b50);
+		put16(_directory, 20);
+		put16(_directory, 20);
+		put16(_directory, 0);
+		put16(_directory, method);
+		put32(_directory, 0);
+		put32(_directory, crc);
+		put32(_directory, compressed.size());
+		put32(_directory, data.size());
+		put16(_directory, name.size());
+		put16(_directory, 0);
+		put16(_directory, 0);
+		put16(_directory, 0);
+		put16(_directory, 0);
+		put32(_directory, 0);
+		put32(_directory, offset);
+		_directory.insert(_directory.end(), name.begin(), name.end());
+
+		_entry_count++;
+	}
+
+	void add(const string &name, const string &text)
+	{
+		add(name, vector<uint8_t>(text.begin(), text.end()));
+	}
+
+	void write()
+	{
+		vector<uint8_t> end;
+		put32(end, 0x06054b50);
+		put16(end, 0);
+		put16(end, 0);
+		put16(end, _entry_count);
+		put16(end, _entry_count);
+		put32(end, _directory.size());
+		put32(end, _body.size());
+		put16(end, 0);
+
+		ofstream f(_path.c_str(), ios::out | ios::binary);
+		f.write((const char*)&_body[0], _body.size());
+		f.write((const char*)&_directory[0], _directory.size());
+		f.write((const char*)&end[0], end.size());
+	}
+
+private:
+	static void put16(vector<uint8_t> &v, uint16_t x)
+	{
+		v.push_back(x);
+		v.push_back(x >> 8);
+	}
+
+	static void put32(vector<uint8_t> &v, uint32_t x)
+	{
+		put16(v, x);
+		put16(v, x >> 16);
+	}
+
+private:
+	string _path;
+	vector<uint8_t> _body;
+	vector<uint8_t> _directory;
+	unsigned int _entry_count;
+};
+
+string make_metadata(unsigned int unit_size, unsigned int probe_count,
+	const string &samplerate)
+{
+	ostringstream s;
+	s << "[global]\n"
+		"sigrok version=0.2.0\n"
+		"\n"
+		"[device 1]\n"
+		"driver=demo\n"
+		"capturefile=logic-1\n"
+		"unitsize=" << unit_size << "\n"
+		"total probes=" << probe_count << "\n"
+		"samplerate=" << samplerate << "\n";
+	for (unsigned int i = 1; i <= probe_count; i++)
+		s << "probe" << i << "=P" << i << "\n";
+	return s.str();
+}
+
+vector<uint8_t> make_samples(uint64_t length, unsigned int seed)
+{
+	vector<uint8_t> data(length);
+	uint32_t x = seed;
+	for (uint64_t i = 0; i < length; i++) {
+		// Runs of repeated bytes, so the data compresses like
+		// logic samples
+		if (i % 64 == 0)
+			x = x * 1103515245 + 12345;
+		data[i] = (uint8_t)(x >> 16);
+	}
+	return data;
+}
+
+void collect(vector<uint8_t> *data, unsigned int unit_size,
+	const sr_datafeed_logic &logic)
+{
+	BOOST_REQUIRE_EQUAL(logic.unitsize, unit_size);
+	BOOST_REQUIRE_EQUAL(logic.length % unit_size, 0);
+	const uint8_t *const src = (const uint8_t*)logic.data;
+	data->insert(data->end(), src, src + logic.length);
+}
+
+void collect_analog(vector<float> *data, const sr_datafeed_analog &analog)
+{
+	data->insert(data->end(), analog.data,
+		analog.data + analog.num_samples);
+}
+
+void record_progress(uint64_t *last, uint64_t done, uint64_t total)
+{
+	BOOST_REQUIRE(done >= *last);
+	BOOST_REQUIRE(done <= total);
+	*last = done;
+}
+
+/**
+ * Cancels a read, from whichever thread receives the data.
+ */
+class CancelFlag
+{
+public:
+	CancelFlag() :
+		_cancelled(false)
+	{
+	}
+
+	void cancel()
+	{
+		boost::lock_guard<boost::mutex> lock(_mutex);
+		_cancelled = true;
+	}
+
+	bool is_cancelled() const
+	{
+		boost::lock_guard<boost::mutex> lock(_mutex);
+		return _cancelled;
+	}
+
+private:
+	mutable boost::mutex _mutex;
+	bool _cancelled;
+};
+
+void collect_and_cancel(vector<uint8_t> *data, CancelFlag *flag,
+	const sr_datafeed_logic &logic)
+{
+	collect(data, 1, logic);
+	flag->cancel();
+}
+
+BOOST_AUTO_TEST_CASE(Version1)
+{
+	// One entry holds all the samples
+	const vector<uint8_t> samples = make_samples(10 << 20, 1);
+
+	TestArchive a;
+	a.add("version", "1");
+	a.add("metadata", make_metadata(2, 12, "200 kHz"));
+	a.add("logic-1", samples);
+	a.write();
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(a.path()));
+	BOOST_CHECK_EQUAL(f.get_samplerate(), 200000);
+	BOOST_CHECK_EQUAL(f.get_unit_size(), 2);
+	BOOST_CHECK_EQUAL(f.get_total_probe_count(), 12);
+	BOOST_CHECK_EQUAL(f.get_sample_count(), samples.size() / 2);
+
+	const vector< pair<int, string> > &probes = f.get_probes();
+	BOOST_REQUIRE_EQUAL(probes.size(), 12);
+	BOOST_CHECK_EQUAL(probes[0].first, 0);
+	BOOST_CHECK_EQUAL(probes[0].second, "P1");
+	BOOST_CHECK_EQUAL(probes[11].first, 11);
+	BOOST_CHECK_EQUAL(probes[11].second, "P12");
+
+	vector<uint8_t> data;
+	uint64_t progress = 0;
+	BOOST_REQUIRE(f.read(boost::bind(&collect, &data, 2, _1),
+		SessionFile::AnalogHandler(),
+		boost::bind(&record_progress, &progress, _1, _2), 4));
+	BOOST_CHECK_EQUAL(progress, samples.size());
+	BOOST_REQUIRE(data == samples);
+}
+
+BOOST_AUTO_TEST_CASE(Version2)
+{
+	// The samples are split across chunks, some of which end part way
+	// through a sample, and some of which are stored
+	const unsigned int UnitSize = 3;
+	const vector<uint8_t> samples = make_samples(3 * 100001, 2);
+
+	TestArchive a;
+	a.add("version", "2");
+	a.add("metadata", make_metadata(UnitSize, 20, "1 MHz"));
+
+	for (unsigned int i = 0, start = 0; start < samples.size(); i++) {
+		const unsigned int end = min((unsigned int)samples.size(),
+			start + 1000 + (i * 7919) % 20000);
+		ostringstream name;
+		name << "logic-1-" << (i + 1);
+		a.add(name.str(), vector<uint8_t>(samples.begin() + start,
+			samples.begin() + end), i % 3 != 0);
+		start = end;
+	}
+	a.write();
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(a.path()));
+	BOOST_CHECK_EQUAL(f.get_samplerate(), 1000000);
+	BOOST_CHECK_EQUAL(f.get_sample_count(), 100001);
+
+	for (unsigned int threads = 1; threads <= 4; threads++) {
+		vector<uint8_t> data;
+		uint64_t progress = 0;
+		BOOST_REQUIRE(f.read(
+			boost::bind(&collect, &data, UnitSize, _1),
+			SessionFile::AnalogHandler(),
+			boost::bind(&record_progress, &progress, _1, _2),
+			threads));
+		BOOST_CHECK_EQUAL(progress, samples.size());
+		BOOST_REQUIRE(data == samples);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Analog)
+{
+	// The analog samples follow the logic samples
+	const vector<uint8_t> samples = make_samples(5000, 7);
+	vector<float> analog(3000);
+	for (unsigned int i = 0; i < analog.size(); i++)
+		analog[i] = i * 0.5f - 100.0f;
+	const uint8_t *const analog_bytes = (const uint8_t*)&analog[0];
+
+	TestArchive a;
+	a.add("version", "1");
+	a.add("metadata", make_metadata(1, 8, "1 MHz") +
+		"total analog=1\nanalog9=CH1\n");
+	a.add("logic-1", samples);
+	a.add("analog-1-9", vector<uint8_t>(analog_bytes,
+		analog_bytes + analog.size() * sizeof(float)));
+	a.write();
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(a.path()));
+	BOOST_CHECK_EQUAL(f.get_sample_count(), samples.size());
+	BOOST_REQUIRE(f.has_analog());
+	BOOST_CHECK_EQUAL(f.get_analog_probe().first, 8);
+	BOOST_CHECK_EQUAL(f.get_analog_probe().second, "CH1");
+	BOOST_CHECK_EQUAL(f.get_analog_sample_count(), analog.size());
+
+	vector<uint8_t> data;
+	vector<float> analog_data;
+	uint64_t progress = 0;
+	BOOST_REQUIRE(f.read(boost::bind(&collect, &data, 1, _1),
+		boost::bind(&collect_analog, &analog_data, _1),
+		boost::bind(&record_progress, &progress, _1, _2), 4));
+	BOOST_CHECK_EQUAL(progress, samples.size() +
+		analog.size() * sizeof(float));
+	BOOST_CHECK(data == samples);
+	BOOST_CHECK(analog_data == analog);
+
+	// A file may hold analog samples alone
+	TestArchive b;
+	b.add("version", "1");
+	b.add("metadata", "[device 1]\nsamplerate=10 kHz\n"
+		"total analog=1\nanalog1=CH1\n");
+	b.add("analog-1-1", vector<uint8_t>(analog_bytes,
+		analog_bytes + analog.size() * sizeof(float)));
+	b.write();
+
+	BOOST_REQUIRE(f.open(b.path()));
+	BOOST_CHECK(f.get_probes().empty());
+	BOOST_CHECK_EQUAL(f.get_sample_count(), 0);
+
+	analog_data.clear();
+	BOOST_REQUIRE(f.read(SessionFile::LogicHandler(),
+		boost::bind(&collect_analog, &analog_data, _1),
+		SessionFile::ProgressHandler(), 1));
+	BOOST_CHECK(analog_data == analog);
+}
+
+BOOST_AUTO_TEST_CASE(Unsupported)
+{
+	SessionFile f;
+
+	// Missing files and other archives are left to libsigrok
+	BOOST_CHECK(!f.open("/nonexistent/pulseview-test.sr"));
+
+	TestArchive a;
+	a.add("readme", "not a session");
+	a.write();
+	BOOST_CHECK(!f.open(a.path()));
+
+	TestArchive b;
+	b.add("version", "3");
+	b.add("metadata", make_metadata(1, 8, "1 MHz"));
+	b.add("logic-1", make_samples(100, 3));
+	b.write();
+	BOOST_CHECK(!f.open(b.path()));
+
+	// Files with several devices are left to libsigrok too
+	TestArchive c;
+	c.add("version", "2");
+	c.add("metadata", make_metadata(1, 8, "1 MHz") +
+		"[device 2]\ncapturefile=logic-2\nunitsize=1\n"
+		"total probes=8\nprobe1=A\n");
+	c.add("logic-1-1", make_samples(100, 4));
+	c.add("logic-2-1", make_samples(100, 5));
+	c.write();
+	BOOST_CHECK(!f.open(c.path()));
+}
+
+BOOST_AUTO_TEST_CASE(Corrupt)
+{
+	// A truncated chunk fails the load
+	vector<uint8_t> samples = make_samples(1 << 16, 6);
+
+	TestArchive a;
+	a.add("version", "2");
+	a.add("metadata", make_metadata(1, 8, "1 MHz"));
+	for (unsigned int i = 1; i <= 8; i++) {
+		ostringstream name;
+		name << "logic-1-" << i;
+		a.add(name.str(), samples);
+	}
+	a.write();
+
+	// Overwrite the middle of the file
+	{
+		fstream s(a.path().c_str(),
+			ios::in | ios::out | ios::binary);
+		s.seekp(0, ios::end);
+		const streamoff size = s.tellp();
+		s.seekp(size / 2);
+		const vector<uint8_t> junk(256, 0xFF);
+		s.write((const char*)&junk[0], junk.size());
+	}
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(a.path()));
+
+	vector<uint8_t> data;
+	BOOST_CHECK(!f.read(boost::bind(&collect, &data, 1, _1),
+		SessionFile::AnalogHandler(), SessionFile::ProgressHandler(), 4));
+}
+
+BOOST_AUTO_TEST_CASE(Cancel)
+{
+	// Reading stops at the first piece after it is cancelled
+	const vector<uint8_t> samples = make_samples(10 << 20, 8);
+
+	TestArchive a;
+	a.add("version", "1");
+	a.add("metadata", make_metadata(1, 8, "1 MHz"));
+	a.add("logic-1", samples);
+	a.write();
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(a.path()));
+
+	vector<uint8_t> data;
+	CancelFlag cancel;
+	BOOST_CHECK(!f.read(
+		boost::bind(&collect_and_cancel, &data, &cancel, _1),
+		SessionFile::AnalogHandler(), SessionFile::ProgressHandler(), 1,
+		boost::bind(&CancelFlag::is_cancelled, &cancel)));
+	BOOST_CHECK(!data.empty());
+	BOOST_CHECK(data.size() < samples.size());
+
+	// As do the threads inflating the chunks of a version 2 file
+	TestArchive b;
+	b.add("version", "2");
+	b.add("metadata", make_metadata(1, 8, "1 MHz"));
+	for (unsigned int i = 1; i <= 16; i++) {
+		ostringstream name;
+		name << "logic-1-" << i;
+		b.add(name.str(), vector<uint8_t>(samples.begin(),
+			samples.begin() + (1 << 20)));
+	}
+	b.write();
+
+	BOOST_REQUIRE(f.open(b.path()));
+
+	data.clear();
+	CancelFlag threaded_cancel;
+	BOOST_CHECK(!f.read(
+		boost::bind(&collect_and_cancel, &data, &threaded_cancel, _1),
+		SessionFile::AnalogHandler(), SessionFile::ProgressHandler(), 4,
+		boost::bind(&CancelFlag::is_cancelled, &threaded_cancel)));
+	BOOST_CHECK(data.size() < (16 << 20));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,284 @@
+/*
+ * This file is part of the PulseView project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <extdef.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "../../pv/data/analogsnapshot.h"
+#include "../../pv/data/logicsnapshot.h"
+#include "../../pv/data/sessionfile.h"
+#include "../../pv/data/sessionfilewriter.h"
+
+using namespace std;
+
+using boost::shared_ptr;
+using pv::data::AnalogSnapshot;
+using pv::data::LogicSnapshot;
+using pv::data::SessionFile;
+using pv::data::SessionFileWriter;
+
+BOOST_AUTO_TEST_SUITE(SessionFileWriterTest)
+
+/**
+ * Names a temporary file, and removes it when done.
+ */
+class TempFile
+{
+public:
+	TempFile()
+	{
+		char name[] = "/tmp/pulseview-test-XXXXXX";
+		const int fd = mkstemp(name);
+		BOOST_REQUIRE(fd >= 0);
+		close(fd);
+		_path = name;
+	}
+
+	~TempFile()
+	{
+		unlink(_path.c_str());
+	}
+
+	const string& path() const
+	{
+		return _path;
+	}
+
+private:
+	string _path;
+};
+
+vector<uint8_t> make_samples(uint64_t length, unsigned int seed)
+{
+	vector<uint8_t> data(length);
+	uint32_t x = seed;
+	for (uint64_t i = 0; i < length; i++) {
+		// Runs of repeated values, as logic samples have
+		if (i % 256 == 0)
+			x = x * 1103515245 + 12345;
+		data[i] = (uint8_t)(x >> 16);
+	}
+	return data;
+}
+
+void collect(vector<uint8_t> *data, const sr_datafeed_logic &logic)
+{
+	const uint8_t *const src = (const uint8_t*)logic.data;
+	data->insert(data->end(), src, src + logic.length);
+}
+
+void collect_analog(vector<float> *data, const sr_datafeed_analog &analog)
+{
+	data->insert(data->end(), analog.data,
+		analog.data + analog.num_samples);
+}
+
+void record_progress(uint64_t *last, uint64_t done, uint64_t total)
+{
+	BOOST_REQUIRE(done >= *last);
+	BOOST_REQUIRE(done <= total);
+	*last = done;
+}
+
+BOOST_AUTO_TEST_CASE(Logic)
+{
+	// Several blocks of samples, the last of them short
+	const unsigned int UnitSize = 2;
+	const vector<uint8_t> samples = make_samples(
+		UnitSize * ((5 << 20) + 1234), 1);
+	const LogicSnapshot::Layout Layouts[] = {LogicSnapshot::Interleaved,
+		LogicSnapshot::RunLength, LogicSnapshot::BitPlane};
+
+	vector< pair<int, string> > probes;
+	probes.push_back(make_pair(0, string("CLK")));
+	probes.push_back(make_pair(3, string("DATA")));
+	probes.push_back(make_pair(11, string("CS")));
+
+	for (unsigned int l = 0; l < countof(Layouts); l++) {
+		sr_datafeed_logic logic;
+		logic.unitsize = UnitSize;
+		logic.length = samples.size();
+		logic.data = (void*)&samples[0];
+		const shared_ptr<LogicSnapshot> snapshot(
+			new LogicSnapshot(logic, Layouts[l]));
+
+		for (unsigned int threads = 1; threads <= 4; threads += 3) {
+			TempFile t;
+			SessionFileWriter w(200000);
+			w.set_logic(snapshot, probes);
+
+			uint64_t progress = 0;
+			BOOST_REQUIRE(w.write(t.path(),
+				boost::bind(&record_progress, &progress,
+					_1, _2), threads));
+			BOOST_CHECK_EQUAL(progress, samples.size());
+
+			SessionFile f;
+			BOOST_REQUIRE(f.open(t.path()));
+			BOOST_CHECK_EQUAL(f.get_samplerate(), 200000);
+			BOOST_CHECK_EQUAL(f.get_unit_size(), UnitSize);
+			BOOST_CHECK_EQUAL(f.get_total_probe_count(), 12);
+			BOOST_CHECK(f.get_probes() == probes);
+			BOOST_CHECK(!f.has_analog());
+
+			vector<uint8_t> data;
+			BOOST_REQUIRE(f.read(boost::bind(&collect, &data, _1),
+				SessionFile::AnalogHandler(),
+				SessionFile::ProgressHandler(), 1));
+			BOOST_REQUIRE(data == samples);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Analog)
+{
+	const vector<uint8_t> samples = make_samples(1000, 2);
+	vector<float> analog((3 << 20) + 17);
+	for (unsigned int i = 0; i < analog.size(); i++)
+		analog[i] = (float)(i % 1000) * 0.25f - 10.0f;
+
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = samples.size();
+	logic.data = (void*)&samples[0];
+	const shared_ptr<LogicSnapshot> logic_snapshot(
+		new LogicSnapshot(logic));
+
+	sr_datafeed_analog a;
+	memset(&a, 0, sizeof(a));
+	a.num_samples = analog.size();
+	a.data = &analog[0];
+	const shared_ptr<AnalogSnapshot> analog_snapshot(
+		new AnalogSnapshot(a));
+
+	vector< pair<int, string> > probes;
+	probes.push_back(make_pair(0, string("D0")));
+	probes.push_back(make_pair(7, string("D7")));
+
+	// The analog probe follows the logic probes
+	{
+		TempFile t;
+		SessionFileWriter w(1000000);
+		w.set_logic(logic_snapshot, probes);
+		w.set_analog(analog_snapshot, "CH1");
+
+		uint64_t progress = 0;
+		BOOST_REQUIRE(w.write(t.path(),
+			boost::bind(&record_progress, &progress, _1, _2), 4));
+		BOOST_CHECK_EQUAL(progress, samples.size() +
+			analog.size() * sizeof(float));
+
+		SessionFile f;
+		BOOST_REQUIRE(f.open(t.path()));
+		BOOST_CHECK_EQUAL(f.get_samplerate(), 1000000);
+		BOOST_REQUIRE(f.has_analog());
+		BOOST_CHECK_EQUAL(f.get_analog_probe().first, 8);
+		BOOST_CHECK_EQUAL(f.get_analog_probe().second, "CH1");
+
+		vector<uint8_t> data;
+		vector<float> analog_data;
+		BOOST_REQUIRE(f.read(boost::bind(&collect, &data, _1),
+			boost::bind(&collect_analog, &analog_data, _1),
+			SessionFile::ProgressHandler(), 4));
+		BOOST_CHECK(data == samples);
+		BOOST_CHECK(analog_data == analog);
+	}
+
+	// Or is saved alone
+	{
+		TempFile t;
+		SessionFileWriter w(12345);
+		w.set_analog(analog_snapshot, "CH1");
+		BOOST_REQUIRE(w.write(t.path(),
+			SessionFileWriter::ProgressHandler(), 2));
+
+		SessionFile f;
+		BOOST_REQUIRE(f.open(t.path()));
+		BOOST_CHECK_EQUAL(f.get_samplerate(), 12345);
+		BOOST_CHECK(f.get_probes().empty());
+		BOOST_REQUIRE(f.has_analog());
+		BOOST_CHECK_EQUAL(f.get_analog_probe().first, 0);
+
+		vector<float> analog_data;
+		BOOST_REQUIRE(f.read(SessionFile::LogicHandler(),
+			boost::bind(&collect_analog, &analog_data, _1),
+			SessionFile::ProgressHandler(), 1));
+		BOOST_CHECK(analog_data == analog);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Empty)
+{
+	// A snapshot with no samples still makes a file which can be read
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+	const shared_ptr<LogicSnapshot> snapshot(new LogicSnapshot(logic));
+
+	vector< pair<int, string> > probes;
+	probes.push_back(make_pair(0, string("D0")));
+
+	TempFile t;
+	SessionFileWriter w(1000);
+	w.set_logic(snapshot, probes);
+	BOOST_REQUIRE(w.write(t.path(), SessionFileWriter::ProgressHandler(),
+		4));
+
+	SessionFile f;
+	BOOST_REQUIRE(f.open(t.path()));
+	BOOST_CHECK_EQUAL(f.get_sample_count(), 0);
+
+	vector<uint8_t> data;
+	BOOST_REQUIRE(f.read(boost::bind(&collect, &data, _1),
+		SessionFile::AnalogHandler(), SessionFile::ProgressHandler(),
+		1));
+	BOOST_CHECK(data.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Unwritable)
+{
+	sr_datafeed_logic logic;
+	logic.unitsize = 1;
+	logic.length = 0;
+	logic.data = NULL;
+
+	vector< pair<int, string> > probes;
+	probes.push_back(make_pair(0, string("D0")));
+
+	SessionFileWriter w(1000);
+	w.set_logic(shared_ptr<LogicSnapshot>(new LogicSnapshot(logic)),
+		probes);
+	BOOST_CHECK(!w.write("/nonexistent/pulseview-test.sr",
+		SessionFileWriter::ProgressHandler(), 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()